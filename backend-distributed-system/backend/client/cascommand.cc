@@ -0,0 +1,22 @@
+#include "cascommand.h"
+#include "../common/common.h"
+
+using namespace std;
+
+void CasCommand::Handle(const std::string &line) {
+    vector<string> tokens = split(line);
+    assert(tokens.size() >= 4);
+    string key = tokens[1];
+    uint64_t version = std::stoull(tokens[2]);
+    string value = tokens[3];
+    for(int i = 4; i < tokens.size(); i++) {
+        // assumes single space delimiter for now
+        value += " " + tokens[i];
+    }
+    client.Put(key, value, "", version);
+}
+
+void CasCommand::PrintHelpMessage() {
+    std::cout << "cas <key> <version> <value>\nmaps <key> to <value> if <key> is still at <version>, as printed by get. "
+                 "version 0 stands for a key that does not exist yet\n";
+}
@@ -0,0 +1,18 @@
+#ifndef SHARDING_CASCOMMAND_H
+#define SHARDING_CASCOMMAND_H
+
+#include "../repl/regexcommand.h"
+#include "client.h"
+
+class CasCommand : public RegexCommand {
+public:
+    // match: cas <key> <version> <value>
+    explicit CasCommand(Client& cl) : RegexCommand("cas .+"), client(cl) {}
+    void Handle(const std::string& line) override;
+    void PrintHelpMessage() override;
+private:
+    Client& client;
+};
+
+
+#endif //SHARDING_CASCOMMAND_H
@@ -3,10 +3,33 @@
 //
 
 #include <iostream>
+#include <memory>
+#include <random>
+#include <type_traits>
 
 #include "client.h"
 #include "../build/shardkv.grpc.pb.h"
 
+// whether sending req a second time does no harm. writes do, unless they
+// carry an id the group can tell a retry by: a put adds to the user and post
+// lists again, and a delete that went through fails the second time
+template <typename Request>
+static bool idempotent(const Request&) {
+    return true;
+}
+
+static bool idempotent(const PutRequest& req) {
+    return req.id().client_id() != 0 || req.if_absent();
+}
+
+static bool idempotent(const AppendRequest& req) {
+    return req.id().client_id() != 0;
+}
+
+static bool idempotent(const DeleteRequest& req) {
+    return req.id().client_id() != 0;
+}
+
 // helper to log errors
 void logError(const std::string& method, Status& error) {
     assert(!error.ok());
@@ -17,12 +40,18 @@ void logError(const std::string& method, Status& error) {
 void Client::Query() {
     Empty query;
     QueryResponse response;
-    ClientContext cc;
-
-    Status status = stub->Query(&cc, query, &response);
+    Status status = retries.Call(shardmasterAddress, [&]() {
+        ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+        return stub->Query(&cc, query, &response);
+    });
     if(status.ok()) {
         // start by resetting config
         configuration.Clear();
+        configVersion = response.version();
+        // shardmasters that predate configurable key spaces leave it unset
+        configuration.SetKeySpace(response.max_key() != 0 ? response.max_key() : MAX_KEY,
+                                  static_cast<Partitioning>(response.partitioning()));
         for(const auto& config : response.config()) {
             // now set up shards
             for(const auto& shard : config.shards()) {
@@ -38,6 +67,7 @@ void Client::Move(const std::string& server, const shard_t &shard) {
     MoveRequest req;
     Empty response;
     ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
 
     req.set_server(server);
     req.mutable_shard()->set_upper(shard.upper);
@@ -48,12 +78,14 @@ void Client::Move(const std::string& server, const shard_t &shard) {
     }
 }
 
-void Client::Join(const std::string& server) {
+void Client::Join(const std::string& server, unsigned int weight) {
     JoinRequest req;
     Empty response;
     ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
 
     req.set_server(server);
+    req.set_weight(weight);
     Status status = stub->Join(&cc, req, &response);
     if(!status.ok()) {
         logError("Join", status);
@@ -64,6 +96,7 @@ void Client::Leave(const std::vector<std::string>& servers) {
     LeaveRequest req;
     Empty response;
     ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
 
     for (const std::string& server : servers) {
         req.add_servers(server);
@@ -79,20 +112,16 @@ void Client::PrintConfig() {
     configuration.Print();
 }
 
-void Client::Get(const std::string& key) {
+void Client::Get(const std::string& key, GetRequest::Consistency consistency, uint32_t maxStalenessMs) {
+    GetRequest req;
+    req.set_key(key);
+    req.set_consistency(consistency);
+    req.set_max_staleness_ms(maxStalenessMs);
     if (key == "all_users") {
         std::vector<std::string> servers = configuration.AllServers();
         for (std::string server : servers) {
-            auto channel = grpc::CreateChannel(server, grpc::InsecureChannelCredentials());
-            auto kvStub = Shardkv::NewStub(channel);
-            std::cout << "Get server: " << server << "\n";
-
-            ::grpc::ClientContext cc;
-            GetRequest req;
             GetResponse res;
-            req.set_key(key);
-
-            auto status = kvStub->Get(&cc, req, &res);
+            auto status = getFrom(server, req, &res);
             if(status.ok()) {
                 std::cout << "Get returned: " << res.data() << "\n";
             } else {
@@ -100,43 +129,276 @@ void Client::Get(const std::string& key) {
             }
         }
     } else {
-        auto kvStub = getKVStub(key);
-        if(kvStub == nullptr) {
+        auto owner = configuration.GetServer(key);
+        if(!owner.has_value()) {
+            Query();
             return;
         }
+        auto cached = readCache.find(key);
+        if(cached != readCache.end()) {
+            req.set_known_version(cached->second.first);
+        }
+        // reads of a hot key are spread over its owner and the groups holding
+        // copies of it
+        std::string server = owner.value();
+        auto hint = hotCopies.find(key);
+        if(hint != hotCopies.end()) {
+            size_t pick = nextCopy++ % (hint->second.size() + 1);
+            if(pick > 0) server = hint->second[pick - 1];
+        }
 
-        unsigned int key_id = (unsigned int)extractID(key);
-        std::cout << "Get server: " << configuration.GetServer(key_id).value() << "\n";
-
-        ::grpc::ClientContext cc;
-        GetRequest req;
         GetResponse res;
-        req.set_key(key);
-
-        auto status = kvStub->Get(&cc, req, &res);
+        auto status = getFrom(server, req, &res);
+        if(!status.ok() && server != owner.value()) {
+            // the copy was dropped or its group is gone, the owner has the key
+            hotCopies.erase(key);
+            server = owner.value();
+            res.Clear();
+            status = getFrom(server, req, &res);
+        }
+        auto moved = configuration.GetServer(key);
+        if(!status.ok() && moved.has_value() && moved != owner) {
+            // the owner we knew of named the group that owns key now
+            std::cout << "Redirected to: " << moved.value() << "\n";
+            owner = moved;
+            server = owner.value();
+            res.Clear();
+            status = getFrom(server, req, &res);
+        }
+        if(status.ok() && server == owner.value()) {
+            if(res.copies_size() > 0) {
+                hotCopies[key].assign(res.copies().begin(), res.copies().end());
+            } else {
+                hotCopies.erase(key);
+            }
+        }
         if(status.ok()) {
+            if(res.not_modified()) {
+                res.set_data(cached->second.second);
+            } else {
+                readCache[key] = {res.version(), res.data()};
+            }
             std::cout << "Get returned: " << res.data() << "\n";
+            std::cout << "Version: " << res.version() << "\n";
         } else {
+            readCache.erase(key);
             logError("Get", status);
         }
     }
 }
 
-void Client::Delete(const std::string& key) {
-    auto kvStub = getKVStub(key);
-    if(kvStub == nullptr) {
+// helper for reading key from the group at server
+Status Client::getFrom(const std::string& server, GetRequest req, GetResponse* res) {
+    std::cout << "Get server: " << server << "\n";
+    if(req.consistency() == GetRequest::STRONG) {
+        return hedging.Enabled() ? hedgedGet(server, req, res) : callGroup(server, &Shardkv::Stub::Get, req, res);
+    }
+    auto seq = writeSeqs.find(server);
+    req.set_min_seq(seq == writeSeqs.end() ? 0 : seq->second);
+    // every other read goes to the backup, which turns it away if it is too
+    // far behind the primary
+    auto view = views.find(server);
+    if(view != views.end() && !view->second.backup().empty() && nextReplica++ % 2 == 1) {
+        auto kvStub = Shardkv::NewStub(grpc::CreateChannel(view->second.backup(), grpc::InsecureChannelCredentials()));
+        ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+        auto status = kvStub->Get(&cc, req, res);
+        if(status.ok() || status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) {
+            return status;
+        }
+        res->Clear();
+    }
+    return callGroup(server, &Shardkv::Stub::Get, req, res);
+}
+
+Status Client::hedgedGet(const std::string& server, const GetRequest& req, GetResponse* res) {
+    if(!views.count(server)) {
+        refreshView(server);
+    }
+    auto found = views.find(server);
+    if(found == views.end()) {
+        return callGroup(server, &Shardkv::Stub::Get, req, res);
+    }
+    // strong reads go to the primary or the tail, hedges to the replica before
+    // it. the head of a chain serves no relaxed reads
+    const ViewResponse& view = found->second;
+    int length = view.chain_size();
+    std::string target = length > 0 ? view.chain(length - 1) : view.primary();
+    std::string replica = length > 2 ? view.chain(length - 2) : length > 0 ? "" : view.backup();
+    if(replica.empty()) {
+        return callGroup(server, &Shardkv::Stub::Get, req, res);
+    }
+    GetRequest hedge(req);
+    hedge.set_consistency(GetRequest::BOUNDED);
+    hedge.set_max_staleness_ms(hedging.Options().maxStalenessMs);
+    std::string number = std::to_string(view.view());
+    auto status = HedgedCall<GetResponse>(
+            hedging,
+            [&](ClientContext* cc, GetResponse* r) {
+                auto kvStub = Shardkv::NewStub(grpc::CreateChannel(target, grpc::InsecureChannelCredentials()));
+                cc->AddMetadata(VIEW_METADATA, number);
+                return kvStub->Get(cc, req, r);
+            },
+            [&](ClientContext* cc, GetResponse* r) {
+                auto kvStub = Shardkv::NewStub(grpc::CreateChannel(replica, grpc::InsecureChannelCredentials()));
+                return kvStub->Get(cc, hedge, r);
+            },
+            res);
+    if(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION ||
+       status.error_code() == grpc::StatusCode::UNAVAILABLE) {
+        // our view is out of date, the usual path finds the current one
+        res->Clear();
+        return callGroup(server, &Shardkv::Stub::Get, req, res);
+    }
+    return status;
+}
+
+template <typename Request, typename Response>
+Status Client::callGroup(const std::string& group,
+                         Status (Shardkv::Stub::*call)(ClientContext*, const Request&, Response*),
+                         const Request& req, Response* res) {
+    if(!views.count(group)) {
+        refreshView(group);
+    }
+    // the first try may be turned away by a member that is no longer primary,
+    // the second goes to the primary it named
+    for(int attempt = 0; attempt < 2; attempt++) {
+        auto view = views.find(group);
+        if(view == views.end()) {
+            break;
+        }
+        // a chain serves strong reads from its tail
+        bool chainRead = std::is_same<Request, GetRequest>::value && view->second.chain_size() > 0;
+        const std::string& target = chainRead ? *view->second.chain().rbegin() : view->second.primary();
+        auto kvStub = Shardkv::NewStub(grpc::CreateChannel(target, grpc::InsecureChannelCredentials()));
+        ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+        cc.AddMetadata(VIEW_METADATA, std::to_string(view->second.view()));
+        // tried once, a member that is down is left to the manager. its
+        // breaker spares us the wait on it while it stays down
+        auto status = retries.Call(target, [&]() {
+            return (kvStub.get()->*call)(&cc, req, res);
+        }, false);
+        if(status.error_code() != grpc::StatusCode::FAILED_PRECONDITION &&
+           status.error_code() != grpc::StatusCode::UNAVAILABLE) {
+            recordSeq(group, cc);
+            learnOwner(cc);
+            return status;
+        }
+        res->Clear();
+        const auto& trailer = cc.GetServerTrailingMetadata();
+        auto primary = trailer.find(PRIMARY_METADATA);
+        auto number = trailer.find(VIEW_METADATA);
+        std::string named = primary == trailer.end() ? "" : std::string(primary->second.begin(), primary->second.end());
+        if(!chainRead && !named.empty() && named != view->second.primary() && number != trailer.end()) {
+            // redirected to the primary the member we reached knows of
+            view->second.set_primary(named);
+            view->second.set_view(std::stoul(std::string(number->second.begin(), number->second.end())));
+        } else if(!refreshView(group)) {
+            break;
+        }
+    }
+    // the manager always knows its primary
+    auto kvStub = Shardkv::NewStub(grpc::CreateChannel(group, grpc::InsecureChannelCredentials()));
+    std::unique_ptr<ClientContext> cc;
+    // a write that may have been applied is not sent again, unless the
+    // group can tell it was
+    auto status = retries.Call(group, [&]() {
+        cc = std::make_unique<ClientContext>();
+        cc->set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+        res->Clear();
+        return (kvStub.get()->*call)(cc.get(), req, res);
+    }, idempotent(req));
+    if(cc) {
+        recordSeq(group, *cc);
+        learnOwner(*cc);
+    }
+    return status;
+}
+
+template <typename Request, typename Response>
+Status Client::callOwner(const std::string& key, const std::string& server,
+                         Status (Shardkv::Stub::*call)(ClientContext*, const Request&, Response*),
+                         const Request& req, Response* res) {
+    auto status = callGroup(server, call, req, res);
+    auto owner = configuration.GetServer(key);
+    if(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT && owner.has_value() && owner.value() != server) {
+        std::cout << "Redirected to: " << owner.value() << "\n";
+        res->Clear();
+        status = callGroup(owner.value(), call, req, res);
+    }
+    return status;
+}
+
+void Client::recordSeq(const std::string& group, const ClientContext& cc) {
+    const auto& trailer = cc.GetServerTrailingMetadata();
+    auto seq = trailer.find(SEQ_METADATA);
+    if(seq == trailer.end()) {
         return;
     }
+    uint64_t written = std::stoull(std::string(seq->second.begin(), seq->second.end()));
+    writeSeqs[group] = std::max(writeSeqs[group], written);
+}
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Delete server: " << configuration.GetServer(key_id).value() << "\n";
+void Client::learnOwner(const ClientContext& cc) {
+    const auto& trailer = cc.GetServerTrailingMetadata();
+    auto owner = trailer.find(OWNER_METADATA);
+    auto shard = trailer.find(OWNER_SHARD_METADATA);
+    auto version = trailer.find(CONFIG_VERSION_METADATA);
+    if(owner == trailer.end() || shard == trailer.end() || version == trailer.end()) {
+        return;
+    }
+    uint64_t hinted = std::stoull(std::string(version->second.begin(), version->second.end()));
+    std::string bounds(shard->second.begin(), shard->second.end());
+    size_t dash = bounds.find('-');
+    if(hinted < configVersion || dash == std::string::npos) {
+        return;
+    }
+    configuration.Assign(std::string(owner->second.begin(), owner->second.end()),
+                         {std::stoull(bounds.substr(0, dash)), std::stoull(bounds.substr(dash + 1))});
+    configVersion = hinted;
+}
+
+void Client::stamp(RequestId* id) {
+    id->set_client_id(clientId);
+    id->set_seq(++lastSeq);
+}
+
+uint64_t Client::newClientId() {
+    std::random_device random;
+    std::uniform_int_distribution<uint64_t> ids(1, UINT64_MAX);
+    return ids(random);
+}
+
+bool Client::refreshView(const std::string& group) {
+    auto kvStub = Shardkv::NewStub(grpc::CreateChannel(group, grpc::InsecureChannelCredentials()));
+    ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+    ViewResponse view;
+    if(!kvStub->GetView(&cc, Empty(), &view).ok() || view.primary().empty()) {
+        views.erase(group);
+        return false;
+    }
+    views[group] = view;
+    return true;
+}
+
+void Client::Delete(const std::string& key, uint64_t ifVersion) {
+    auto server = configuration.GetServer(key);
+    if(!server.has_value()) {
+        Query();
+        return;
+    }
+
+    std::cout << "Delete server: " << server.value() << "\n";
 
-    ::grpc::ClientContext cc;
     DeleteRequest req;
     Empty res;
     req.set_key(key);
+    req.set_if_version(ifVersion);
+    stamp(req.mutable_id());
 
-    auto status = kvStub->Delete(&cc, req, &res);
+    auto status = callOwner(key, server.value(), &Shardkv::Stub::Delete, req, &res);
     if(status.ok()) {
         std::cout << "Deleted" <<"\n";
     } else {
@@ -144,61 +406,48 @@ void Client::Delete(const std::string& key) {
     }
 }
 
-void Client::Put(const std::string &key, const std::string &value, const std::string &user_id) {
-    auto kvStub = getKVStub(key);
-    if(kvStub == nullptr) {
+void Client::Put(const std::string &key, const std::string &value, const std::string &user_id,
+                 uint64_t ifVersion) {
+    auto server = configuration.GetServer(key);
+    if(!server.has_value()) {
+        Query();
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Put server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Put server: " << server.value() << "\n";
 
-    ::grpc::ClientContext cc;
     PutRequest req;
     Empty res;
     req.set_key(key);
     req.set_data(value);
     req.set_user(user_id);
+    req.set_if_version(ifVersion);
+    stamp(req.mutable_id());
 
-    auto status = kvStub->Put(&cc, req, &res);
+    auto status = callOwner(key, server.value(), &Shardkv::Stub::Put, req, &res);
      if(!status.ok()) {
         logError("Put", status);
     }
 }
 
-void Client::Append(const std::string &key, const std::string &value) {
-    auto kvStub = getKVStub(key);
-    if(kvStub == nullptr) {
+void Client::Append(const std::string &key, const std::string &value, uint64_t ifVersion) {
+    auto server = configuration.GetServer(key);
+    if(!server.has_value()) {
+        Query();
         return;
     }
 
-    unsigned int key_id = (unsigned int)extractID(key);
-    std::cout << "Append server: " << configuration.GetServer(key_id).value() << "\n";
+    std::cout << "Append server: " << server.value() << "\n";
 
-    ::grpc::ClientContext cc;
     AppendRequest req;
     Empty res;
     req.set_key(key);
     req.set_data(value);
+    req.set_if_version(ifVersion);
+    stamp(req.mutable_id());
 
-    auto status = kvStub->Append(&cc, req, &res);
+    auto status = callOwner(key, server.value(), &Shardkv::Stub::Append, req, &res);
     if(!status.ok()) {
         logError("Append", status);
     }
 }
-
-// helper for getting key-value server stubs given a key. returns nullptr on error
-std::unique_ptr<Shardkv::Stub> Client::getKVStub(const std::string key) {
-    // get servername
-    unsigned int key_id = (unsigned int)extractID(key);
-    auto addr = configuration.GetServer(key_id);
-    if(!addr.has_value()) {
-        // not sure how we could get this case UNLESS we have just never run query, so we'll just do that I guess
-        // oh I guess this could happen if the key is out of range too... think more about this - can we assume it
-        // doesn't happen?
-        Query();
-        return nullptr;
-    }
-    auto channel = grpc::CreateChannel(addr.value(), grpc::InsecureChannelCredentials());
-    return Shardkv::NewStub(channel);
-}
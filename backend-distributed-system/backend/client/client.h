@@ -12,6 +12,9 @@
 #include "../build/shardmaster.grpc.pb.h"
 #include "../build/shardkv.grpc.pb.h"
 #include "../common/common.h"
+#include "../common/hedging.h"
+#include "../common/retry.h"
+#include "../common/rpc.h"
 #include "../config/config.h"
 
 using grpc::Channel;
@@ -21,12 +24,13 @@ using grpc::ClientContext;
 class Client {
     using Empty = google::protobuf::Empty;
 public:
-    explicit Client(const std::string& addr) :
-        stub(Shardmaster::NewStub(grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()))) {}
+    explicit Client(const std::string& addr, const HedgeOptions& hedge = HedgeOptions()) :
+        stub(Shardmaster::NewStub(grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()))),
+        shardmasterAddress(addr), hedging(hedge), clientId(newClientId()) {}
 
     void Query();
 
-    void Join(const std::string& server);
+    void Join(const std::string& server, unsigned int weight = 0);
 
     void Leave(const std::vector<std::string>& servers);
 
@@ -34,22 +38,96 @@ public:
 
     void PrintConfig();
 
-    void Get(const std::string& key);
+    // reads key, from the backup of its group as well if consistency allows
+    // it, see GetRequest. READ_YOUR_WRITES reads see every write we made
+    void Get(const std::string& key, GetRequest::Consistency consistency = GetRequest::STRONG,
+             uint32_t maxStalenessMs = 0);
 
-    void Put(const std::string& key, const std::string& value, const std::string& user_id);
+    // the writes below take an ifVersion as given by Get. if it is not 0, the
+    // write fails unless key is still at that version, see PutRequest
+    void Put(const std::string& key, const std::string& value, const std::string& user_id,
+             uint64_t ifVersion = 0);
 
-    void Append(const std::string& key, const std::string& value);
+    void Append(const std::string& key, const std::string& value, uint64_t ifVersion = 0);
 
-    void Delete(const std::string& key);
+    void Delete(const std::string& key, uint64_t ifVersion = 0);
 
 private:
-    // helper for getting stubs to shardkv servers given a key
-    std::unique_ptr<Shardkv::Stub> getKVStub(const std::string key);
+    // sends a request to the primary of the group managed at group, as named
+    // by the view we cached for it, saving the hop through the manager. a
+    // primary that turns us away points us to the current one, and we go
+    // through the manager if that fails too or the group has no view yet
+    template <typename Request, typename Response>
+    Status callGroup(const std::string& group,
+                     Status (Shardkv::Stub::*call)(ClientContext*, const Request&, Response*),
+                     const Request& req, Response* res);
+
+    // sends a request for key to the group at server with callGroup. if that
+    // group no longer owns key and names the one that does, the request is
+    // sent there right away
+    template <typename Request, typename Response>
+    Status callOwner(const std::string& key, const std::string& server,
+                     Status (Shardkv::Stub::*call)(ClientContext*, const Request&, Response*),
+                     const Request& req, Response* res);
+
+    // asks the manager at group for its current view. returns false, dropping
+    // what we had cached, if it has none
+    bool refreshView(const std::string& group);
+
+    // keeps the sequence number a write to group got, see SEQ_METADATA
+    void recordSeq(const std::string& group, const ClientContext& cc);
+
+    // takes in the owner a group that turned us away named, see
+    // OWNER_METADATA, unless our configuration is newer
+    void learnOwner(const ClientContext& cc);
+
+    // names a write as the next one of ours, see RequestId
+    void stamp(RequestId* id);
+
+    // a random id, 0 aside, that no other client is likely to have
+    static uint64_t newClientId();
+
+    // helper for reading key from the group at server
+    Status getFrom(const std::string& server, GetRequest req, GetResponse* res);
+
+    // a strong read from the group at server that is sent to a replica as
+    // well if it is slow to return, see HedgeOptions
+    Status hedgedGet(const std::string& server, const GetRequest& req, GetResponse* res);
 
     // grpc stub
     std::unique_ptr<Shardmaster::Stub> stub;
+    const std::string shardmasterAddress;
 
     Config configuration;
+    // the version of configuration, or of the last owner we learnt of
+    uint64_t configVersion = 0;
+
+    // the view of each group, by the address of its manager as found in
+    // configuration
+    std::map<std::string, ViewResponse> views;
+    // the latest sequence number a write of ours got at each group, by the
+    // address of its manager
+    std::map<std::string, uint64_t> writeSeqs;
+    // spreads reads that allow it over the primary and the backup
+    size_t nextReplica = 0;
+    // when to hedge strong reads
+    HedgePolicy hedging;
+    // how calls to the shardmaster and to groups are retried, and which of
+    // them are taken for down
+    RetryPolicy retries;
+    // our writes carry this id and a number counting up, so groups apply
+    // them once however often we send them
+    const uint64_t clientId;
+    uint64_t lastSeq = 0;
+
+    // the last value and version we read of each key. reads send the
+    // version, and are not sent the value back if it is still current
+    std::map<std::string, std::pair<uint64_t, std::string>> readCache;
+
+    // groups holding read-only copies of hot keys, as last told by their owners
+    std::map<std::string, std::vector<std::string>> hotCopies;
+    // spreads reads of hot keys round robin over the owner and the copies
+    size_t nextCopy = 0;
 };
 
 
@@ -9,11 +9,12 @@ using namespace std;
 
 void DeleteCommand::Handle(const std::string &line) {
     vector<string> tokens = split(line);
-    assert(tokens.size() == 2);
+    assert(tokens.size() == 2 || tokens.size() == 3);
     string key = tokens[1];
-    client.Delete(key);
+    client.Delete(key, tokens.size() == 3 ? std::stoull(tokens[2]) : 0);
 }
 
 void DeleteCommand::PrintHelpMessage() {
-    std::cout << "del <key>\ndeletes <key> and the associated value, prints an error if the key is not found\n";
+    std::cout << "del <key>\ndeletes <key> and the associated value, prints an error if the key is not found. with a <version>, "
+                 "as printed by get, only deletes <key> if it is still at that version\n";
 }
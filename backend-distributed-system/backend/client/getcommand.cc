@@ -9,11 +9,19 @@ using namespace std;
 
 void GetCommand::Handle(const std::string &line) {
     vector<string> tokens = split(line);
-    assert(tokens.size() == 2);
+    assert(tokens.size() >= 2 && tokens.size() <= 4);
     string key = tokens[1];
-    client.Get(key);
+    if (tokens.size() == 2 || tokens[2] == "strong") {
+        client.Get(key);
+    } else if (tokens[2] == "bounded") {
+        client.Get(key, GetRequest::BOUNDED, tokens.size() == 4 ? std::stoul(tokens[3]) : 0);
+    } else {
+        client.Get(key, GetRequest::READ_YOUR_WRITES);
+    }
 }
 
 void GetCommand::PrintHelpMessage() {
-    std::cout << "get <key>\nretrieves the value associated with <key>, prints an error if the key is not found\n";
+    std::cout << "get <key> [strong | bounded <ms> | session]\nretrieves the value associated with <key>, prints an error if the key is not found. "
+                 "bounded reads may be served by a backup at most <ms> behind its primary, session reads by a backup "
+                 "that has all of our writes\n";
 }
@@ -11,7 +11,7 @@
 
 class GetCommand : public RegexCommand {
 public:
-    // matches: get <key>
+    // matches: get <key> [strong | bounded <ms> | session]
     explicit GetCommand(Client& cl) : RegexCommand("get .+"), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override ;
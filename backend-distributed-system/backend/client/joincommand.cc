@@ -9,11 +9,11 @@ using namespace std;
 void JoinCommand::Handle(const string &line) {
     vector<string> tokens = split(line);
     assert(tokens[0] == "join");
-    assert(tokens.size() == 2);
-    client.Join(tokens[1]);
+    assert(tokens.size() == 2 || tokens.size() == 3);
+    client.Join(tokens[1], tokens.size() == 3 ? std::stoul(tokens[2]) : 0);
 }
 
 void JoinCommand::PrintHelpMessage() {
-    cout << "join <address>\ntells the shardmaster that a key-value server running on the specified address is "
-            " available to distribute shards onto\n";
+    cout << "join <address> [weight]\ntells the shardmaster that a key-value server running on the specified address is "
+            " available to distribute shards onto. a server of weight 2 gets twice the keys of one of weight 1 (the default)\n";
 }
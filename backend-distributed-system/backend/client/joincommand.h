@@ -12,8 +12,8 @@
 
 class JoinCommand : public RegexCommand {
 public:
-    // matches: join <server>
-    explicit JoinCommand(Client& cl) : RegexCommand("join .*:\\d+"), client(cl) {}
+    // matches: join <server> [weight]
+    explicit JoinCommand(Client& cl) : RegexCommand("join .*:\\d+( \\d+)?"), client(cl) {}
     void Handle(const std::string& line) override;
     void PrintHelpMessage() override;
 private:
@@ -15,19 +15,23 @@
 #include "appendcommand.h"
 #include "putcommand.h"
 #include "deletecommand.h"
+#include "cascommand.h"
 
 using namespace std;
 
 int main(int argc, char **argv) {
-    // usage is ./client <hostname> <port>
-    if(argc != 3) {
-        std::cerr << "usage: ./client <hostname> <port>\n";
+    // usage is ./client <hostname> <port> [--hedge=<percent>]
+    HedgeOptions hedge;
+    if(argc == 4 && string(argv[3]).rfind("--hedge=", 0) == 0) {
+        hedge.budgetPercent = std::stoul(string(argv[3]).substr(8));
+    } else if(argc != 3) {
+        std::cerr << "usage: ./client <hostname> <port> [--hedge=<percent>]\n";
         return 1;
     }
 
     const string addr = string(argv[1]) + ":" + string(argv[2]);
     // construct client
-    Client client(addr);
+    Client client(addr, hedge);
 
     // construct repl and add commands
     Repl repl;
@@ -47,6 +51,8 @@ int main(int argc, char **argv) {
     repl.AddCommand(ac);
     DeleteCommand dc(client);
     repl.AddCommand(dc);
+    CasCommand cc(client);
+    repl.AddCommand(cc);
 
     // now start repl
     repl.Start();
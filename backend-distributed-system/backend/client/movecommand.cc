@@ -6,8 +6,8 @@
 
 void MoveCommand::Handle(const std::string &line) {
     std::vector<std::string> tokens = split(line);
-    unsigned int lower = std::stoi(tokens[2]);
-    unsigned int upper = std::stoi(tokens[3]);
+    uint64_t lower = std::stoull(tokens[2]);
+    uint64_t upper = std::stoull(tokens[3]);
 
     shard_t shard = {lower, upper};
     client.Move(tokens[1], shard);
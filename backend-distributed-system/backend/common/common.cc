@@ -1,6 +1,7 @@
 #include "common.h"
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <regex>
 #include <cstring>
 
@@ -10,12 +11,12 @@ void sortAscendingInterval(std::vector<shard_t>& shards) {
       [](const shard_t& a, const shard_t& b) { return a.lower < b.lower; });
 }
 
-size_t size(const shard_t& s) { return s.upper - s.lower + 1; }
+uint64_t size(const shard_t& s) { return s.upper - s.lower + 1; }
 
 std::pair<shard_t, shard_t> split_shard(const shard_t& s) {
   // can't get midpoint of size 1 shard
   assert(s.lower < s.upper);
-  unsigned int midpoint = s.lower + ((s.upper - s.lower) / 2);
+  uint64_t midpoint = s.lower + ((s.upper - s.lower) / 2);
   return std::make_pair<shard_t, shard_t>({s.lower, midpoint},
                                           {midpoint + 1, s.upper});
 }
@@ -98,7 +99,7 @@ std::vector<std::string> parse_value(std::string val, std::string delim) {
   return tokens;
 }
 
-int extractID(std::string key){
+uint64_t extractID(std::string key){
   std::vector<std::string> tokens;
 
   char *save;
@@ -110,30 +111,254 @@ int extractID(std::string key){
   
   assert(tokens.size() > 1); //illformed key
 
-  return stoi(tokens[1]);
+  return stoull(tokens[1]);
 }
 
 void RebalanceShards(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
-                     const std::vector<std::string>& servers) {
-  int num_keys = MAX_KEY - MIN_KEY + 1;
-  int num_servers = servers.size();
-  int keys_per_server = num_keys / num_servers;
-  int extra_keys = num_keys % num_servers;
-  unsigned int lower = MIN_KEY;
-  unsigned int upper = keys_per_server - 1;
+                     const std::vector<std::string>& servers,
+                     uint64_t max_key) {
+  uint64_t num_keys = max_key - MIN_KEY + 1;
+  uint64_t num_servers = servers.size();
+  uint64_t keys_per_server = num_keys / num_servers;
+  uint64_t extra_keys = num_keys % num_servers;
+  uint64_t lower = MIN_KEY;
 
   for(auto& server : servers) {
     serverShardMap[server].clear();
 
+    uint64_t keys = keys_per_server;
     if(extra_keys > 0) {
-      upper++;
+      keys++;
       extra_keys--;
     }
+    if(keys == 0) continue;
 
-    shard_t shard{lower, upper};
+    shard_t shard{lower, lower + keys - 1};
     serverShardMap[server].push_back(shard);
 
-    lower = upper + 1;
-    upper = lower + keys_per_server - 1;
+    lower += keys;
   }
 }
+
+// splits num_keys into shares proportional to weights. the keys left over
+// after rounding down go to the largest remainders, ties broken by order
+static std::vector<uint64_t> keyShares(uint64_t num_keys, const std::vector<unsigned int>& weights,
+                                       const std::vector<size_t>& order) {
+  // num_keys * weight needs more than 64 bits for large key spaces
+  unsigned __int128 total_weight = 0;
+  for(unsigned int w : weights) total_weight += w;
+  std::vector<uint64_t> shares(weights.size());
+  std::vector<unsigned __int128> remainders(weights.size());
+  uint64_t given = 0;
+  for(size_t i = 0; i < weights.size(); i++) {
+    unsigned __int128 scaled = static_cast<unsigned __int128>(num_keys) * weights[i];
+    shares[i] = static_cast<uint64_t>(scaled / total_weight);
+    remainders[i] = scaled % total_weight;
+    given += shares[i];
+  }
+  std::vector<size_t> ranked = order;
+  std::stable_sort(ranked.begin(), ranked.end(),
+                   [&](size_t a, size_t b) { return remainders[a] > remainders[b]; });
+  for(size_t i = 0; given < num_keys; i++, given++) {
+    shares[ranked[i]]++;
+  }
+  return shares;
+}
+
+void RebalanceShardsWeighted(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                             const std::vector<std::string>& servers,
+                             const std::vector<unsigned int>& weights,
+                             uint64_t max_key) {
+  if(servers.empty()) return;
+  std::vector<size_t> order(servers.size());
+  for(size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::vector<uint64_t> shares = keyShares(max_key - MIN_KEY + 1, weights, order);
+  uint64_t lower = MIN_KEY;
+  for(size_t i = 0; i < servers.size(); i++) {
+    serverShardMap[servers[i]].clear();
+    if(shares[i] == 0) continue;
+    serverShardMap[servers[i]].push_back({lower, lower + shares[i] - 1});
+    lower += shares[i];
+  }
+}
+
+void RebalanceShardsByCost(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                           const std::vector<std::string>& servers,
+                           const std::vector<unsigned int>& weights,
+                           const std::vector<key_cost_t>& costs,
+                           uint64_t max_key) {
+  if(servers.empty()) return;
+  // positions count keys from MIN_KEY, so the end of the key space is
+  // num_keys even when max_key is MAX_KEY_LIMIT
+  uint64_t num_keys = max_key - MIN_KEY + 1;
+  double total_cost = 0;
+  for(const auto& c : costs) total_cost += c.per_key * static_cast<double>(c.upper - c.lower + 1);
+  uint64_t total_weight = 0;
+  for(unsigned int w : weights) total_weight += w;
+
+  // cut wherever the running cost is closest to the running share of weight:
+  // a key is taken if at least half of its cost fits under the target
+  size_t segment = 0;
+  uint64_t next = 0;
+  double cost = 0;
+  uint64_t weight = 0;
+  for(size_t i = 0; i < servers.size(); i++) {
+    serverShardMap[servers[i]].clear();
+    weight += weights[i];
+    uint64_t first = next;
+    // leave a key for each of the servers still to come
+    uint64_t last_allowed = num_keys - std::min<uint64_t>(num_keys, servers.size() - i - 1);
+    if(i + 1 == servers.size()) {
+      next = num_keys;
+    } else {
+      double target = total_cost * weight / total_weight;
+      while(next < last_allowed) {
+        while(segment + 1 < costs.size() && costs[segment].upper - MIN_KEY < next) segment++;
+        double per_key = segment < costs.size() ? costs[segment].per_key : 0;
+        uint64_t segment_end = segment < costs.size() ? costs[segment].upper - MIN_KEY + 1 : num_keys;
+        uint64_t available = std::min(segment_end, last_allowed) - next;
+        if(next == first) {
+          cost += per_key;
+          next++;
+          continue;
+        }
+        if(cost + per_key / 2 > target) break;
+        uint64_t take = available;
+        if(per_key > 0) {
+          double fits = (target - cost - per_key / 2) / per_key + 1;
+          if(fits < static_cast<double>(available)) take = static_cast<uint64_t>(fits);
+        }
+        cost += per_key * static_cast<double>(take);
+        next += take;
+        if(take < available) break;
+      }
+    }
+    if(next > first) {
+      serverShardMap[servers[i]].push_back({first + MIN_KEY, next - 1 + MIN_KEY});
+    }
+  }
+}
+
+void RebalanceShardsMinimal(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                            const std::vector<std::string>& servers,
+                            const std::vector<unsigned int>& weights,
+                            uint64_t max_key) {
+  if(servers.empty()) return;
+  uint64_t num_keys = max_key - MIN_KEY + 1;
+
+  std::vector<uint64_t> held_keys;
+  std::vector<shard_t> all;
+  for(const auto& server : servers) {
+    auto& shards = serverShardMap[server];
+    sortAscendingInterval(shards);
+    uint64_t total = 0;
+    for(const auto& shard : shards) {
+      total += size(shard);
+      all.push_back(shard);
+    }
+    held_keys.push_back(total);
+  }
+  // the servers holding the most keys get the extra ones, so they give less
+  std::vector<size_t> order(servers.size());
+  for(size_t i = 0; i < order.size(); i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t a, size_t b) { return held_keys[a] > held_keys[b]; });
+  std::vector<uint64_t> shares =
+      keyShares(num_keys, weights.empty() ? std::vector<unsigned int>(servers.size(), 1) : weights, order);
+  std::vector<std::pair<uint64_t, std::string>> held;
+  std::unordered_map<std::string, uint64_t> target;
+  for(size_t i : order) {
+    held.push_back({held_keys[i], servers[i]});
+    target[servers[i]] = shares[i];
+  }
+
+  // keys nobody owns, plus whatever servers hold beyond their share
+  std::vector<shard_t> pool;
+  sortAscendingInterval(all);
+  uint64_t next = MIN_KEY;
+  bool done = false;
+  for(const auto& shard : all) {
+    if(shard.lower > next) pool.push_back({next, shard.lower - 1});
+    if(shard.upper >= max_key) {
+      done = true;
+      break;
+    }
+    next = std::max(next, shard.upper + 1);
+  }
+  if(!done) pool.push_back({next, max_key});
+  for(auto& [total, server] : held) {
+    auto& shards = serverShardMap[server];
+    while(total > target[server]) {
+      uint64_t surplus = total - target[server];
+      shard_t& last = shards.back();
+      if(size(last) <= surplus) {
+        pool.push_back(last);
+        total -= size(last);
+        shards.pop_back();
+      } else {
+        pool.push_back({last.upper - surplus + 1, last.upper});
+        last.upper -= surplus;
+        total = target[server];
+      }
+    }
+  }
+  sortAscendingInterval(pool);
+
+  // fill up the servers below their share from the pool
+  size_t next_piece = 0;
+  for(auto& [total, server] : held) {
+    auto& shards = serverShardMap[server];
+    while(total < target[server] && next_piece < pool.size()) {
+      uint64_t deficit = target[server] - total;
+      shard_t& piece = pool[next_piece];
+      if(size(piece) <= deficit) {
+        shards.push_back(piece);
+        total += size(piece);
+        next_piece++;
+      } else {
+        shards.push_back({piece.lower, piece.lower + deficit - 1});
+        piece.lower += deficit;
+        total = target[server];
+      }
+    }
+    // merge neighbouring shards so the configuration stays small
+    sortAscendingInterval(shards);
+    std::vector<shard_t> merged;
+    for(const auto& shard : shards) {
+      if(!merged.empty() && merged.back().upper + 1 == shard.lower) merged.back().upper = shard.upper;
+      else merged.push_back(shard);
+    }
+    shards = std::move(merged);
+  }
+}
+
+uint64_t countMovedKeys(const std::unordered_map<std::string, std::vector<shard_t>>& before,
+                        const std::unordered_map<std::string, std::vector<shard_t>>& after) {
+  using Owned = std::pair<shard_t, const std::string*>;
+  auto flatten = [](const std::unordered_map<std::string, std::vector<shard_t>>& layout) {
+    std::vector<Owned> owned;
+    for(const auto& [server, shards] : layout) {
+      for(const auto& shard : shards) owned.push_back({shard, &server});
+    }
+    std::sort(owned.begin(), owned.end(),
+              [](const Owned& a, const Owned& b) { return a.first.lower < b.first.lower; });
+    return owned;
+  };
+  std::vector<Owned> old_owners = flatten(before);
+  std::vector<Owned> new_owners = flatten(after);
+  // walk both sorted lists together, adding up the overlaps that changed owner
+  uint64_t moved = 0;
+  size_t i = 0, j = 0;
+  while(i < old_owners.size() && j < new_owners.size()) {
+    const shard_t& a = old_owners[i].first;
+    const shard_t& b = new_owners[j].first;
+    uint64_t lower = std::max(a.lower, b.lower);
+    uint64_t upper = std::min(a.upper, b.upper);
+    if(lower <= upper && *old_owners[i].second != *new_owners[j].second) {
+      moved += upper - lower + 1;
+    }
+    if(a.upper < b.upper) i++;
+    else j++;
+  }
+  return moved;
+}
@@ -1,6 +1,7 @@
 #ifndef SHARDING_COMMON_H
 #define SHARDING_COMMON_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -10,21 +11,51 @@
 /* ====== Definitions ====== */
 /* ========================= */
 
-// thresholds for shard splitting and merging
-// ignore these unless you implement part 4
+// thresholds for shard splitting and merging, in requests per second. shards
+// above HOT_THRESH are split, neighbouring shards below COLD_THRESH merged
 constexpr unsigned int HOT_THRESH = 100;
 constexpr unsigned int COLD_THRESH = 10;
+// reads per second above which a single key is copied to other groups, since
+// splitting its shard cannot spread the load of one key
+constexpr unsigned int HOT_KEY_THRESH = 200;
+
+// metadata of a request sent straight to a group's primary rather than
+// through its manager, holding the view the sender believes is current. a
+// member that is not the primary of that view turns the request away with
+// FAILED_PRECONDITION, sending the view and primary it knows of back in
+// trailing metadata under the same keys
+constexpr char VIEW_METADATA[] = "x-view";
+constexpr char PRIMARY_METADATA[] = "x-primary";
+// trailing metadata of a write, the sequence number the primary gave it. a
+// reader passes the latest one it got as GetRequest.min_seq to read its own
+// writes from the backup
+constexpr char SEQ_METADATA[] = "x-seq";
+// trailing metadata of a request turned away by a group that does not own its
+// key: the group that does, the shard it owns the key in as <lower>-<upper>,
+// and the version of the configuration that says so. the sender may send the
+// request there right away rather than ask the shardmaster first
+constexpr char OWNER_METADATA[] = "x-owner";
+constexpr char OWNER_SHARD_METADATA[] = "x-owner-shard";
+constexpr char CONFIG_VERSION_METADATA[] = "x-config-version";
+// trailing metadata of a conditional write, the version it left its key at,
+// 0 if it deleted the key. see PutRequest.if_version
+constexpr char VERSION_METADATA[] = "x-version";
 
 // range of keys -- be sure to use these as your bounds
-// when sharding in any part of the project
-constexpr unsigned int MIN_KEY = 0;
-constexpr unsigned int MAX_KEY = 1000;
+// when sharding in any part of the project. MAX_KEY is only the default, the
+// shardmaster can be started with any upper bound up to MAX_KEY_LIMIT and
+// publishes the one in use with every configuration
+constexpr uint64_t MIN_KEY = 0;
+constexpr uint64_t MAX_KEY = 1000;
+// the largest supported upper bound, one short of UINT64_MAX so the size of
+// any range fits in 64 bits
+constexpr uint64_t MAX_KEY_LIMIT = UINT64_MAX - 1;
 
 // a simple struct to represent a shard!
 // lower should be always be <= higher
 typedef struct shard {
-  unsigned int lower;
-  unsigned int upper;
+  uint64_t lower;
+  uint64_t upper;
 
   bool operator==(const shard& rhs) const {
     return lower == rhs.lower && upper == rhs.upper;
@@ -56,10 +87,45 @@ void sortAscendingInterval(std::vector<shard_t>& shards);
 // sorts a vector of shards into ascending/descending order of shard length
 void sortAscendingSize(std::vector<shard_t>& shards);
 void sortDescendingSize(std::vector<shard_t>& shards);
+// the rebalancing functions below spread the keys [MIN_KEY, max_key] over
+// servers. they work on ranges, never on single keys, so their cost does not
+// depend on the size of the key space
 void RebalanceShards(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
-                     const std::vector<std::string>& servers);
+                     const std::vector<std::string>& servers,
+                     uint64_t max_key = MAX_KEY);
+// like RebalanceShards, but servers[i] gets a share of the keys proportional
+// to weights[i]. with equal weights the result is the same as RebalanceShards
+void RebalanceShardsWeighted(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                             const std::vector<std::string>& servers,
+                             const std::vector<unsigned int>& weights,
+                             uint64_t max_key = MAX_KEY);
+// every key in [lower, upper] costs per_key
+struct key_cost_t {
+  uint64_t lower;
+  uint64_t upper;
+  double per_key;
+};
+// like RebalanceShardsWeighted, but shares out cost instead of keys, so a
+// server gets fewer keys where they are busy. costs must cover the key space
+// in order. every server gets at least one key
+void RebalanceShardsByCost(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                           const std::vector<std::string>& servers,
+                           const std::vector<unsigned int>& weights,
+                           const std::vector<key_cost_t>& costs,
+                           uint64_t max_key = MAX_KEY);
+// like RebalanceShards, but keeps every key where it is unless its server is
+// above its share, so only the keys needed to even things out change server.
+// keys nobody owns (e.g. after a leave) are handed to the servers below their
+// share. shares are proportional to weights, or equal if weights is empty
+void RebalanceShardsMinimal(std::unordered_map<std::string, std::vector<shard_t>>& serverShardMap,
+                            const std::vector<std::string>& servers,
+                            const std::vector<unsigned int>& weights = {},
+                            uint64_t max_key = MAX_KEY);
+// counts the keys that are owned in before and owned by someone else in after
+uint64_t countMovedKeys(const std::unordered_map<std::string, std::vector<shard_t>>& before,
+                        const std::unordered_map<std::string, std::vector<shard_t>>& after);
 // gets the size of a shard
-size_t size(const shard_t& s);
+uint64_t size(const shard_t& s);
 // gets the total size of a vector of shards
 size_t shardRangeSize(const std::vector<shard_t>& vec);
 
@@ -83,6 +149,6 @@ std::vector<std::string> parse_value(std::string val, std::string delim);
 
 //extracts the ID number out of the key
 //you may find the utility helpful when implementing shardmaster
-int extractID(std::string key);
+uint64_t extractID(std::string key);
 
 #endif  // SHARDING_COMMON_H
@@ -0,0 +1,40 @@
+#include "hedging.h"
+
+#include <algorithm>
+
+std::chrono::microseconds HedgePolicy::StartRead() {
+    std::lock_guard<std::mutex> lock(mutex);
+    saved = std::min(MAX_SAVED, saved + options.budgetPercent / 100.0);
+    if (latencies.size() < SAMPLES) {
+        return options.initialDelay;
+    }
+    return delay;
+}
+
+void HedgePolicy::Record(std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (latencies.size() < SAMPLES) {
+        latencies.push_back(latency);
+    } else {
+        latencies[next] = latency;
+        next = (next + 1) % SAMPLES;
+    }
+    // sorting the samples on every read would cost more than the reads
+    if (latencies.size() < SAMPLES || ++sinceDelay < SAMPLES / 16) {
+        return;
+    }
+    sinceDelay = 0;
+    std::vector<std::chrono::microseconds> sorted(latencies);
+    auto nth = sorted.begin() + static_cast<size_t>(options.percentile * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), nth, sorted.end());
+    delay = *nth;
+}
+
+bool HedgePolicy::TakeHedge() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (saved < 1) {
+        return false;
+    }
+    saved -= 1;
+    return true;
+}
@@ -0,0 +1,148 @@
+#ifndef SHARDING_HEDGING_H
+#define SHARDING_HEDGING_H
+
+#include <grpcpp/grpcpp.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rpc.h"
+
+// tunables of hedged reads: a read that is slow to return is sent to another
+// replica as well, and whichever answers first is used
+struct HedgeOptions {
+  // hedges sent at most, as a percentage of reads. 0 turns hedging off
+  unsigned int budgetPercent = 0;
+  // percentile of recent read latencies a read is given before it is hedged
+  double percentile = 0.95;
+  // how long a read is given until enough of them were seen to tell
+  std::chrono::milliseconds initialDelay{20};
+  // how far behind its primary the replica answering a hedged strong read
+  // may be, in milliseconds
+  uint32_t maxStalenessMs = 1000;
+};
+
+// when to hedge, shared by all reads of a client or manager
+class HedgePolicy {
+ public:
+  explicit HedgePolicy(const HedgeOptions& opts = HedgeOptions()) : options(opts) {}
+
+  const HedgeOptions& Options() const { return options; }
+  bool Enabled() const { return options.budgetPercent > 0; }
+  // how long a read is given before it is hedged, and counts it towards the
+  // budget
+  std::chrono::microseconds StartRead();
+  // records how long an answered read took
+  void Record(std::chrono::microseconds latency);
+  // takes one hedge from the budget, returns false if none is left
+  bool TakeHedge();
+
+  // latencies the delay is worked out from, the most recent ones
+  static constexpr size_t SAMPLES = 256;
+  // hedges the budget saves up at most while reads are fast
+  static constexpr double MAX_SAVED = 10;
+
+ private:
+  const HedgeOptions options;
+  std::mutex mutex;
+  std::vector<std::chrono::microseconds> latencies;
+  // where the next latency goes in latencies once it is full
+  size_t next = 0;
+  // the delay as of the last SAMPLES / 16 latencies
+  std::chrono::microseconds delay{0};
+  size_t sinceDelay = 0;
+  // every read adds budgetPercent / 100, every hedge takes 1
+  double saved = 0;
+};
+
+/**
+ * Runs first, and second as well if first has not returned once policy's
+ * delay ran out and the budget allows a hedge. The first answer that is not
+ * an error wins and the other call is cancelled. Both calls get their own
+ * client context, which they may add metadata to.
+ *
+ * @param policy decides whether and when to hedge
+ * @param first the call a read normally makes
+ * @param second the hedge, sent to another replica
+ * @param response where the winning answer is stored
+ * @param parent the request the read is made for, if any, see CallContext
+ * @return the status of the winning call, or of first if both failed
+ */
+template <typename Response>
+::grpc::Status HedgedCall(HedgePolicy& policy,
+                          const std::function<::grpc::Status(::grpc::ClientContext*, Response*)>& first,
+                          const std::function<::grpc::Status(::grpc::ClientContext*, Response*)>& second,
+                          Response* response, const ::grpc::ServerContext* parent = nullptr) {
+  auto start = std::chrono::steady_clock::now();
+  auto delay = policy.StartRead();
+  struct Attempt {
+    std::unique_ptr<::grpc::ClientContext> cc;
+    Response response;
+    ::grpc::Status status;
+    bool done = false;
+    std::thread thread;
+  };
+  std::mutex mutex;
+  std::condition_variable finished;
+  Attempt attempts[2];
+  for (auto& attempt : attempts) {
+    attempt.cc = CallContext(parent);
+  }
+  auto launch = [&](Attempt& attempt,
+                    const std::function<::grpc::Status(::grpc::ClientContext*, Response*)>& call) {
+    attempt.thread = std::thread([&attempt, &mutex, &finished, call]() {
+      auto status = call(attempt.cc.get(), &attempt.response);
+      std::lock_guard<std::mutex> lock(mutex);
+      attempt.status = status;
+      attempt.done = true;
+      finished.notify_all();
+    });
+  };
+
+  launch(attempts[0], first);
+  Attempt* winner = nullptr;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool hedged = false;
+    if (!finished.wait_for(lock, delay, [&]() { return attempts[0].done; }) && policy.TakeHedge()) {
+      launch(attempts[1], second);
+      hedged = true;
+    }
+    // the first success wins, a failure only once the other one is done too
+    finished.wait(lock, [&]() {
+      for (auto& attempt : attempts) {
+        if (attempt.done && attempt.status.ok()) {
+          winner = &attempt;
+          return true;
+        }
+      }
+      return attempts[0].done && (!hedged || attempts[1].done);
+    });
+  }
+  if (winner != nullptr) {
+    policy.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start));
+  } else {
+    winner = &attempts[0];
+  }
+  for (auto& attempt : attempts) {
+    if (&attempt != winner) {
+      attempt.cc->TryCancel();
+    }
+  }
+  for (auto& attempt : attempts) {
+    if (attempt.thread.joinable()) {
+      attempt.thread.join();
+    }
+  }
+  *response = std::move(winner->response);
+  return winner->status;
+}
+
+#endif  // SHARDING_HEDGING_H
@@ -0,0 +1,92 @@
+#include "interval_map.h"
+
+#include <algorithm>
+#include <iterator>
+
+IntervalMap::IntervalMap(const std::unordered_map<std::string, std::vector<shard_t>>& shardMap) {
+  for (const auto& [server, shards] : shardMap) {
+    uint32_t id = Intern(server);
+    for (const auto& shard : shards) {
+      intervals[shard.lower] = {shard.upper, id};
+    }
+  }
+}
+
+uint32_t IntervalMap::Intern(const std::string& server) {
+  auto it = ids.find(server);
+  if (it != ids.end()) return it->second;
+  uint32_t id = names.size();
+  names.push_back(server);
+  ids[server] = id;
+  return id;
+}
+
+void IntervalMap::SplitAt(uint64_t key) {
+  auto it = intervals.upper_bound(key);
+  if (it == intervals.begin()) return;
+  --it;
+  if (it->first == key || it->second.upper < key) return;
+  intervals[key] = {it->second.upper, it->second.server};
+  it->second.upper = key - 1;
+}
+
+void IntervalMap::Assign(const shard_t& shard, const std::string& server) {
+  SplitAt(shard.lower);
+  if (shard.upper < MAX_KEY_LIMIT) SplitAt(shard.upper + 1);
+  // everything starting inside shard now also ends inside it
+  intervals.erase(intervals.lower_bound(shard.lower), intervals.upper_bound(shard.upper));
+  intervals[shard.lower] = {shard.upper, Intern(server)};
+}
+
+void IntervalMap::Remove(const shard_t& shard, const std::string& server) {
+  auto id = ids.find(server);
+  if (id == ids.end()) return;
+  SplitAt(shard.lower);
+  if (shard.upper < MAX_KEY_LIMIT) SplitAt(shard.upper + 1);
+  auto it = intervals.lower_bound(shard.lower);
+  while (it != intervals.end() && it->first <= shard.upper) {
+    it = it->second.server == id->second ? intervals.erase(it) : std::next(it);
+  }
+}
+
+const std::string* IntervalMap::Owner(uint64_t key) const {
+  auto it = intervals.upper_bound(key);
+  if (it == intervals.begin()) return nullptr;
+  --it;
+  return key <= it->second.upper ? &names[it->second.server] : nullptr;
+}
+
+std::vector<std::pair<shard_t, std::string>> IntervalMap::Owners(const shard_t& shard) const {
+  std::vector<std::pair<shard_t, std::string>> owners;
+  auto it = intervals.upper_bound(shard.lower);
+  if (it != intervals.begin()) --it;
+  for (; it != intervals.end() && it->first <= shard.upper; ++it) {
+    if (it->second.upper < shard.lower) continue;
+    shard_t piece = {std::max(it->first, shard.lower), std::min(it->second.upper, shard.upper)};
+    owners.push_back({piece, names[it->second.server]});
+  }
+  return owners;
+}
+
+std::vector<shard_t> IntervalMap::Shards(const std::string& server) const {
+  std::vector<shard_t> shards;
+  auto id = ids.find(server);
+  if (id == ids.end()) return shards;
+  for (const auto& [lower, interval] : intervals) {
+    if (interval.server == id->second) shards.push_back({lower, interval.upper});
+  }
+  return shards;
+}
+
+std::unordered_map<std::string, std::vector<shard_t>> IntervalMap::ToShardMap(
+    const std::vector<std::string>& servers) const {
+  std::unordered_map<std::string, std::vector<shard_t>> shardMap;
+  for (const auto& server : servers) {
+    shardMap[server];
+  }
+  for (const auto& [lower, interval] : intervals) {
+    auto it = shardMap.find(names[interval.server]);
+    if (it != shardMap.end()) it->second.push_back({lower, interval.upper});
+  }
+  return shardMap;
+}
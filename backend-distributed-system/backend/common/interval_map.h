@@ -0,0 +1,68 @@
+#ifndef SHARDING_INTERVAL_MAP_H
+#define SHARDING_INTERVAL_MAP_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.h"
+
+/**
+ * Which server owns which keys, kept as non-overlapping intervals sorted by
+ * their lower bound. The shardmaster keeps its configuration in one, shardkv
+ * servers the ranges they are still pulling in. Assigning a range and looking
+ * up the owner of a key take O(log n) in the number of intervals (plus the
+ * intervals a range swallows), independent of the size of the key space. Server names are interned, so
+ * every interval costs the same however long the addresses are.
+ */
+class IntervalMap {
+ public:
+  IntervalMap() = default;
+  // builds the map from the per-server form the rebalancing functions use
+  explicit IntervalMap(const std::unordered_map<std::string, std::vector<shard_t>>& shardMap);
+
+  // makes server the owner of shard, cutting it out of the intervals it
+  // overlaps. the neighbouring intervals are left as they are, so shard stays
+  // a shard of its own
+  void Assign(const shard_t& shard, const std::string& server);
+
+  // drops the parts of shard owned by server, leaving those keys without owner
+  void Remove(const shard_t& shard, const std::string& server);
+
+  // the server owning key, or nullptr if nobody does
+  const std::string* Owner(uint64_t key) const;
+
+  // the owned parts of shard, in order, with their owner
+  std::vector<std::pair<shard_t, std::string>> Owners(const shard_t& shard) const;
+
+  // the shards of server, sorted. O(n) in the number of intervals
+  std::vector<shard_t> Shards(const std::string& server) const;
+
+  // the per-server form, with an entry for every server in servers even if it
+  // owns nothing
+  std::unordered_map<std::string, std::vector<shard_t>> ToShardMap(
+      const std::vector<std::string>& servers) const;
+
+  // number of intervals
+  size_t Size() const { return intervals.size(); }
+
+ private:
+  struct Interval {
+    uint64_t upper;
+    // index into names
+    uint32_t server;
+  };
+
+  uint32_t Intern(const std::string& server);
+  // makes sure an interval starts at key, splitting the one holding it
+  void SplitAt(uint64_t key);
+
+  // keyed by lower bound
+  std::map<uint64_t, Interval> intervals;
+  std::vector<std::string> names;
+  std::unordered_map<std::string, uint32_t> ids;
+};
+
+#endif  // SHARDING_INTERVAL_MAP_H
@@ -0,0 +1,141 @@
+#include "key_hash.h"
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t read64(const unsigned char* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  acc = rotl(acc, 31);
+  return acc * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * PRIME1 + PRIME4;
+}
+
+}  // namespace
+
+uint64_t xxHash64(const void* data, size_t len, uint64_t seed) {
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  const unsigned char* end = p + len;
+  uint64_t h;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+    const unsigned char* limit = end - 32;
+    do {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+  } else {
+    h = seed + PRIME5;
+  }
+  h += len;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * PRIME1 + PRIME4;
+  }
+  if (p + 4 <= end) {
+    h ^= read32(p) * PRIME1;
+    h = rotl(h, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; p++) {
+    h ^= *p * PRIME5;
+    h = rotl(h, 11) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+std::string_view hashTag(const std::string& key) {
+  size_t open = key.find('{');
+  if (open != std::string::npos) {
+    size_t close = key.find('}', open + 1);
+    if (close != std::string::npos && close > open + 1) {
+      return std::string_view(key).substr(open + 1, close - open - 1);
+    }
+  }
+  return key;
+}
+
+uint64_t hashPosition(const std::string& key, uint64_t max_key) {
+  std::string_view tag = hashTag(key);
+  uint64_t hash = xxHash64(tag.data(), tag.size());
+  unsigned __int128 span = static_cast<unsigned __int128>(max_key - MIN_KEY) + 1;
+  return MIN_KEY + static_cast<uint64_t>(hash * span >> 64);
+}
+
+bool keyPosition(const std::string& key, Partitioning partitioning,
+                 uint64_t max_key, uint64_t* position) {
+  if (key == "all_users") {
+    return false;
+  }
+  if (partitioning == Partitioning::HASH) {
+    *position = hashPosition(key, max_key);
+    return true;
+  }
+  std::string_view name = partitioning == Partitioning::AFFINITY ? hashTag(key) : key;
+  // <type>_<digits>, optionally followed by _<anything>
+  size_t start = name.find('_');
+  if (start == std::string_view::npos) {
+    return false;
+  }
+  size_t end = start + 1;
+  while (end < name.size() && std::isdigit(static_cast<unsigned char>(name[end]))) {
+    end++;
+  }
+  if (end == start + 1 || end - start - 1 > 20 || (end < name.size() && name[end] != '_')) {
+    return false;
+  }
+  errno = 0;
+  std::string digits(name.substr(start + 1, end - start - 1));
+  unsigned long long id = std::strtoull(digits.c_str(), nullptr, 10);
+  if (errno == ERANGE) {
+    return false;
+  }
+  *position = id;
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef SHARDING_KEY_HASH_H
+#define SHARDING_KEY_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "common.h"
+
+// how keys are placed in the key space, in the order of
+// QueryResponse::Partitioning
+enum class Partitioning {
+  // by the id in the key, <type>_<id>
+  ID,
+  // by the xxHash64 of the key or of its hash tag
+  HASH,
+  // by the id in the key's tag if it has one, in the key otherwise. a post
+  // named post_9{user_5} lives with user_5 and user_5_posts
+  AFFINITY
+};
+
+// xxHash64 of the len bytes at data. one-shot, the key is hashed in a single
+// pass without any streaming state
+uint64_t xxHash64(const void* data, size_t len, uint64_t seed = 0);
+
+// the part of key that is hashed. keys sharing a hash tag, the text between
+// the first '{' and the next '}', always land on the same shard, e.g.
+// "{cart_42}.items" and "{cart_42}.total". keys without a tag, or with an
+// empty one, are hashed whole
+std::string_view hashTag(const std::string& key);
+
+// where key hashes to in [MIN_KEY, max_key]. the hash is scaled rather than
+// reduced modulo the key space, so it is spread evenly over any range
+uint64_t hashPosition(const std::string& key, uint64_t max_key);
+
+// where key sits in [MIN_KEY, max_key] when placed by partitioning. returns
+// false for keys without a position, which are the per-group all_users list
+// and, unless hashed, keys whose id (or tag) doesn't look like <type>_<id>
+bool keyPosition(const std::string& key, Partitioning partitioning,
+                 uint64_t max_key, uint64_t* position);
+
+#endif  // SHARDING_KEY_HASH_H
@@ -0,0 +1,90 @@
+#include "retry.h"
+
+#include <algorithm>
+#include <random>
+#include <thread>
+
+std::chrono::milliseconds JitteredBackoff(int attempt, std::chrono::milliseconds initial,
+                                          std::chrono::milliseconds max) {
+    thread_local std::mt19937_64 random(std::random_device{}());
+    auto limit = initial;
+    for (int i = 1; i < attempt && limit < max; i++) {
+        limit *= 2;
+    }
+    limit = std::min(limit, max);
+    std::uniform_int_distribution<int64_t> spread(0, limit.count());
+    return std::chrono::milliseconds(spread(random));
+}
+
+RetryPolicy::RetryPolicy(const RetryOptions& opts) : options(opts) {}
+
+::grpc::Status RetryPolicy::Call(const std::string& peer, const std::function<::grpc::Status()>& call,
+                                 bool idempotent, std::chrono::system_clock::time_point deadline) {
+    int attempts = idempotent ? std::max(1, options.maxAttempts) : 1;
+    for (int attempt = 1;; attempt++) {
+        if (!Allow(peer)) {
+            return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, peer + " is down, not calling it");
+        }
+        auto status = call();
+        Record(peer, status);
+        if (status.ok() || attempt >= attempts || !Retryable(status) || !MayRetry()) {
+            return status;
+        }
+        auto wait = JitteredBackoff(attempt, options.initialBackoff, options.maxBackoff);
+        if (std::chrono::system_clock::now() + wait >= deadline) {
+            return status;
+        }
+        std::this_thread::sleep_for(wait);
+    }
+}
+
+bool RetryPolicy::Retryable(const ::grpc::Status& status) {
+    switch (status.error_code()) {
+        case ::grpc::StatusCode::UNAVAILABLE:
+        case ::grpc::StatusCode::DEADLINE_EXCEEDED:
+        case ::grpc::StatusCode::RESOURCE_EXHAUSTED:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool RetryPolicy::Allow(const std::string& peer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = breakers.find(peer);
+    if (it == breakers.end() || it->second.failures < options.breakerThreshold) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now < it->second.openUntil) {
+        return false;
+    }
+    // half open: this call probes whether peer is back, the others keep
+    // failing right away until it tells
+    it->second.openUntil = now + options.openFor;
+    return true;
+}
+
+void RetryPolicy::Record(const std::string& peer, const ::grpc::Status& status) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (status.ok()) {
+        tokens = std::min(MAX_TOKENS, tokens + options.tokenRatio);
+    } else if (Retryable(status)) {
+        tokens = std::max(0.0, tokens - 1);
+    }
+    // only a peer we could not reach counts against its breaker, any answer
+    // shows it is up
+    if (status.error_code() != ::grpc::StatusCode::UNAVAILABLE) {
+        breakers.erase(peer);
+        return;
+    }
+    auto& breaker = breakers[peer];
+    if (++breaker.failures >= options.breakerThreshold) {
+        breaker.openUntil = std::chrono::steady_clock::now() + options.openFor;
+    }
+}
+
+bool RetryPolicy::MayRetry() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tokens > MAX_TOKENS / 2;
+}
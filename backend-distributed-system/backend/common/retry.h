@@ -0,0 +1,90 @@
+#ifndef SHARDING_RETRY_H
+#define SHARDING_RETRY_H
+
+#include <grpcpp/grpcpp.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+// tunables of RetryPolicy
+struct RetryOptions {
+  // tries of a call, the first one included
+  int maxAttempts = 3;
+  // the wait before the first retry is picked at random up to this, and the
+  // limit doubles with every further retry up to maxBackoff
+  std::chrono::milliseconds initialBackoff{20};
+  std::chrono::milliseconds maxBackoff{1000};
+  // every successful call earns this fraction of a retry, every failed try
+  // costs one. retries stop while less than half of MAX_TOKENS is left, so a
+  // peer that keeps failing is not sent every call several times over
+  double tokenRatio = 0.1;
+  // failures in a row to a peer after which its circuit breaker opens: calls
+  // to it fail right away, except for one probe every openFor
+  unsigned int breakerThreshold = 5;
+  std::chrono::milliseconds openFor{1000};
+};
+
+// a random wait before retry number attempt, counting from 1: anywhere up to
+// initial doubled attempt - 1 times, at most max. spreading the waits out
+// keeps peers that failed together from retrying in lockstep
+std::chrono::milliseconds JitteredBackoff(int attempt, std::chrono::milliseconds initial,
+                                          std::chrono::milliseconds max);
+
+// how calls to other servers are retried. one policy is shared by all calls
+// a server, manager or client makes, so the retry budget and the circuit
+// breakers cover every call to a peer
+class RetryPolicy {
+ public:
+  explicit RetryPolicy(const RetryOptions& opts = RetryOptions());
+
+  /**
+   * Runs call, which makes one call to peer with a client context of its
+   * own, until it succeeds or fails in a way another try cannot fix. Tries
+   * are spaced out by JitteredBackoff, limited by the retry budget, and not
+   * made while peer's circuit breaker is open.
+   *
+   * @param peer the address call calls
+   * @param call makes the call
+   * @param idempotent false for calls that must not be made twice, which
+   * are tried only once
+   * @param deadline no retry is started after this, typically the deadline
+   * of the request the call is made for
+   * @return the status of the last try, or UNAVAILABLE if peer's circuit
+   * breaker is open
+   */
+  ::grpc::Status Call(const std::string& peer, const std::function<::grpc::Status()>& call,
+                      bool idempotent = true,
+                      std::chrono::system_clock::time_point deadline = std::chrono::system_clock::time_point::max());
+
+  // whether a failure with status may pass on another try
+  static bool Retryable(const ::grpc::Status& status);
+
+  // whether peer may be called now. while its breaker is open, lets one
+  // probe through every openFor
+  bool Allow(const std::string& peer);
+  // records the outcome of a call to peer
+  void Record(const std::string& peer, const ::grpc::Status& status);
+
+  // the retry budget holds at most this many retries
+  static constexpr double MAX_TOKENS = 10;
+
+ private:
+  // whether enough of the retry budget is left for another try
+  bool MayRetry();
+
+  struct Breaker {
+    unsigned int failures = 0;
+    std::chrono::steady_clock::time_point openUntil;
+  };
+
+  const RetryOptions options;
+  std::mutex mutex;
+  double tokens = MAX_TOKENS;
+  std::map<std::string, Breaker> breakers;
+};
+
+#endif  // SHARDING_RETRY_H
@@ -0,0 +1,42 @@
+#include "rpc.h"
+
+#include <algorithm>
+
+std::unique_ptr<::grpc::ClientContext> CallContext(const ::grpc::ServerContext* context,
+                                                   std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::system_clock::now() + timeout;
+    if (context == nullptr) {
+        auto cc = std::make_unique<::grpc::ClientContext>();
+        cc->set_deadline(deadline);
+        return cc;
+    }
+    auto cc = ::grpc::ClientContext::FromServerContext(*context);
+    cc->set_deadline(std::min(deadline, context->deadline()));
+    return cc;
+}
+
+std::chrono::system_clock::time_point DeadlineOf(const ::grpc::ServerContext* context) {
+    return context == nullptr ? std::chrono::system_clock::time_point::max() : context->deadline();
+}
+
+void ReplicaList::Set(const std::vector<std::string>& list) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (replicas.empty()) replicas = list;
+}
+
+bool ReplicaList::Empty() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return replicas.empty();
+}
+
+std::string ReplicaList::Current() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return replicas.empty() ? "" : replicas[current];
+}
+
+void ReplicaList::Failed(const std::string& replica) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!replicas.empty() && replicas[current] == replica) {
+        current = (current + 1) % replicas.size();
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef SHARDING_RPC_H
+#define SHARDING_RPC_H
+
+#include <grpcpp/grpcpp.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// longest a call may take when nothing tighter applies: a call made on
+// behalf of a request whose sender set no deadline, or a client's own call
+constexpr std::chrono::seconds DEFAULT_RPC_TIMEOUT{10};
+
+// a client context for a call made while serving context. it runs out along
+// with context, or timeout from now if that is sooner, and is cancelled when
+// context is, so work done for a request that was given up on stops with it.
+// with no context, for calls of our own, it just runs out timeout from now
+std::unique_ptr<::grpc::ClientContext> CallContext(const ::grpc::ServerContext* context,
+                                                   std::chrono::milliseconds timeout = DEFAULT_RPC_TIMEOUT);
+
+// the deadline of the request being served in context, none without a request
+std::chrono::system_clock::time_point DeadlineOf(const ::grpc::ServerContext* context);
+
+// the replicas of a service any of them can serve, such as a replicated
+// shardmaster, and the one calls go to. once a call to it fails, calls move
+// on to the next one. safe to use from several threads
+class ReplicaList {
+ public:
+  // takes in replicas, unless we have some already
+  void Set(const std::vector<std::string>& replicas);
+  bool Empty() const;
+  // where calls should go, empty while we know of no replica
+  std::string Current() const;
+  // moves on from replica after a call to it failed, unless that was done
+  // already
+  void Failed(const std::string& replica);
+
+ private:
+  mutable std::mutex mutex;
+  std::vector<std::string> replicas;
+  size_t current = 0;
+};
+
+#endif  // SHARDING_RPC_H
@@ -4,10 +4,14 @@
 
 #include "config.h"
 
+#include <cinttypes>
+
+#include "../common/key_hash.h"
+
 void Config::Print() {
     // guaranteed iteration order, so it doesn't matter how these have been inserted
     for(const auto&[upper, data] : shardToServer) {
-        printf("Shard {%d, %d} on server %s\n", data.lower, upper, data.server.c_str());
+        printf("Shard {%" PRIu64 ", %" PRIu64 "} on server %s\n", data.lower, upper, data.server.c_str());
     }
 }
 
@@ -16,7 +20,28 @@ void Config::Insert(const std::string &server, const shard_t &shard) {
     shardToServer.emplace(shard.upper, s);
 }
 
-std::optional<std::string> Config::GetServer(unsigned int key) {
+void Config::Assign(const std::string &server, const shard_t &shard) {
+    // entries are keyed by their upper bound, so the first one that can
+    // overlap shard is the first one ending at or after its lower bound
+    std::vector<std::pair<uint64_t, ServerAndLower>> kept;
+    auto it = shardToServer.lower_bound(shard.lower);
+    while(it != shardToServer.end() && it->second.lower <= shard.upper) {
+        // the parts sticking out on either side stay where they were
+        if(it->second.lower < shard.lower) {
+            kept.push_back({shard.lower - 1, {it->second.server, it->second.lower}});
+        }
+        if(it->first > shard.upper) {
+            kept.push_back({it->first, {it->second.server, shard.upper + 1}});
+        }
+        it = shardToServer.erase(it);
+    }
+    for(const auto& [upper, s] : kept) {
+        shardToServer.emplace(upper, s);
+    }
+    Insert(server, shard);
+}
+
+std::optional<std::string> Config::GetServer(uint64_t key) {
     auto it = shardToServer.lower_bound(key);
     if(it == shardToServer.end()) {
         return std::nullopt;
@@ -24,6 +49,19 @@ std::optional<std::string> Config::GetServer(unsigned int key) {
     return std::optional<std::string>(it->second.server);
 }
 
+std::optional<std::string> Config::GetServer(const std::string& key) {
+    uint64_t position;
+    if(!keyPosition(key, partitioning, maxKey, &position)) {
+        return std::nullopt;
+    }
+    return GetServer(position);
+}
+
+void Config::SetKeySpace(uint64_t maxKey, Partitioning partitioning) {
+    this->maxKey = maxKey;
+    this->partitioning = partitioning;
+}
+
 std::vector<std::string> Config::AllServers() {
     std::vector<std::string> servers;
     auto it = shardToServer.begin();
@@ -10,10 +10,11 @@
 #include <vector>
 #include <optional>
 #include "../common/common.h"
+#include "../common/key_hash.h"
 
 typedef struct {
     std::string server;
-    unsigned int lower;
+    uint64_t lower;
 } ServerAndLower;
 
 class Config {
@@ -21,8 +22,18 @@ public:
     // inserts a server and a shard on that server
     void Insert(const std::string& server, const shard_t& shard);
 
+    // puts shard on server, taking it off the servers holding parts of it
+    void Assign(const std::string& server, const shard_t& shard);
+
     // retrieves the server currently responsible for the given key. returns none if no such server exists
-    std::optional<std::string> GetServer(unsigned int key);
+    std::optional<std::string> GetServer(uint64_t key);
+
+    // like GetServer, but for a key as stored, placed by its id or its hash as
+    // set by SetKeySpace
+    std::optional<std::string> GetServer(const std::string& key);
+
+    // sets how keys are placed in the key space, as published by the shardmaster
+    void SetKeySpace(uint64_t maxKey, Partitioning partitioning);
 
     // returns list of all servers
     std::vector<std::string> AllServers();
@@ -34,7 +45,9 @@ public:
 private:
     // we map the upper bound on a shard (i.e shard.upper) to the server that holds it and the lower bound
     // of the shard
-    std::map<unsigned int, ServerAndLower> shardToServer;
+    std::map<uint64_t, ServerAndLower> shardToServer;
+    uint64_t maxKey = MAX_KEY;
+    Partitioning partitioning = Partitioning::ID;
 };
 
 
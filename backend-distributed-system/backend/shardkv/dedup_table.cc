@@ -0,0 +1,60 @@
+#include "dedup_table.h"
+
+#include <algorithm>
+
+DedupTable::DedupTable(size_t capacity) : capacity(capacity) {}
+
+bool DedupTable::Seen(const RequestId& id) const {
+  if (id.client_id() == 0) return false;
+  auto it = windows.find(id.client_id());
+  if (it == windows.end() || id.seq() > it->second.highest) return false;
+  uint64_t behind = it->second.highest - id.seq();
+  return behind >= WINDOW || (it->second.seen >> behind) & 1;
+}
+
+bool DedupTable::Admit(const RequestId& id) {
+  if (id.client_id() == 0) return true;
+  if (Seen(id)) return false;
+  auto it = windows.find(id.client_id());
+  if (it == windows.end()) {
+    if (windows.size() >= capacity) Evict();
+    it = windows.emplace(id.client_id(), Window()).first;
+  }
+  Window& window = it->second;
+  if (id.seq() > window.highest) {
+    uint64_t ahead = id.seq() - window.highest;
+    window.seen = ahead >= WINDOW ? 0 : window.seen << ahead;
+    window.highest = id.seq();
+  }
+  window.seen |= uint64_t{1} << (window.highest - id.seq());
+  window.used = ++clock;
+  return true;
+}
+
+void DedupTable::Save(DumpResponse* dump) const {
+  for (const auto& [client, window] : windows) {
+    auto* saved = dump->add_clients();
+    saved->set_client_id(client);
+    saved->set_highest(window.highest);
+    saved->set_seen(window.seen);
+  }
+}
+
+void DedupTable::Load(const DumpResponse& dump) {
+  for (const auto& saved : dump.clients()) {
+    auto it = windows.find(saved.client_id());
+    if (it != windows.end() && it->second.highest >= saved.highest()) continue;
+    if (it == windows.end() && windows.size() >= capacity) Evict();
+    Window& window = windows[saved.client_id()];
+    window.highest = saved.highest();
+    window.seen = saved.seen();
+    window.used = ++clock;
+  }
+}
+
+void DedupTable::Evict() {
+  auto oldest = std::min_element(windows.begin(), windows.end(), [](const auto& a, const auto& b) {
+    return a.second.used < b.second.used;
+  });
+  if (oldest != windows.end()) windows.erase(oldest);
+}
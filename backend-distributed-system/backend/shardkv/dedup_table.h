@@ -0,0 +1,58 @@
+#ifndef SHARDING_DEDUP_TABLE_H
+#define SHARDING_DEDUP_TABLE_H
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "../build/shardkv.grpc.pb.h"
+
+/**
+ * Remembers which writes of every client were applied, so a write that
+ * arrives again, because its client retried after losing our answer, say, is
+ * acknowledged without being applied twice. Per client it keeps the highest
+ * sequence number applied and a bitmap of the WINDOW numbers up to it, so a
+ * client may have up to WINDOW writes in flight at once; anything older is
+ * taken for a duplicate. Once more than capacity clients are known, the one
+ * that wrote least recently is forgotten.
+ *
+ * Not thread safe: the server checks and records a write under the same lock
+ * it applies it with.
+ */
+class DedupTable {
+ public:
+  explicit DedupTable(size_t capacity);
+
+  // true if the write id names was applied already. always false for writes
+  // without an id
+  bool Seen(const RequestId& id) const;
+
+  // records the write id names as applied. returns false, recording nothing,
+  // if it was applied already
+  bool Admit(const RequestId& id);
+
+  // copies every client's window into dump, for a member joining the group
+  void Save(DumpResponse* dump) const;
+  // takes in the windows of a dump, keeping ours where we are further on
+  void Load(const DumpResponse& dump);
+
+  // sequence numbers kept per client
+  static constexpr uint64_t WINDOW = 64;
+
+ private:
+  struct Window {
+    uint64_t highest = 0;
+    // bit i is set if highest - i was applied
+    uint64_t seen = 0;
+    // the value of clock when the client last wrote
+    uint64_t used = 0;
+  };
+
+  // drops the client that wrote least recently
+  void Evict();
+
+  const size_t capacity;
+  uint64_t clock = 0;
+  std::unordered_map<uint64_t, Window> windows;
+};
+
+#endif  // SHARDING_DEDUP_TABLE_H
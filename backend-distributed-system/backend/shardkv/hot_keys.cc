@@ -0,0 +1,34 @@
+#include "hot_keys.h"
+
+#include <algorithm>
+
+HotKeyTracker::HotKeyTracker(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+void HotKeyTracker::Count(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = counts.find(key);
+  if (it != counts.end()) {
+    it->second++;
+    return;
+  }
+  if (counts.size() < capacity) {
+    counts.emplace(key, 1);
+    return;
+  }
+  // no room: the new read and one read of every kept key cancel out
+  for (it = counts.begin(); it != counts.end();) {
+    it = --it->second == 0 ? counts.erase(it) : std::next(it);
+  }
+}
+
+std::vector<std::pair<std::string, uint64_t>> HotKeyTracker::Take() {
+  std::unordered_map<std::string, uint64_t> taken;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    taken.swap(counts);
+  }
+  std::vector<std::pair<std::string, uint64_t>> keys(taken.begin(), taken.end());
+  std::sort(keys.begin(), keys.end(),
+            [](const auto& a, const auto& b) { return a.second > b.second; });
+  return keys;
+}
@@ -0,0 +1,36 @@
+#ifndef SHARDING_HOT_KEYS_H
+#define SHARDING_HOT_KEYS_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Finds the most read keys in a stream of reads with the Misra-Gries
+ * algorithm, in memory bounded by `capacity` whatever the number of distinct
+ * keys. Every key read more than 1 / (capacity + 1) of the time is guaranteed
+ * to be kept, with a count at most that share of the reads below its real one.
+ *
+ * Safe to call from any thread.
+ */
+class HotKeyTracker {
+ public:
+  explicit HotKeyTracker(size_t capacity);
+
+  // counts one read of key
+  void Count(const std::string& key);
+
+  // the keys kept since the last call with their counts, most read first, and
+  // starts counting afresh
+  std::vector<std::pair<std::string, uint64_t>> Take();
+
+ private:
+  std::mutex mtx;
+  const size_t capacity;
+  std::unordered_map<std::string, uint64_t> counts;
+};
+
+#endif  // SHARDING_HOT_KEYS_H
@@ -4,12 +4,38 @@
 
 #include "shardkv.h"
 
+static void usage() {
+  fprintf(stderr, "usage: ./shardkv <PORT> <SHARD MANAGER HOSTNAME> " \
+                  "<SHARD MANAGER PORT> [--migration-concurrency=<N>] " \
+                  "[--migration-bandwidth=<BYTES PER SEC>] " \
+                  "[--migration-mode=push|pull] " \
+                  "[--hot-key-copies=<N>]\n");
+}
+
 int main(int argc, char** argv) {
-  if (argc != 4) {
-    fprintf(stderr, "usage: ./shardkv <PORT> <SHARD MANAGER HOSTNAME> " \
-                    "<SHARD MANAGER PORT>\n");
+  if (argc < 4) {
+    usage();
     return 1;
   }
+  ShardkvOptions options;
+  for (int i = 4; i < argc; i++) {
+    std::string flag(argv[i]);
+    std::string value = flag.substr(flag.find('=') + 1);
+    if (flag.rfind("--migration-concurrency=", 0) == 0) {
+      options.migrationConcurrency = std::stoul(value);
+    } else if (flag.rfind("--migration-bandwidth=", 0) == 0) {
+      options.migrationBandwidth = std::stoull(value);
+    } else if (flag == "--migration-mode=push") {
+      options.migrationMode = MigrationMode::PUSH;
+    } else if (flag == "--migration-mode=pull") {
+      options.migrationMode = MigrationMode::PULL;
+    } else if (flag.rfind("--hot-key-copies=", 0) == 0) {
+      options.hotKeyCopies = std::stoul(value);
+    } else {
+      usage();
+      return 1;
+    }
+  }
   // get our hostname so we can construct address for shardkv. we need this
   // because the shardmanager will know us by our hostname and port, so we should
   // track that.
@@ -27,7 +53,7 @@ int main(int argc, char** argv) {
 
   ::grpc::ServerBuilder builder;
   builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  ShardkvServer shardkv(addr, shardmaster_addr);
+  ShardkvServer shardkv(addr, shardmaster_addr, options);
   builder.RegisterService(&shardkv);
   std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
 
@@ -0,0 +1,202 @@
+#include "migration_scheduler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#include "../common/retry.h"
+
+TokenBucket::TokenBucket(uint64_t rate)
+    : rate(static_cast<double>(rate)),
+      tokens(static_cast<double>(rate)),
+      last(std::chrono::steady_clock::now()) {}
+
+void TokenBucket::Acquire(uint64_t bytes) {
+  if (rate == 0) return;
+  std::chrono::duration<double> wait(0);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last;
+    last = now;
+    tokens = std::min(rate, tokens + elapsed.count() * rate);
+    tokens -= static_cast<double>(bytes);
+    if (tokens < 0) {
+      wait = std::chrono::duration<double>(-tokens / rate);
+    }
+  }
+  if (wait.count() > 0) {
+    std::this_thread::sleep_for(wait);
+  }
+}
+
+MigrationScheduler::MigrationScheduler(size_t maxConcurrent,
+                                       uint64_t bytesPerSecond,
+                                       TransferFn transfer)
+    : bucket(bytesPerSecond), transfer(std::move(transfer)) {
+  size_t n = std::max<size_t>(1, maxConcurrent);
+  for (size_t i = 0; i < n; i++) {
+    workers.emplace_back([this]() { Worker(); });
+  }
+}
+
+MigrationScheduler::~MigrationScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+uint64_t MigrationScheduler::Schedule(const std::string& destination,
+                                      std::vector<std::string> keys) {
+  return Enqueue(destination, false, std::move(keys), transfer, nullptr);
+}
+
+uint64_t MigrationScheduler::SchedulePull(const std::string& source,
+                                          std::vector<std::string> keys,
+                                          TransferFn pull, DoneFn done) {
+  return Enqueue(source, true, std::move(keys), std::move(pull),
+                 std::move(done));
+}
+
+uint64_t MigrationScheduler::Enqueue(const std::string& peer, bool incoming,
+                                     std::vector<std::string> keys,
+                                     TransferFn transfer, DoneFn done) {
+  std::lock_guard<std::mutex> lock(mtx);
+  uint64_t id = nextId++;
+  Move move;
+  move.progress = {id, peer, incoming, MigrationState::PENDING, keys.size(), 0, 0, 0};
+  move.keys = std::move(keys);
+  move.notBefore = std::chrono::steady_clock::now();
+  move.transfer = std::move(transfer);
+  move.done = std::move(done);
+  moves.emplace(id, std::move(move));
+  cv.notify_one();
+  return id;
+}
+
+std::optional<MigrationProgress> MigrationScheduler::Status(uint64_t id) {
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = moves.find(id);
+  if (it == moves.end()) {
+    return std::nullopt;
+  }
+  return it->second.progress;
+}
+
+std::vector<std::string> MigrationScheduler::TakeStranded() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return std::exchange(stranded, {});
+}
+
+std::vector<MigrationProgress> MigrationScheduler::AllStatus() {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::vector<MigrationProgress> all;
+  for (const auto& [id, move] : moves) {
+    all.push_back(move.progress);
+  }
+  return all;
+}
+
+MigrationScheduler::Move* MigrationScheduler::NextRunnable(
+    std::chrono::steady_clock::time_point now,
+    std::chrono::steady_clock::time_point* wakeup) {
+  for (auto& [id, move] : moves) {
+    if (move.progress.state != MigrationState::PENDING ||
+        busyPeers.count(move.progress.peer)) {
+      continue;
+    }
+    if (move.notBefore > now) {
+      *wakeup = std::min(*wakeup, move.notBefore);
+      continue;
+    }
+    return &move;
+  }
+  return nullptr;
+}
+
+void MigrationScheduler::Finish(uint64_t id) {
+  finished.push_back(id);
+  while (finished.size() > FINISHED_HISTORY) {
+    moves.erase(finished.front());
+    finished.pop_front();
+  }
+}
+
+void MigrationScheduler::Worker() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!stopping) {
+    auto wakeup = std::chrono::steady_clock::time_point::max();
+    Move* move = NextRunnable(std::chrono::steady_clock::now(), &wakeup);
+    if (move == nullptr) {
+      if (wakeup == std::chrono::steady_clock::time_point::max()) {
+        cv.wait(lock);
+      } else {
+        cv.wait_until(lock, wakeup);
+      }
+      continue;
+    }
+
+    // moves live in a std::map, so the pointer stays valid while we run it;
+    // only finished moves are ever erased
+    MigrationProgress& progress = move->progress;
+    const std::string peer = progress.peer;
+    progress.state = MigrationState::RUNNING;
+    progress.attempts++;
+    busyPeers.insert(peer);
+    size_t next = progress.keysMoved;
+    lock.unlock();
+
+    bool reachable = true;
+    while (next < move->keys.size()) {
+      uint64_t bytes = 0;
+      uint64_t charged = 0;
+      auto charge = [this, &charged](uint64_t size) {
+        bucket.Acquire(size);
+        charged += size;
+      };
+      if (!move->transfer(peer, move->keys[next], charge, &bytes)) {
+        reachable = false;
+        break;
+      }
+      if (bytes > charged) bucket.Acquire(bytes - charged);
+      next++;
+      std::lock_guard<std::mutex> progressLock(mtx);
+      progress.keysMoved = next;
+      progress.bytesMoved += bytes;
+    }
+
+    lock.lock();
+    busyPeers.erase(peer);
+    if (!reachable && progress.attempts < MAX_ATTEMPTS) {
+      progress.state = MigrationState::PENDING;
+      // spread out, so moves that failed together do not retry together
+      move->notBefore = std::chrono::steady_clock::now() + RETRY_DELAY / 2 +
+                        JitteredBackoff(1, RETRY_DELAY, RETRY_DELAY);
+    } else {
+      if (!reachable) {
+        std::cerr << "Giving up on migration " << progress.id << " with "
+                  << peer << std::endl;
+        if (!progress.incoming) {
+          stranded.insert(stranded.end(), move->keys.begin() + next, move->keys.end());
+        }
+      }
+      progress.state = reachable ? MigrationState::DONE : MigrationState::FAILED;
+      // Finish may drop the move, so keep what the callback needs
+      MigrationProgress finalProgress = progress;
+      DoneFn done = std::move(move->done);
+      Finish(progress.id);
+      if (done) {
+        lock.unlock();
+        done(finalProgress);
+        lock.lock();
+      }
+    }
+    // a group just became free, so another worker may have work now
+    cv.notify_all();
+  }
+}
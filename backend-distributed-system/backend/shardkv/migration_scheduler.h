@@ -0,0 +1,149 @@
+#ifndef SHARDING_MIGRATION_SCHEDULER_H
+#define SHARDING_MIGRATION_SCHEDULER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// lifecycle of a single shard move, in the same order as MoveStatus::State
+enum class MigrationState { PENDING, RUNNING, DONE, FAILED };
+
+// snapshot of a shard move, as reported by the MigrationStatus RPC
+struct MigrationProgress {
+  uint64_t id;
+  // the group we send keys to, or pull them from for incoming moves
+  std::string peer;
+  bool incoming;
+  MigrationState state;
+  size_t keysTotal;
+  size_t keysMoved;
+  uint64_t bytesMoved;
+  uint32_t attempts;
+};
+
+/**
+ * A simple token bucket used to cap the bandwidth spent on migrations. Tokens
+ * are bytes and refill at `rate` bytes per second, with at most one second of
+ * burst. A rate of 0 disables throttling.
+ */
+class TokenBucket {
+ public:
+  explicit TokenBucket(uint64_t rate);
+
+  // blocks until `bytes` may be sent. A request larger than the bucket drives
+  // it into debt, so huge values are still sent, just followed by a pause.
+  void Acquire(uint64_t bytes);
+
+ private:
+  std::mutex mtx;
+  const double rate;
+  double tokens;
+  std::chrono::steady_clock::time_point last;
+};
+
+/**
+ * Runs shard moves on a small pool of worker threads. Moves to different
+ * groups run concurrently, moves to the same group run one after the other so
+ * a single slow group never gets more than one stream. A move whose group is
+ * unreachable is parked and retried later instead of holding a worker. One
+ * that is still failing after MAX_ATTEMPTS is reported FAILED, and the keys
+ * an outgoing move did not send are kept for TakeStranded.
+ *
+ * Outgoing moves push keys to their new owner, incoming moves (used by the
+ * pull migration mode) fetch keys from their previous owner.
+ */
+class MigrationScheduler {
+ public:
+  // blocks until `bytes` may be sent within the bandwidth cap, see
+  // TokenBucket
+  using ChargeFn = std::function<void(uint64_t bytes)>;
+  // moves a single key to or from `peer`. returns false if the peer could
+  // not be reached; `bytes` is set to the amount of data moved. a transfer
+  // that knows its size up front charges it before sending, whatever it did
+  // not charge is charged once it returns
+  using TransferFn = std::function<bool(const std::string& peer,
+                                        const std::string& key,
+                                        const ChargeFn& charge,
+                                        uint64_t* bytes)>;
+  // called once a move is DONE or FAILED, from the worker that ran it
+  using DoneFn = std::function<void(const MigrationProgress& progress)>;
+
+  MigrationScheduler(size_t maxConcurrent, uint64_t bytesPerSecond,
+                     TransferFn transfer);
+  ~MigrationScheduler();
+
+  // queues the given keys for transfer to destination, returns the move's id
+  uint64_t Schedule(const std::string& destination,
+                    std::vector<std::string> keys);
+
+  // queues the given keys to be fetched from source with pull, in order, and
+  // calls done once the move finished. returns the move's id
+  uint64_t SchedulePull(const std::string& source,
+                        std::vector<std::string> keys, TransferFn pull,
+                        DoneFn done);
+
+  // returns the progress of a move, or nullopt if the id is unknown
+  std::optional<MigrationProgress> Status(uint64_t id);
+
+  // returns the progress of every move we still remember
+  std::vector<MigrationProgress> AllStatus();
+
+  // returns the keys of the outgoing moves that were given up on since the
+  // last call, so the next configuration sends them again
+  std::vector<std::string> TakeStranded();
+
+  // number of attempts before a move to an unreachable group is failed
+  static constexpr uint32_t MAX_ATTEMPTS = 500;
+  // how long a move waits after its group was unreachable, on average
+  static constexpr std::chrono::milliseconds RETRY_DELAY{200};
+  // number of finished moves kept around for status queries
+  static constexpr size_t FINISHED_HISTORY = 256;
+
+ private:
+  struct Move {
+    MigrationProgress progress;
+    std::vector<std::string> keys;
+    std::chrono::steady_clock::time_point notBefore;
+    // transfer function of this move
+    TransferFn transfer;
+    DoneFn done;
+  };
+
+  void Worker();
+  // picks the first runnable move, returns nullptr if there is none. must be
+  // called with mtx held
+  Move* NextRunnable(std::chrono::steady_clock::time_point now,
+                     std::chrono::steady_clock::time_point* wakeup);
+  void Finish(uint64_t id);
+  uint64_t Enqueue(const std::string& peer, bool incoming,
+                   std::vector<std::string> keys, TransferFn transfer,
+                   DoneFn done);
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stopping = false;
+  uint64_t nextId = 1;
+  // every move we know about, keyed by id so runnable moves come out FIFO
+  std::map<uint64_t, Move> moves;
+  // ids of finished moves, oldest first
+  std::deque<uint64_t> finished;
+  // groups that currently have a move in flight
+  std::set<std::string> busyPeers;
+  // keys of FAILED outgoing moves not taken yet, see TakeStranded
+  std::vector<std::string> stranded;
+
+  TokenBucket bucket;
+  TransferFn transfer;
+  std::vector<std::thread> workers;
+};
+
+#endif  // SHARDING_MIGRATION_SCHEDULER_H
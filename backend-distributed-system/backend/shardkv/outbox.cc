@@ -0,0 +1,88 @@
+#include "outbox.h"
+
+#include <algorithm>
+
+Outbox::Outbox(RouteFn route, SendFn send)
+    : route(std::move(route)), send(std::move(send)) {
+  sender = std::thread([this]() { Sender(); });
+}
+
+Outbox::~Outbox() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  cv.notify_all();
+  sender.join();
+}
+
+void Outbox::Add(OutboxEntry entry) {
+  std::lock_guard<std::mutex> lock(mtx);
+  entries.emplace(nextId++, std::move(entry));
+  cv.notify_one();
+}
+
+void Outbox::Remove(const std::vector<OutboxEntry>& delivered) {
+  std::lock_guard<std::mutex> lock(mtx);
+  for (const auto& entry : delivered) {
+    auto it = std::find_if(entries.begin(), entries.end(), [&entry](const auto& queued) {
+      return queued.second.key == entry.key && queued.second.data == entry.data;
+    });
+    if (it != entries.end()) entries.erase(it);
+  }
+}
+
+size_t Outbox::Size() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return entries.size();
+}
+
+void Outbox::Sender() {
+  std::unique_lock<std::mutex> lock(mtx);
+  while (!stopping) {
+    if (entries.empty()) {
+      cv.wait(lock);
+      continue;
+    }
+    // route a snapshot, entries added meanwhile go out with the next round
+    auto now = std::chrono::steady_clock::now();
+    auto wakeup = now + MIN_BACKOFF;
+    std::map<std::string, std::pair<std::vector<uint64_t>, std::vector<OutboxEntry>>> batches;
+    std::vector<std::pair<uint64_t, OutboxEntry>> queued(entries.begin(), entries.end());
+    std::map<std::string, Backoff> waiting = backoffs;
+    lock.unlock();
+    for (auto& [id, entry] : queued) {
+      std::string group = route(entry.key);
+      if (group.empty()) continue;
+      auto backoff = waiting.find(group);
+      if (backoff != waiting.end() && backoff->second.notBefore > now) {
+        wakeup = std::min(wakeup, backoff->second.notBefore);
+        continue;
+      }
+      auto& [ids, batch] = batches[group];
+      if (ids.size() == MAX_BATCH) continue;
+      ids.push_back(id);
+      batch.push_back(std::move(entry));
+    }
+
+    for (const auto& [group, pending] : batches) {
+      const auto& [ids, batch] = pending;
+      bool sent = send(group, batch);
+      std::lock_guard<std::mutex> batchLock(mtx);
+      if (sent) {
+        for (uint64_t id : ids) entries.erase(id);
+        backoffs.erase(group);
+        // more may be waiting for this group
+        wakeup = now;
+        continue;
+      }
+      auto& backoff = backoffs[group];
+      backoff.delay = std::min(MAX_BACKOFF, std::max(MIN_BACKOFF, 2 * backoff.delay));
+      backoff.notBefore = std::chrono::steady_clock::now() + backoff.delay;
+    }
+    lock.lock();
+    if (!stopping && wakeup > std::chrono::steady_clock::now()) {
+      cv.wait_until(lock, wakeup);
+    }
+  }
+}
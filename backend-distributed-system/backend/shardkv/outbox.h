@@ -0,0 +1,83 @@
+#ifndef SHARDING_OUTBOX_H
+#define SHARDING_OUTBOX_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// an append to another group's key that one of our writes implies, e.g. a
+// post added to its user's post list
+struct OutboxEntry {
+  std::string key;
+  std::string data;
+};
+
+/**
+ * Sends the appends our writes imply for keys of other groups in the
+ * background, so a write never waits on another group. Entries are sent in
+ * order, in batches of up to MAX_BATCH per destination, to whichever group owns
+ * their key at the time. A group that cannot be reached is retried with
+ * exponential backoff without holding up the entries of other groups.
+ *
+ * Entries stay queued until they are delivered, however long that takes, so
+ * they may be delivered more than once (e.g. by a backup that took over); the
+ * receiving side must apply them idempotently.
+ */
+class Outbox {
+ public:
+  // the group to send an entry for key to, or an empty string to hold on to
+  // it for now
+  using RouteFn = std::function<std::string(const std::string& key)>;
+  // delivers a batch to group. returns false if the group did not take it
+  using SendFn = std::function<bool(const std::string& group,
+                                    const std::vector<OutboxEntry>& batch)>;
+
+  Outbox(RouteFn route, SendFn send);
+  ~Outbox();
+
+  // queues entry for delivery
+  void Add(OutboxEntry entry);
+
+  // drops queued entries matching the given ones, which were delivered by
+  // someone else
+  void Remove(const std::vector<OutboxEntry>& entries);
+
+  // number of entries not delivered yet
+  size_t Size();
+
+  // largest number of entries sent to a group at once
+  static constexpr size_t MAX_BATCH = 128;
+  // backoff after the first failure for a group, doubled with every further
+  // one up to MAX_BACKOFF. also how long entries without a route are held
+  static constexpr std::chrono::milliseconds MIN_BACKOFF{100};
+  static constexpr std::chrono::milliseconds MAX_BACKOFF{5000};
+
+ private:
+  struct Backoff {
+    std::chrono::milliseconds delay{0};
+    std::chrono::steady_clock::time_point notBefore;
+  };
+
+  void Sender();
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool stopping = false;
+  uint64_t nextId = 1;
+  // keyed by id so entries come out in the order they were added
+  std::map<uint64_t, OutboxEntry> entries;
+  // groups that failed recently
+  std::map<std::string, Backoff> backoffs;
+
+  RouteFn route;
+  SendFn send;
+  std::thread sender;
+};
+
+#endif  // SHARDING_OUTBOX_H
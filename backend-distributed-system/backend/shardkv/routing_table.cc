@@ -0,0 +1,68 @@
+#include "routing_table.h"
+
+#include <algorithm>
+
+RoutingTable::RoutingTable() : version(0), maxKey(MAX_KEY), partitioning(Partitioning::ID), servers(1) {}
+
+RoutingTable::RoutingTable(const QueryResponse& config, const std::string& self)
+    : RoutingTable() {
+  version = config.version();
+  // shardmasters that predate configurable key spaces leave it unset
+  if (config.max_key() != 0) maxKey = config.max_key();
+  partitioning = static_cast<Partitioning>(config.partitioning());
+  for (const auto& entry : config.config()) {
+    uint32_t server = servers.size();
+    servers.push_back(entry.server());
+    bool ours = entry.server() == self;
+    for (const auto& shard : entry.shards()) {
+      uint64_t lower = std::max(shard.lower(), MIN_KEY);
+      uint64_t upper = std::min(shard.upper(), maxKey);
+      if (lower > upper) continue;
+      intervals.push_back({lower, upper, server});
+      if (ours) {
+        ownedShards.push_back({lower, upper});
+      }
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(),
+            [](const Interval& a, const Interval& b) { return a.lower < b.lower; });
+  sortAscendingInterval(ownedShards);
+}
+
+bool RoutingTable::Owns(uint64_t id) const {
+  // the last shard starting at or before id is the only one that can hold it
+  auto it = std::upper_bound(ownedShards.begin(), ownedShards.end(), id,
+                             [](uint64_t k, const shard_t& s) { return k < s.lower; });
+  if (it == ownedShards.begin()) return false;
+  --it;
+  return id <= it->upper;
+}
+
+const std::string& RoutingTable::Owner(uint64_t id) const {
+  // the last interval starting at or before id is the only one that can hold it
+  auto it = std::upper_bound(intervals.begin(), intervals.end(), id,
+                             [](uint64_t k, const Interval& i) { return k < i.lower; });
+  if (it == intervals.begin()) return servers[0];
+  --it;
+  return id <= it->upper ? servers[it->server] : servers[0];
+}
+
+shard_t RoutingTable::ShardOf(uint64_t id) const {
+  auto it = std::upper_bound(intervals.begin(), intervals.end(), id,
+                             [](uint64_t k, const Interval& i) { return k < i.lower; });
+  if (it == intervals.begin() || id > (--it)->upper) return {id, id};
+  return {it->lower, it->upper};
+}
+
+std::vector<std::pair<shard_t, std::string>> RoutingTable::Owners(const shard_t& shard) const {
+  std::vector<std::pair<shard_t, std::string>> owners;
+  auto it = std::upper_bound(intervals.begin(), intervals.end(), shard.lower,
+                             [](uint64_t k, const Interval& i) { return k < i.lower; });
+  if (it != intervals.begin()) --it;
+  for (; it != intervals.end() && it->lower <= shard.upper; ++it) {
+    if (it->upper < shard.lower) continue;
+    owners.push_back({{std::max(it->lower, shard.lower), std::min(it->upper, shard.upper)},
+                      servers[it->server]});
+  }
+  return owners;
+}
@@ -0,0 +1,80 @@
+#ifndef SHARDING_ROUTING_TABLE_H
+#define SHARDING_ROUTING_TABLE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../build/shardmaster.grpc.pb.h"
+#include "../common/common.h"
+#include "../common/key_hash.h"
+
+/**
+ * Immutable snapshot of a shardmaster configuration, as seen by one group. It
+ * keeps the configuration as sorted intervals pointing at interned server ids,
+ * plus the sorted shards of the group itself, so ownership checks on the
+ * request path are a binary search whatever the size of the key space.
+ *
+ * Tables are never modified once built; a new configuration gets a new table
+ * which is published by swapping a std::shared_ptr.
+ */
+class RoutingTable {
+ public:
+  // an empty table, owning nothing
+  RoutingTable();
+  // builds the table for the group `self` from a shardmaster configuration
+  RoutingTable(const QueryResponse& config, const std::string& self);
+
+  // version of the configuration this table was built from
+  uint64_t Version() const { return version; }
+
+  // the largest key of the key space the configuration covers
+  uint64_t MaxKey() const { return maxKey; }
+
+  // where key sits in the key space, by its id or its hash depending on the
+  // configuration. returns false for keys that are not routed, see keyPosition
+  bool Position(const std::string& key, uint64_t* position) const {
+    return keyPosition(key, partitioning, maxKey, position);
+  }
+
+  // true if our group owns id
+  bool Owns(uint64_t id) const;
+
+  // the group owning id, or an empty string if no group does
+  const std::string& Owner(uint64_t id) const;
+
+  // the shard of the configuration holding id, {id, id} if none does
+  shard_t ShardOf(uint64_t id) const;
+
+  // the parts of shard owned by some group, in order, with their owner
+  std::vector<std::pair<shard_t, std::string>> Owners(const shard_t& shard) const;
+
+  // every group in the configuration, in its order
+  std::vector<std::string> Groups() const {
+    return std::vector<std::string>(servers.begin() + 1, servers.end());
+  }
+
+  // the shards our group owns, sorted
+  const std::vector<shard_t>& OwnedShards() const { return ownedShards; }
+
+ private:
+  struct Interval {
+    uint64_t lower;
+    uint64_t upper;
+    // index into servers
+    uint32_t server;
+  };
+
+  uint64_t version;
+  uint64_t maxKey;
+  // how keys are placed, as published by the shardmaster
+  Partitioning partitioning;
+  // sorted by lower, never overlapping
+  std::vector<Interval> intervals;
+  // every group in the configuration, index 0 is the empty string
+  std::vector<std::string> servers;
+  // sorted by lower, never overlapping
+  std::vector<shard_t> ownedShards;
+};
+
+#endif  // SHARDING_ROUTING_TABLE_H
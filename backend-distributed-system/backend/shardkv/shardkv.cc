@@ -1,7 +1,27 @@
 #include <grpcpp/grpcpp.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <set>
 
 #include "shardkv.h"
 
+// the answer to a write whose key is no longer at its if_version
+static const ::grpc::Status VERSION_CHANGED(::grpc::StatusCode::ABORTED, "Key changed since the given version");
+// the answer of a member that does not have the keys of the one before it yet
+static const ::grpc::Status STILL_LOADING(::grpc::StatusCode::FAILED_PRECONDITION, "Still loading keys");
+
+// the answer to a write our successor could not take, having applied nothing.
+// a successor that is still loading or unreachable is worth trying again soon
+static ::grpc::Status ForwardFailed(const ::grpc::Status& status) {
+    switch (status.error_code()) {
+        case ::grpc::StatusCode::FAILED_PRECONDITION:
+        case ::grpc::StatusCode::UNAVAILABLE:
+            return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "Successor not ready, try again");
+        default:
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+    }
+}
+
 /**
  * This method is analogous to a hashmap lookup. A key is supplied in the
  * request and if its value can be found, we should either set the appropriate
@@ -18,12 +38,51 @@
 ::grpc::Status ShardkvServer::Get(::grpc::ServerContext* context,
                                   const ::GetRequest* request,
                                   ::GetResponse* response) {
+    // a member still loading may lack any key, even for a relaxed read
+    if (!loaded) return STILL_LOADING;
+    if (request->consistency() != GetRequest::STRONG && CurrentView()->tail != address) {
+        return FollowerGet(*request, response);
+    }
+    if (!CheckView(context, true)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the primary of this view");
+    }
     auto requestedKey = request->key();
-    auto it = keyValueDatabase.find(requestedKey);
+    uint64_t position;
+    auto table = Routing();
+    bool positioned = table->Position(requestedKey, &position);
+    if (positioned) {
+        CountRequest(position);
+        if (options.hotKeyCopies > 0) hotKeyReads.Count(requestedKey);
+    }
+    // in pull mode a key whose range moved on may have been written at its new
+    // owner since, so whatever we still hold of it is not served. a key to be
+    // pushed is ours to serve until it is handed over
+    bool ours = !positioned || table->Owns(position);
+    bool served = ours || options.migrationMode != MigrationMode::PULL;
+    EnsureLocal(requestedKey, context);
+    std::lock_guard<std::mutex> lock(serverMutex);
+    auto it = served ? keyValueDatabase.find(requestedKey) : keyValueDatabase.end();
     if(it == keyValueDatabase.end()) {
+        // another group's hot key we hold a copy of
+        auto copy = copies.find(requestedKey);
+        if (copy != copies.end() && copy->second.expires <= std::chrono::steady_clock::now()) {
+            copies.erase(copy);
+        } else if (copy != copies.end() && copy->second.valid) {
+            AnswerRead(copy->second.data, *request, response);
+            return ::grpc::Status::OK;
+        }
+        if (!ours) {
+            return NotResponsible(context, *table, position);
+        }
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Specified key not found in the database");
     }
-    response->set_data(it->second);
+    AnswerRead(it->second, *request, response);
+    auto hot = hotKeys.find(requestedKey);
+    if (hot != hotKeys.end()) {
+        for (const auto& group : hot->second.groups) {
+            response->add_copies(group);
+        }
+    }
     return ::grpc::Status::OK;
 }
 
@@ -44,55 +103,83 @@
 ::grpc::Status ShardkvServer::Put(::grpc::ServerContext* context,
                                   const ::PutRequest* request,
                                   Empty* response) {
+    if (!loaded) return STILL_LOADING;
+    if (!CheckView(context)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the primary of this view");
+    }
+    // a retry of a write we applied already is acknowledged right away
+    if (Applied(request->id())) return ::grpc::Status::OK;
     std::string requestedKey = request->key();
     std::string requestedData = request->data();
     std::string requestedUser = request->user();
-    if(primaryServerAddress == address && !backupServerAddress.empty()) {
-        auto serverChannel = ::grpc::CreateChannel(backupServerAddress, ::grpc::InsecureChannelCredentials());
+    std::string postUserKey = requestedUser + "_posts";
+    // where the key and the user's post list live, worked out once per request
+    uint64_t position;
+    uint64_t userPosition = 0;
+    if (!Routing()->Position(requestedKey, &position)) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key can not be placed in the key space");
+    }
+    if (!requestedUser.empty() && !Routing()->Position(postUserKey, &userPosition)) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "User can not be placed in the key space");
+    }
+    CountRequest(position);
+    // held until the write is applied, see keyLocks and forwardMutex
+    std::lock_guard<std::mutex> keyLock(KeyLock(requestedKey));
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    // a misrouted write is turned away before it reaches our backup
+    auto table = Routing();
+    if (!table->Owns(position)) {
+        return NotResponsible(context, *table, position);
+    }
+    // pull before replicating, so the pulled value never overwrites this write
+    // on the backup
+    EnsureLocal(requestedKey, context);
+    if (!requestedUser.empty()) EnsureLocal(postUserKey, context);
+    // the version is checked once, the members after us apply what we decide
+    if (VersionChanged(requestedKey, request->if_version())) return VERSION_CHANGED;
+    if (request->if_absent() && Stored(requestedKey)) return ::grpc::Status::OK;
+    std::string successor = CurrentView()->successor;
+    if(!successor.empty()) {
+        auto serverChannel = ::grpc::CreateChannel(successor, ::grpc::InsecureChannelCredentials());
         auto newkvStub = Shardkv::NewStub(serverChannel);
-        ::grpc::ClientContext context;
-        auto status = newkvStub->Put(&context, *request, response);
-        if (!status.ok()) return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+        PutRequest forward = *request;
+        forward.set_if_version(0);
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return newkvStub->Put(cc.get(), forward, response);
+        }, request->id().client_id() != 0 || request->if_absent(), context->deadline());
+        if (!status.ok()) return ForwardFailed(status);
     }
-    int keyID = extractID(requestedKey);
-    if(keyServerMap.find(keyID) == keyServerMap.end() || keyServerMap[keyID]!=shardmanager_address) {
-        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server not responsible for the specified key");
+    CountWrite(context);
+    PendingDrops pending{this};
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if (!dedup.Admit(request->id())) return ::grpc::Status::OK;
+    if (request->if_version() != 0) {
+        context->AddTrailingMetadata(VERSION_METADATA, std::to_string(ValueVersion(requestedData)));
     }
     if(requestedKey.find("post", 0) == std::string::npos) {
-        keyValueDatabase["all_users"] += (requestedKey+",");
+        // only users are listed, any other key is just stored
+        if (requestedKey.rfind("user_", 0) == 0) keyValueDatabase["all_users"] += (requestedKey+",");
         keyValueDatabase[requestedKey] = requestedData;
+        KeyWritten(requestedKey, &pending.drops);
         return ::grpc::Status::OK;
     }
     if (requestedUser.empty()) {
         keyValueDatabase[requestedKey] = requestedData;
+        KeyWritten(requestedKey, &pending.drops);
         return ::grpc::Status::OK;
     }
-    int userID = extractID(requestedUser);
-    std::string postUserKey = requestedUser + "_posts";
-    if (keyServerMap[userID] != shardmanager_address) {
-        std::chrono::milliseconds timespan(100);
-        auto serverChannel = grpc::CreateChannel(keyServerMap[userID], grpc::InsecureChannelCredentials());
-        auto stub = Shardkv::NewStub(serverChannel);
-        int i = 0;
-        while(i < MAX_SERVER_ATTEMPTS) {
-            ::grpc::ClientContext context;
-            AppendRequest request;
-            Empty res;
-            request.set_key(postUserKey);
-            request.set_data(requestedKey);
-            auto status = stub->Append(&context, request, &res);
-            if(status.ok()) break;
-            std::this_thread::sleep_for(timespan);
-            i++;
-        }
-        if (i == MAX_SERVER_ATTEMPTS) {
-            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Unable to contact server");
-        }
+    if (!table->Owns(userPosition)) {
+        // the user's list lives with another group, it is updated in the
+        // background so the write never waits on that group
+        outbox->Add({postUserKey, requestedKey});
     } else {
         keyValueDatabase[postUserKey] += (requestedKey + ",");
+        KeyWritten(postUserKey, &pending.drops);
     }
     postUserMap[requestedKey] = requestedUser;
     keyValueDatabase[requestedKey] = requestedData;
+    KeyWritten(requestedKey, &pending.drops);
     return ::grpc::Status::OK;
 }
 
@@ -112,25 +199,169 @@
 ::grpc::Status ShardkvServer::Append(::grpc::ServerContext* context,
                                      const ::AppendRequest* request,
                                      Empty* response) {
+    if (!loaded) return STILL_LOADING;
+    if (!CheckView(context)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the primary of this view");
+    }
+    // a retry of a write we applied already is acknowledged right away
+    if (Applied(request->id())) return ::grpc::Status::OK;
     std::string requestedKey = request->key();
     std::string requestedData = request->data();
-    int keyID = extractID(requestedKey);
-    std::string user = (requestedKey[0] == 'p') ? postUserMap[requestedKey] : (requestedKey[requestedKey.length()-1] == 's') ? "" : requestedKey;
-    if(keyServerMap.find(keyID) == keyServerMap.end() || keyServerMap[keyID] != shardmanager_address) {
-        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server not responsible for the specified key");
+    uint64_t position;
+    if (!Routing()->Position(requestedKey, &position)) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key can not be placed in the key space");
     }
-    if (requestedKey.back() == 's') {
-        keyValueDatabase[requestedKey].append(requestedData + ",");
+    CountRequest(position);
+    // held until the write is applied, see keyLocks and forwardMutex
+    std::lock_guard<std::mutex> keyLock(KeyLock(requestedKey));
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    if (auto table = Routing(); !table->Owns(position)) {
+        return NotResponsible(context, *table, position);
+    }
+    EnsureLocal(requestedKey, context);
+    // the version is checked once, the members after us apply what we decide
+    if (VersionChanged(requestedKey, request->if_version())) return VERSION_CHANGED;
+    std::string successor = CurrentView()->successor;
+    if(!successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        AppendRequest forward = *request;
+        forward.set_if_version(0);
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->Append(cc.get(), forward, response);
+        }, request->id().client_id() != 0, context->deadline());
+        if (!status.ok()) return ForwardFailed(status);
+    }
+    CountWrite(context);
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if (!dedup.Admit(request->id())) return ::grpc::Status::OK;
+    // a conditional append tells the version it leaves the key at
+    auto appended = [&]() {
+        if (request->if_version() != 0) {
+            context->AddTrailingMetadata(VERSION_METADATA, std::to_string(ValueVersion(keyValueDatabase[requestedKey])));
+        }
         return ::grpc::Status::OK;
+    };
+    KeyWritten(requestedKey, &pending.drops);
+    const std::string postsSuffix = "_posts";
+    if (requestedKey.size() > postsSuffix.size() &&
+        requestedKey.compare(requestedKey.size() - postsSuffix.size(), postsSuffix.size(), postsSuffix) == 0) {
+        keyValueDatabase[requestedKey].append(requestedData + ",");
+        return appended();
     }
     bool isPostKey = requestedKey.find("post_") == 0;
-    std::string userKey = isPostKey ? postUserMap[requestedKey] + "_posts" : "all_users";
+    bool isUserKey = requestedKey.find("user_") == 0;
     if (keyValueDatabase.find(requestedKey) == keyValueDatabase.end()) {
         keyValueDatabase[requestedKey] = requestedData;
-        keyValueDatabase[userKey].append(requestedKey + ",");
+        // users and posts are listed, any other key is just stored
+        if (isPostKey) {
+            std::string postUserKey = postUserMap[requestedKey] + "_posts";
+            keyValueDatabase[postUserKey].append(requestedKey + ",");
+            KeyWritten(postUserKey, &pending.drops);
+        } else if (isUserKey) {
+            keyValueDatabase["all_users"].append(requestedKey + ",");
+        }
     } else {
         keyValueDatabase[requestedKey].append(requestedData);
     }
+    return appended();
+}
+
+/**
+ * Applies the appends another group's writes imply for our keys, sent from its
+ * outbox. A batch may arrive more than once, so an item already in a post list
+ * is not added again. Every key must be ours, otherwise nothing is applied and
+ * the sender routes the batch again.
+ *
+ * @param context - you can ignore this
+ * @param request the appends, in order
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::AppendBatch(::grpc::ServerContext* context,
+                                          const ::AppendBatchRequest* request,
+                                          Empty* response) {
+    if (!loaded) return STILL_LOADING;
+    std::vector<std::string> keys;
+    std::vector<uint64_t> positions;
+    for (const auto& append : request->appends()) {
+        uint64_t position;
+        if (!Routing()->Position(append.key(), &position)) {
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Key can not be placed in the key space");
+        }
+        keys.push_back(append.key());
+        positions.push_back(position);
+    }
+    // held until the write is applied, see keyLocks and forwardMutex
+    auto locked = LockKeys(keys);
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    // a misrouted batch is turned away before it reaches our backup
+    auto table = Routing();
+    for (uint64_t position : positions) {
+        if (!table->Owns(position)) {
+            return NotResponsible(context, *table, position);
+        }
+    }
+    for (const auto& key : keys) {
+        EnsureLocal(key, context);
+    }
+    std::string successor = CurrentView()->successor;
+    if(!successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->AppendBatch(cc.get(), *request, response);
+        }, false, context->deadline());
+        if (!status.ok()) return ForwardFailed(status);
+    }
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    const std::string postsSuffix = "_posts";
+    for (const auto& append : request->appends()) {
+        const std::string& key = append.key();
+        std::string& value = keyValueDatabase[key];
+        KeyWritten(key, &pending.drops);
+        if (key.size() <= postsSuffix.size() ||
+            key.compare(key.size() - postsSuffix.size(), postsSuffix.size(), postsSuffix) != 0) {
+            value.append(append.data());
+            continue;
+        }
+        if (("," + value).find("," + append.data() + ",") == std::string::npos) {
+            value.append(append.data() + ",");
+        }
+    }
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Called by our primary with the appends it delivered from its outbox, which
+ * we hold as well since we saw the same writes. They are dropped here so we
+ * don't send them again if we take over.
+ *
+ * @param context - you can ignore this
+ * @param request the delivered appends
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::TrimOutbox(::grpc::ServerContext* context,
+                                         const ::AppendBatchRequest* request,
+                                         Empty* response) {
+    std::string successor = CurrentView()->successor;
+    if (!successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->TrimOutbox(cc.get(), *request, response);
+        }, true, context->deadline());
+    }
+    std::vector<OutboxEntry> delivered;
+    for (const auto& append : request->appends()) {
+        delivered.push_back({append.key(), append.data()});
+    }
+    outbox->Remove(delivered);
     return ::grpc::Status::OK;
 }
 
@@ -149,16 +380,112 @@
 ::grpc::Status ShardkvServer::Delete(::grpc::ServerContext* context,
                                            const ::DeleteRequest* request,
                                            Empty* response) {
+    if (!loaded) return STILL_LOADING;
+    if (!CheckView(context)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the primary of this view");
+    }
+    // a retry of a write we applied already is acknowledged right away
+    if (Applied(request->id())) return ::grpc::Status::OK;
     auto requestedKey = request->key();
-	if(this->keyValueDatabase.find(requestedKey)!=this->keyValueDatabase.end())
+    uint64_t position;
+    if (Routing()->Position(requestedKey, &position)) CountRequest(position);
+    // held until the write is applied, see keyLocks and forwardMutex
+    std::lock_guard<std::mutex> keyLock(KeyLock(requestedKey));
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    EnsureLocal(requestedKey, context);
+    // the version is checked once, the members after us apply what we decide
+    if (VersionChanged(requestedKey, request->if_version())) return VERSION_CHANGED;
+    std::string successor = CurrentView()->successor;
+    if(!successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        DeleteRequest forward = *request;
+        forward.set_if_version(0);
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->Delete(cc.get(), forward, response);
+        }, true, context->deadline());
+        // a backup without the key ends up where we do
+        if (!status.ok() && status.error_code() != ::grpc::StatusCode::INVALID_ARGUMENT) {
+            return ForwardFailed(status);
+        }
+    }
+    CountWrite(context);
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if (dedup.Seen(request->id())) return ::grpc::Status::OK;
+    KeyWritten(requestedKey, &pending.drops);
+	if(this->keyValueDatabase.find(requestedKey)!=this->keyValueDatabase.end()) {
         this->keyValueDatabase.erase(requestedKey);
-    else {
+        dedup.Admit(request->id());
+        if (request->if_version() != 0) context->AddTrailingMetadata(VERSION_METADATA, "0");
+    } else {
+        auto table = Routing();
+        if (table->Position(requestedKey, &position) && !table->Owns(position)) {
+            HintOwner(context, *table, position);
+        }
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server not responsible for the specified key");
     }
     keyValueDatabase.erase(requestedKey);
     return ::grpc::Status::OK;
 }
 
+/**
+ * Deletes several keys at once, used to purge a user's data. Keys we don't
+ * have are skipped rather than failing the batch, so a batch can be sent
+ * again. A deleted user is taken off the all_users list. Every key must be
+ * ours, otherwise nothing is deleted and the sender routes the batch again.
+ *
+ * @param context - you can ignore this
+ * @param request the keys to remove
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::DeleteBatch(::grpc::ServerContext* context,
+                                          const ::DeleteBatchRequest* request,
+                                          Empty* response) {
+    if (!loaded) return STILL_LOADING;
+    if (!CheckView(context)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the primary of this view");
+    }
+    // held until the write is applied, see keyLocks and forwardMutex
+    auto locked = LockKeys({request->keys().begin(), request->keys().end()});
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    auto table = Routing();
+    for (const auto& key : request->keys()) {
+        uint64_t position;
+        if (table->Position(key, &position) && !table->Owns(position)) {
+            return NotResponsible(context, *table, position);
+        }
+    }
+    for (const auto& key : request->keys()) {
+        EnsureLocal(key, context);
+    }
+    std::string successor = CurrentView()->successor;
+    if(!successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->DeleteBatch(cc.get(), *request, response);
+        }, true, context->deadline());
+        if (!status.ok()) return ForwardFailed(status);
+    }
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    for (const auto& key : request->keys()) {
+        KeyWritten(key, &pending.drops);
+        if (keyValueDatabase.erase(key) == 0) {
+            continue;
+        }
+        if (key.find("post_") != std::string::npos) postUserMap.erase(key);
+        else if (key.find("user_") != std::string::npos && key.find("_posts") == std::string::npos) {
+            RemoveFromUserList(key);
+        }
+    }
+    return ::grpc::Status::OK;
+}
+
 /**
  * This method is called in a separate thread on periodic intervals (see the
  * constructor in shardkv.h for how this is done). It should query the shardmaster
@@ -174,66 +501,808 @@
  * key/value pair from this server's storage. Think about concurrency issues like
  * potential deadlock as you write this function!
  *
+ * This is only the fallback for when the shardmaster cannot be watched, see
+ * WatchShardmaster and ApplyConfig.
+ *
  * @param stub a grpc stub for the shardmaster, which we use to invoke the Query
  * method!
  */
-void ShardkvServer::QueryShardmaster(Shardmaster::Stub* stub) {
+bool ShardkvServer::QueryShardmaster(Shardmaster::Stub* stub) {
     Empty query;
     QueryResponse response;
     ::grpc::ClientContext cc;
-    std::chrono::milliseconds timespan(100);
+    cc.set_deadline(std::chrono::system_clock::now() + QUERY_TIMEOUT);
     auto status = stub->Query(&cc, query, &response);
     if (!status.ok()) {
         std::cerr << "Failed to query shardmaster: " << status.error_message() << std::endl;
-        return;
+        return false;
     }
-    std::map<int, std::string> newKeyServerMap;
-    for (int i = 0; i < response.config_size(); ++i) {
-        std::string serv = response.config(i).server();
-        for (int j = 0; j < response.config(i).shards_size(); ++j) {
-            for (int k = response.config(i).shards(j).lower(); k <= response.config(i).shards(j).upper(); ++k) {
-                newKeyServerMap[k] = serv;
+    ApplyConfig(response);
+    return true;
+}
+
+/**
+ * Follows the shardmaster's Watch stream, which pushes the configuration as
+ * soon as it changes. The stream starts at the version we already have, so a
+ * reconnect only sends something if we missed a change.
+ *
+ * @param stub a grpc stub for the shardmaster, which we use to invoke the Watch
+ * method
+ */
+void ShardkvServer::WatchShardmaster(Shardmaster::Stub* stub) {
+    ::grpc::ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + WATCH_TIMEOUT);
+    WatchRequest request;
+    request.set_from_version(Routing()->Version());
+    auto reader = stub->Watch(&cc, request);
+    QueryResponse response;
+    while (reader->Read(&response)) {
+        ApplyConfig(response);
+    }
+    reader->Finish();
+}
+
+/**
+ * Installs a configuration from the shardmaster. Every key we have stored must
+ * be one this server is responsible for according to it; keys that now belong
+ * to another group are transferred there and then deleted here.
+ *
+ * The transfers themselves are handed to the migration scheduler, one move per
+ * destination group, so this thread goes straight back to watching. The keys
+ * of moves it gave up on are handed to it again.
+ *
+ * In pull mode the roles are swapped: the old owner keeps its keys and the new
+ * owner starts serving the range immediately, pulling keys it misses and
+ * scheduling a back-fill of the rest from each previous owner.
+ *
+ * A configuration no newer than the one installed is ignored.
+ *
+ * @param response the configuration to install
+ */
+void ShardkvServer::ApplyConfig(const QueryResponse& response) {
+    // built before taking the lock, requests only wait for the swap
+    auto table = std::make_shared<const RoutingTable>(response, shardmanager_address);
+    bool pull = options.migrationMode == MigrationMode::PULL;
+    // keys we hold but that now belong to another group, by destination
+    std::map<std::string, std::vector<std::string>> outgoing;
+    // ranges that just became ours, by previous owner
+    std::map<std::string, std::vector<shard_t>> incoming;
+    PendingDrops pending{this};
+    {
+        // waits for the writes in flight, see forwardMutex
+        std::unique_lock<std::shared_mutex> forwarding(forwardMutex);
+        std::lock_guard<std::mutex> lock(serverMutex);
+        auto current = Routing();
+        // a query answered before a watched change may arrive after it, and
+        // must not roll the routing back
+        if (table->Version() <= current->Version()) {
+            return;
+        }
+        // a key that moves away is written by its new owner from now on, which
+        // knows nothing of our copies
+        for (auto it = hotKeys.begin(); it != hotKeys.end();) {
+            uint64_t id;
+            std::string key = (it++)->first;
+            if (!table->Position(key, &id) || !table->Owns(id)) KeyWritten(key, &pending.drops);
+        }
+        if (pull) {
+            // walk the ranges, the key space may be far too large to walk ids
+            for (const auto& shard : table->OwnedShards()) {
+                for (const auto& [piece, old] : current->Owners(shard)) {
+                    if (old == shardmanager_address) continue;
+                    incomingRanges.Assign(piece, old);
+                    incoming[old].push_back(piece);
+                }
+            }
+        } else {
+            for (const auto& [key, value] : keyValueDatabase) {
+                uint64_t id;
+                if (!table->Position(key, &id)) continue;
+                const std::string& serv = table->Owner(id);
+                if (serv.empty() || !current->Owns(id) || table->Owns(id)) {
+                    continue;
+                }
+                outgoing[serv].push_back(key);
+            }
+            // keys of moves given up on are sent again, to whoever owns them now
+            for (const auto& key : migrations->TakeStranded()) {
+                uint64_t id;
+                if (keyValueDatabase.count(key) == 0 || !table->Position(key, &id)) continue;
+                const std::string& serv = table->Owner(id);
+                if (serv.empty() || current->Owns(id) || table->Owns(id)) {
+                    continue;
+                }
+                outgoing[serv].push_back(key);
             }
         }
+        std::atomic_store(&routing, std::shared_ptr<const RoutingTable>(table));
+    }
+    for (auto& [destination, keys] : outgoing) {
+        migrations->Schedule(destination, std::move(keys));
     }
-    for (const auto& [k, serv] : newKeyServerMap) {
-        if (keyServerMap.find(k) != keyServerMap.end() && serv != keyServerMap[k] && keyServerMap[k] == shardmanager_address) {
-            auto serverChannel = grpc::CreateChannel(serv, grpc::InsecureChannelCredentials());
-            auto stub = Shardkv::NewStub(serverChannel);
-            std::vector<std::string> keys = {"user_" + std::to_string(k), "post_" + std::to_string(k), "user_" + std::to_string(k) + "_posts"};
-            for (const auto& key : keys) {
-                if (keyValueDatabase.find(key) != keyValueDatabase.end()) {
-                    for (int i = 0; i < MAX_SERVER_ATTEMPTS; ++i) {
-                        ::grpc::ClientContext cc;
-                        PutRequest req;
-                        Empty res;
-                        req.set_key(key);
-                        req.set_data(keyValueDatabase[key]);
-                        auto stat = stub->Put(&cc, req, &res);
-                        if (stat.ok()) {
-                            keyValueDatabase.erase(key);
-                            if (key.find("post_") != std::string::npos) postUserMap.erase(key);
-                            else if (key.find("user_") != std::string::npos && key.find("_posts") == std::string::npos) {
-                                std::string userListAsString = keyValueDatabase["all_users"];
-                                std::vector<std::string> usersVector = parse_value(userListAsString, ",");
-                                usersVector.erase(find(usersVector.begin(), usersVector.end(), key));
-                                userListAsString = "";
-                                for (auto user : usersVector) {
-                                    userListAsString += user;
-                                    userListAsString += ",";
-                                }
-                                keyValueDatabase["all_users"] = userListAsString;
-                            }
-                            break;
-                        } else {
-                            std::this_thread::sleep_for(timespan);
-                        }
+    // only the primary pulls, the backup gets the keys replicated from it
+    if (CurrentView()->primary != address) {
+        return;
+    }
+    for (auto& [source, ranges] : incoming) {
+        std::vector<std::string> keys;
+        if (!ListKeys(source, ranges, &keys)) {
+            // the ranges stay incoming, so their keys are pulled on first access
+            std::cerr << "Failed to list keys at " << source << std::endl;
+            continue;
+        }
+        std::vector<uint64_t> counts;
+        for (const auto& key : keys) {
+            uint64_t id;
+            counts.push_back(table->Position(key, &id) ? requestCounts[LoadSlot(id)].load() : 0);
+        }
+        std::vector<size_t> order(keys.size());
+        for (size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&counts](size_t a, size_t b) {
+            return counts[a] > counts[b];
+        });
+        std::vector<std::string> hotFirst;
+        for (size_t i : order) {
+            hotFirst.push_back(keys[i]);
+        }
+        migrations->SchedulePull(source, std::move(hotFirst),
+                // a pulled key's size is only known once it arrived, so it is
+                // charged afterwards
+                [this](const std::string& source, const std::string& key,
+                       const MigrationScheduler::ChargeFn& charge, uint64_t* bytes) {
+                    return PullKey(source, key, bytes);
+                },
+                [this, ranges](const MigrationProgress& progress) {
+                    // once a back-fill is done nothing is left at the old owner
+                    if (progress.state != MigrationState::DONE) return;
+                    std::lock_guard<std::mutex> lock(serverMutex);
+                    for (const auto& range : ranges) {
+                        incomingRanges.Remove(range, progress.peer);
                     }
+                });
+    }
+}
+
+bool ShardkvServer::SendAppends(const std::string& group, const std::vector<OutboxEntry>& batch) {
+    AppendBatchRequest request;
+    for (const auto& entry : batch) {
+        auto append = request.add_appends();
+        append->set_key(entry.key);
+        append->set_data(entry.data);
+    }
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(group, grpc::InsecureChannelCredentials()));
+    Empty empty;
+    // the outbox sends the batch again later if this fails
+    auto status = retries.Call(group, [&]() {
+        ::grpc::ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + OUTBOX_TIMEOUT);
+        return stub->AppendBatch(&cc, request, &empty);
+    }, false);
+    if (!status.ok()) {
+        return false;
+    }
+    // if this fails the backup sends the batch again should it take over,
+    // which the group ignores
+    std::string backup = CurrentView()->successor;
+    if (!backup.empty()) {
+        auto backupStub = Shardkv::NewStub(grpc::CreateChannel(backup, grpc::InsecureChannelCredentials()));
+        retries.Call(backup, [&]() {
+            ::grpc::ClientContext backupContext;
+            backupContext.set_deadline(std::chrono::system_clock::now() + OUTBOX_TIMEOUT);
+            return backupStub->TrimOutbox(&backupContext, request, &empty);
+        });
+    }
+    return true;
+}
+
+/**
+ * Called by the migration scheduler for every key of a shard move. The value
+ * is read at transfer time, and if the key's range moved again since the move
+ * was queued it follows the range to its current owner (or stays here if the
+ * range came back to us). The new owner only stores the key if it has no
+ * value for it yet, see PutRequest.if_absent.
+ *
+ * @param destination the group the move was scheduled for
+ * @param key the key to transfer
+ * @param charge called with the size of the key before it is sent, see
+ * MigrationScheduler::TransferFn
+ * @param bytes set to the number of bytes sent
+ * @return false if the destination could not take the key, so the move is retried later
+ */
+bool ShardkvServer::TransferKey(const std::string& destination, const std::string& key,
+                                const MigrationScheduler::ChargeFn& charge, uint64_t* bytes) {
+    std::string value;
+    std::string owner = destination;
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        auto it = keyValueDatabase.find(key);
+        if (it == keyValueDatabase.end()) {
+            // deleted since the move was scheduled, nothing left to send
+            return true;
+        }
+        value = it->second;
+        auto table = Routing();
+        uint64_t id;
+        if (table->Position(key, &id) && !table->Owner(id).empty()) {
+            if (table->Owns(id)) return true;
+            owner = table->Owner(id);
+        }
+    }
+
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(owner, grpc::InsecureChannelCredentials()));
+    PutRequest req;
+    Empty res;
+    req.set_key(key);
+    req.set_data(value);
+    // a retried or stranded move never overwrites what the new owner took since
+    req.set_if_absent(true);
+    // a key that could not be sent was charged all the same, so a group that
+    // keeps failing is not hammered at full speed
+    charge(key.size() + value.size());
+    auto status = retries.Call(owner, [&]() {
+        ::grpc::ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + MIGRATION_TIMEOUT);
+        return stub->Put(&cc, req, &res);
+    });
+    if (!status.ok()) {
+        return false;
+    }
+    *bytes = key.size() + value.size();
+
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    keyValueDatabase.erase(key);
+    KeyWritten(key, &pending.drops);
+    if (key.find("post_") != std::string::npos) postUserMap.erase(key);
+    else if (key.find("user_") != std::string::npos && key.find("_posts") == std::string::npos) {
+        RemoveFromUserList(key);
+    }
+    return true;
+}
+
+/**
+ * Pull mode only. Fetches a key from the group that owned its range before us,
+ * stores it unless the key was written here in the meantime, replicates it to
+ * our backup, and only then drops it at the source. Every step may be
+ * repeated, so a pull that fails part way is simply tried again.
+ *
+ * @param source the group that owned the key's range before us
+ * @param key the key to pull
+ * @param bytes set to the number of bytes received
+ * @return false if the source or our backup could not be reached, so the pull
+ * is retried later
+ */
+bool ShardkvServer::PullKey(const std::string& source, const std::string& key, uint64_t* bytes,
+                            const ::grpc::ServerContext* context) {
+    std::lock_guard<std::mutex> pullLock(pullMutex);
+    uint64_t id;
+    if (!Routing()->Position(key, &id) || !Routing()->Owns(id)) {
+        // the range moved on again, its new owner pulls the key through us
+        return true;
+    }
+
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(source, grpc::InsecureChannelCredentials()));
+    FetchRequest req;
+    DumpResponse res;
+    req.add_keys(key);
+    auto status = retries.Call(source, [&]() {
+        auto cc = CallContext(context, MIGRATION_TIMEOUT);
+        return stub->Fetch(cc.get(), req, &res);
+    });
+    if (!status.ok()) {
+        return false;
+    }
+    auto pulled = res.database().find(key);
+    if (pulled == res.database().end()) {
+        return true;
+    }
+    *bytes = key.size() + pulled->second.size();
+
+    std::string successor;
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        // only users are listed, as Put does
+        if (keyValueDatabase.emplace(key, pulled->second).second &&
+            key.find("post") == std::string::npos && key.rfind("user_", 0) == 0) {
+            keyValueDatabase["all_users"] += (key + ",");
+        }
+        successor = CurrentView()->successor;
+    }
+    // sent even if we had the key already, as a pull that failed below stored
+    // it here before. the backup keeps whatever it has, like we do
+    if (!successor.empty()) {
+        auto backupStub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        PutRequest put;
+        Empty empty;
+        put.set_key(key);
+        put.set_data(pulled->second);
+        put.set_if_absent(true);
+        auto backupStatus = retries.Call(successor, [&]() {
+            auto backupContext = CallContext(context, MIGRATION_TIMEOUT);
+            return backupStub->Put(backupContext.get(), put, &empty);
+        }, true, DeadlineOf(context));
+        if (!backupStatus.ok()) {
+            return false;
+        }
+    }
+
+    // the source is no longer written to, so nothing newer is dropped with it
+    req.set_erase(true);
+    status = retries.Call(source, [&]() {
+        auto cc = CallContext(context, MIGRATION_TIMEOUT);
+        return stub->Fetch(cc.get(), req, &res);
+    });
+    return status.ok();
+}
+
+void ShardkvServer::EnsureLocal(const std::string& key, const ::grpc::ServerContext* context) {
+    auto view = CurrentView();
+    const std::string& primary = view->primary;
+    bool tail = view->tail == address;
+    if (options.migrationMode != MigrationMode::PULL || (primary != address && !tail)) {
+        return;
+    }
+    uint64_t id;
+    if (!Routing()->Position(key, &id)) {
+        return;
+    }
+    std::string source;
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        if (keyValueDatabase.find(key) != keyValueDatabase.end()) {
+            return;
+        }
+        const std::string* from = incomingRanges.Owner(id);
+        if (from == nullptr) {
+            return;
+        }
+        source = *from;
+    }
+    if (primary != address) {
+        // the tail of a chain serving a read: only the head pulls, and its
+        // read passes the key down the chain to us before it returns
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(primary, grpc::InsecureChannelCredentials()));
+        GetRequest request;
+        GetResponse response;
+        request.set_key(key);
+        retries.Call(primary, [&]() {
+            auto cc = CallContext(context);
+            return stub->Get(cc.get(), request, &response);
+        }, true, DeadlineOf(context));
+        return;
+    }
+    uint64_t bytes = 0;
+    if (!PullKey(source, key, &bytes, context)) {
+        std::cerr << "Failed to pull " << key << " from " << source << std::endl;
+    }
+}
+
+void ShardkvServer::EnsureRangeLocal(const shard_t& range, const ::grpc::ServerContext* context) {
+    if (options.migrationMode != MigrationMode::PULL || CurrentView()->primary != address) {
+        return;
+    }
+    // only the parts we still own, a range that moved on is pulled by its new
+    // owner through us key by key
+    std::map<std::string, std::vector<shard_t>> sources;
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        for (const auto& [owned, owner] : Routing()->Owners(range)) {
+            if (owner != shardmanager_address) continue;
+            for (const auto& [piece, source] : incomingRanges.Owners(owned)) {
+                sources[source].push_back(piece);
+            }
+        }
+    }
+    for (const auto& [source, ranges] : sources) {
+        std::vector<std::string> keys;
+        if (!ListKeys(source, ranges, &keys, context)) {
+            std::cerr << "Failed to list keys at " << source << std::endl;
+            continue;
+        }
+        for (const auto& key : keys) {
+            EnsureLocal(key, context);
+        }
+    }
+}
+
+bool ShardkvServer::ListKeys(const std::string& source, const std::vector<shard_t>& ranges,
+                             std::vector<std::string>* keys, const ::grpc::ServerContext* context) {
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(source, grpc::InsecureChannelCredentials()));
+    FetchRequest req;
+    DumpResponse res;
+    for (const auto& range : ranges) {
+        auto list = req.add_list();
+        list->set_lower(range.lower);
+        list->set_upper(range.upper);
+    }
+    auto status = retries.Call(source, [&]() {
+        auto cc = CallContext(context, MIGRATION_TIMEOUT);
+        return stub->Fetch(cc.get(), req, &res);
+    }, true, DeadlineOf(context));
+    if (!status.ok()) {
+        return false;
+    }
+    for (const auto& [key, value] : res.database()) {
+        keys->push_back(key);
+    }
+    return true;
+}
+
+/**
+ * Hands keys over to the group now responsible for them, used by that group to
+ * pull keys on first access and to back-fill its new ranges. Keys we do not
+ * have are left out of the response. If we are still pulling a key ourselves
+ * it is pulled first, so chained moves do not lose data. The keys we hold in
+ * the requested id ranges are listed as well, with empty values.
+ *
+ * @param context - you can ignore this
+ * @param request the keys to hand over, and whether to drop them here
+ * @param response the keys we had, with their values
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::Fetch(::grpc::ServerContext* context,
+                                    const ::FetchRequest* request,
+                                    ::DumpResponse* response) {
+    for (const auto& key : request->keys()) {
+        EnsureLocal(key, context);
+    }
+    for (const auto& range : request->list()) {
+        EnsureRangeLocal({range.lower(), range.upper()}, context);
+    }
+    // held until the write is applied, see forwardMutex
+    std::shared_lock<std::shared_mutex> forwarding(forwardMutex);
+    std::string successor = CurrentView()->successor;
+    if (request->erase() && !successor.empty()) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+        DumpResponse ignored;
+        // dropping keys again is harmless, those already gone are skipped
+        auto status = retries.Call(successor, [&]() {
+            auto cc = CallContext(context);
+            return stub->Fetch(cc.get(), *request, &ignored);
+        }, true, context->deadline());
+        if (!status.ok()) return ForwardFailed(status);
+    }
+    auto dataset = response->mutable_database();
+    PendingDrops pending{this};
+    std::lock_guard<std::mutex> lock(serverMutex);
+    for (const auto& key : request->keys()) {
+        auto it = keyValueDatabase.find(key);
+        if (it == keyValueDatabase.end()) {
+            continue;
+        }
+        dataset->insert({key, it->second});
+        if (!request->erase()) {
+            continue;
+        }
+        keyValueDatabase.erase(it);
+        KeyWritten(key, &pending.drops);
+        if (key.find("post_") != std::string::npos) postUserMap.erase(key);
+        else if (key.find("user_") != std::string::npos && key.find("_posts") == std::string::npos) {
+            RemoveFromUserList(key);
+        }
+    }
+    if (request->list_size() == 0) {
+        return ::grpc::Status::OK;
+    }
+    auto table = Routing();
+    for (const auto& [key, value] : keyValueDatabase) {
+        uint64_t id;
+        if (!table->Position(key, &id)) continue;
+        for (const auto& range : request->list()) {
+            if (range.lower() <= id && id <= range.upper()) {
+                dataset->insert({key, ""});
+                break;
+            }
+        }
+    }
+    return ::grpc::Status::OK;
+}
+
+void ShardkvServer::CountRequest(uint64_t position) {
+    requestCounts[LoadSlot(position)].fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t ShardkvServer::LoadSlot(uint64_t id) const {
+    uint64_t maxKey = Routing()->MaxKey();
+    if (id > maxKey) {
+        return LOAD_SLOTS - 1;
+    }
+    // (id - MIN_KEY) * LOAD_SLOTS needs more than 64 bits for large key spaces
+    unsigned __int128 span = static_cast<unsigned __int128>(maxKey - MIN_KEY) + 1;
+    return static_cast<size_t>(static_cast<unsigned __int128>(id - MIN_KEY) * LOAD_SLOTS / span);
+}
+
+/**
+ * This method is called in a separate thread on periodic intervals (see the
+ * constructor in shardkv.h for how this is done). It reports how many requests
+ * we served for each part of our shards since the last report, cutting every
+ * shard into up to LOAD_BUCKETS ranges so the shardmaster can tell where in a
+ * shard the load is. Counters are per LoadSlot, so in key spaces larger than
+ * LOAD_SLOTS the figures of neighbouring ranges are approximate. The bytes we hold and the CPU we used since the last
+ * report go along, for placing load on the least busy groups.
+ *
+ * @param stub a grpc stub for the shardmaster, which we use to invoke the
+ * ReportLoad method
+ * @return false if the shardmaster could not be reached or could not take
+ * the report for now, so another replica should be tried
+ */
+bool ShardkvServer::ReportLoad(Shardmaster::Stub* stub) {
+    // take every counter, requests for keys we do not own are dropped
+    std::vector<uint64_t> counts(requestCounts.size());
+    for (size_t i = 0; i < requestCounts.size(); i++) {
+        counts[i] = requestCounts[i].exchange(0, std::memory_order_relaxed);
+    }
+    // CPU time is sampled on every call so a new primary reports a fresh figure
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpuSeconds = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    auto now = std::chrono::steady_clock::now();
+    double wallSeconds = std::chrono::duration<double>(now - lastLoadReport).count();
+    uint32_t cpuPercent = wallSeconds > 0 ? static_cast<uint32_t>(100 * (cpuSeconds - lastCpuSeconds) / wallSeconds) : 0;
+    lastCpuSeconds = cpuSeconds;
+    lastLoadReport = now;
+    UpdateHotKeys();
+    if (CurrentView()->primary != address) {
+        return true;
+    }
+    LoadReport report;
+    report.set_server(shardmanager_address);
+    report.set_cpu_percent(cpuPercent);
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        uint64_t bytes = 0;
+        for (const auto& [key, value] : keyValueDatabase) {
+            bytes += key.size() + value.size();
+        }
+        report.set_bytes(bytes);
+    }
+    // a counter shared by neighbouring ranges is only reported for the first
+    size_t nextSlot = 0;
+    for (const auto& shard : Routing()->OwnedShards()) {
+        uint64_t width = size(shard) / LOAD_BUCKETS + (size(shard) % LOAD_BUCKETS != 0);
+        for (uint64_t lower = shard.lower; ; lower += width) {
+            uint64_t upper = shard.upper - lower < width ? shard.upper : lower + width - 1;
+            uint64_t requests = 0;
+            size_t lastSlot = LoadSlot(upper);
+            for (size_t slot = std::max(LoadSlot(lower), nextSlot); slot <= lastSlot; slot++) {
+                requests += counts[slot];
+            }
+            nextSlot = std::max(nextSlot, lastSlot + 1);
+            auto range = report.add_ranges();
+            range->mutable_shard()->set_lower(lower);
+            range->mutable_shard()->set_upper(upper);
+            range->set_requests(requests);
+            if (upper == shard.upper) break;
+        }
+    }
+    if (report.ranges_size() == 0) {
+        return true;
+    }
+    ::grpc::ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + QUERY_TIMEOUT);
+    Empty response;
+    auto status = stub->ReportLoad(&cc, report, &response);
+    if (!status.ok()) {
+        std::cerr << "Failed to report load: " << status.error_message() << std::endl;
+    }
+    return !RetryPolicy::Retryable(status);
+}
+
+/**
+ * Called on a group chosen to hold a read-only copy of another group's hot
+ * key. The copy is served by Get until it expires, is dropped, or is replaced
+ * by a newer one; a copy older than what we already have is ignored.
+ *
+ * @param context - you can ignore this
+ * @param request the key, its value, its version and how long it may be served
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::PutCopy(::grpc::ServerContext* context,
+                                      const ::CopyRequest* request,
+                                      Empty* response) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    auto& copy = copies[request->key()];
+    if (request->version() <= copy.version) {
+        return ::grpc::Status::OK;
+    }
+    copy.data = request->data();
+    copy.version = request->version();
+    copy.valid = true;
+    copy.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(request->ttl_ms());
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Called by the owner of a hot key we hold a copy of once the key is written,
+ * or once it is no longer hot. The copy stops being served right away.
+ *
+ * @param context - you can ignore this
+ * @param request the key and the version of the drop
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::DropCopy(::grpc::ServerContext* context,
+                                       const ::CopyRequest* request,
+                                       Empty* response) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    auto& copy = copies[request->key()];
+    if (request->version() <= copy.version) {
+        return ::grpc::Status::OK;
+    }
+    copy.data.clear();
+    copy.version = request->version();
+    copy.valid = false;
+    copy.expires = std::chrono::steady_clock::now() + COPY_TTL;
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Called with every load report. A single key read more than a group can
+ * serve gains nothing from shard splits, so every key of ours read more than
+ * HOT_KEY_THRESH times per second is copied to hotKeyCopies other groups and
+ * its readers told where the copies are. The copies are renewed with every
+ * report while the key stays hot, dropped once it cools down, and dropped by
+ * every write before the write returns. A copy a drop could not reach expires
+ * after COPY_TTL at the latest, as do the copies of a primary that failed.
+ */
+void ShardkvServer::UpdateHotKeys() {
+    auto reads = hotKeyReads.Take();
+    auto now = std::chrono::steady_clock::now();
+    CopyRequests puts;
+    PendingDrops pending{this};
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        for (auto it = copies.begin(); it != copies.end();) {
+            it = it->second.expires <= now ? copies.erase(it) : std::next(it);
+        }
+        if (options.hotKeyCopies == 0 || CurrentView()->primary != address) {
+            return;
+        }
+        auto table = Routing();
+        double seconds = std::chrono::duration<double>(LOAD_REPORT_INTERVAL).count();
+        std::set<std::string> hot;
+        for (const auto& [key, count] : reads) {
+            if (count <= HOT_KEY_THRESH * seconds) break;
+            uint64_t id;
+            auto value = keyValueDatabase.find(key);
+            if (value == keyValueDatabase.end() || !table->Position(key, &id) || !table->Owns(id)) continue;
+            auto groups = CopyGroups(key, *table);
+            if (groups.empty()) continue;
+            hot.insert(key);
+            CopyRequest copy;
+            copy.set_key(key);
+            copy.set_data(value->second);
+            copy.set_version(NextCopyVersion());
+            copy.set_ttl_ms(COPY_TTL.count());
+            for (const auto& group : groups) {
+                puts.push_back({group, copy});
+            }
+            // groups no longer picked, e.g. because they left, drop theirs
+            auto& entry = hotKeys[key];
+            CopyRequest drop;
+            drop.set_key(key);
+            drop.set_version(copy.version());
+            for (const auto& group : entry.groups) {
+                if (std::find(groups.begin(), groups.end(), group) == groups.end()) {
+                    pending.drops.push_back({group, drop});
                 }
             }
+            entry.version = copy.version();
+            entry.groups = std::move(groups);
+        }
+        for (auto it = hotKeys.begin(); it != hotKeys.end();) {
+            std::string key = (it++)->first;
+            if (!hot.count(key)) KeyWritten(key, &pending.drops);
+        }
+    }
+    // a write racing with these drops them again with a newer version
+    SendCopies(&Shardkv::Stub::PutCopy, puts);
+}
+
+std::vector<std::string> ShardkvServer::CopyGroups(const std::string& key, const RoutingTable& table) const {
+    std::vector<std::string> groups = table.Groups();
+    groups.erase(std::remove(groups.begin(), groups.end(), shardmanager_address), groups.end());
+    if (groups.empty()) {
+        return groups;
+    }
+    size_t count = std::min(options.hotKeyCopies, groups.size());
+    size_t first = xxHash64(key.data(), key.size()) % groups.size();
+    std::vector<std::string> picked;
+    for (size_t i = 0; i < count; i++) {
+        picked.push_back(groups[(first + i) % groups.size()]);
+    }
+    return picked;
+}
+
+void ShardkvServer::KeyWritten(const std::string& key, CopyRequests* drops) {
+    auto it = hotKeys.find(key);
+    if (it == hotKeys.end()) {
+        return;
+    }
+    CopyRequest drop;
+    drop.set_key(key);
+    drop.set_version(NextCopyVersion());
+    for (const auto& group : it->second.groups) {
+        drops->push_back({group, drop});
+    }
+    hotKeys.erase(it);
+}
+
+uint64_t ShardkvServer::NextCopyVersion() {
+    uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    lastCopyVersion = std::max(lastCopyVersion + 1, micros);
+    return lastCopyVersion;
+}
+
+void ShardkvServer::SendCopies(::grpc::Status (Shardkv::Stub::*rpc)(::grpc::ClientContext*, const CopyRequest&, Empty*),
+                               const CopyRequests& requests) {
+    for (const auto& [group, request] : requests) {
+        auto stub = Shardkv::NewStub(grpc::CreateChannel(group, grpc::InsecureChannelCredentials()));
+        Empty empty;
+        auto status = retries.Call(group, [&]() {
+            ::grpc::ClientContext cc;
+            cc.set_deadline(std::chrono::system_clock::now() + COPY_TIMEOUT);
+            return (stub.get()->*rpc)(&cc, request, &empty);
+        });
+        if (!status.ok()) {
+            std::cerr << "Failed to update the copy of " << request.key() << " at " << group << ": "
+                      << status.error_message() << std::endl;
+        }
+    }
+}
+
+void ShardkvServer::RemoveFromUserList(const std::string& user) {
+    std::vector<std::string> usersVector = parse_value(keyValueDatabase["all_users"], ",");
+    std::string userListAsString;
+    for (const auto& u : usersVector) {
+        if (u == user) continue;
+        userListAsString += u;
+        userListAsString += ",";
+    }
+    keyValueDatabase["all_users"] = userListAsString;
+}
+
+/**
+ * Reports the progress of the shard moves started by this server, both the
+ * ones sending keys away and the back-fills pulling keys in.
+ *
+ * @param context - you can ignore this
+ * @param request the id of a move, or 0 for all of them
+ * @param response the status of the requested move(s)
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvServer::MigrationStatus(::grpc::ServerContext* context,
+                                              const ::MigrationStatusRequest* request,
+                                              ::MigrationStatusResponse* response) {
+    std::vector<MigrationProgress> moves;
+    if (request->id() == 0) {
+        moves = migrations->AllStatus();
+    } else {
+        auto progress = migrations->Status(request->id());
+        if (!progress.has_value()) {
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Unknown migration");
         }
+        moves.push_back(progress.value());
+    }
+    for (const auto& move : moves) {
+        auto status = response->add_moves();
+        status->set_id(move.id);
+        status->set_peer(move.peer);
+        status->set_incoming(move.incoming);
+        status->set_state(static_cast<MoveStatus::State>(move.state));
+        status->set_keys_total(move.keysTotal);
+        status->set_keys_moved(move.keysMoved);
+        status->set_bytes_moved(move.bytesMoved);
+        status->set_attempts(move.attempts);
     }
-    keyServerMap = std::move(newKeyServerMap);
+    return ::grpc::Status::OK;
 }
 
 
@@ -253,27 +1322,245 @@ void ShardkvServer::QueryShardmaster(Shardmaster::Stub* stub) {
 void ShardkvServer::PingShardmanager(Shardkv::Stub* stub) {
     PingRequest request;
     request.set_server(address);
-    request.set_viewnumber(currentAcknowledgedViewNumber);
+    request.set_viewnumber(CurrentView()->number);
+    request.set_loaded(loaded);
     grpc::ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + PING_TIMEOUT);
     PingResponse response;
     auto status = stub->Ping(&cc, request, &response);
-    currentAcknowledgedViewNumber = response.id();
-    backupServerAddress = response.backup();
-    primaryServerAddress = response.primary();
-    if(status.ok()) {
-        if(shardmaster_address.empty()) {
-            shardmaster_address = response.shardmaster();
-            if(primaryServerAddress != address) {
-                auto channel = grpc::CreateChannel(primaryServerAddress, grpc::InsecureChannelCredentials());
-                auto stub = Shardkv::NewStub(channel);
-                grpc::ClientContext cc;
-                DumpResponse dump_response;
-                stub->Dump(&cc, Empty(), &dump_response);
-                for(auto& kv : dump_response.database()) keyValueDatabase.insert({kv.first, kv.second});
-            }
+    // an unanswered ping leaves the view we know of as it is
+    if(!status.ok()) {
+        return;
+    }
+    // writes are passed on from the primary to the backup, or down a chain
+    // from every member to the one after it. strong reads are served by the
+    // primary, or by the tail of a chain
+    auto view = std::make_shared<View>();
+    view->number = response.id();
+    view->primary = response.primary();
+    view->backup = response.backup();
+    view->successor = view->primary == address ? view->backup : "";
+    view->tail = view->primary;
+    std::string predecessor = view->primary;
+    const auto& chain = response.chain();
+    auto self = std::find(chain.begin(), chain.end(), address);
+    if (self != chain.end()) {
+        view->successor = std::next(self) == chain.end() ? "" : *std::next(self);
+        view->tail = chain[chain.size() - 1];
+        predecessor = self == chain.begin() ? address : *std::prev(self);
+    }
+    std::atomic_store(&this->view, std::shared_ptr<const View>(view));
+    if(shardmasters.Empty()) {
+        std::vector<std::string> replicas(response.shardmasters().begin(), response.shardmasters().end());
+        if(replicas.empty()) replicas.push_back(response.shardmaster());
+        shardmasters.Set(replicas);
+    }
+    // a new member starts from the keys of the one before it, asked for
+    // again with every ping until it has them. the first member starts
+    // the group, our manager makes no other member primary before it
+    // loaded
+    if(!loaded && predecessor == address) {
+        loaded = true;
+    } else if(!loaded) {
+        auto channel = grpc::CreateChannel(predecessor, grpc::InsecureChannelCredentials());
+        auto stub = Shardkv::NewStub(channel);
+        DumpRequest dump_request;
+        dump_request.set_successor(address);
+        DumpResponse dump_response;
+        auto dumped = retries.Call(predecessor, [&]() {
+            grpc::ClientContext cc;
+            cc.set_deadline(std::chrono::system_clock::now() + DUMP_TIMEOUT);
+            return stub->Dump(&cc, dump_request, &dump_response);
+        });
+        if(dumped.ok()) {
+            std::lock_guard<std::mutex> lock(serverMutex);
+            for(auto& kv : dump_response.database()) keyValueDatabase.insert({kv.first, kv.second});
+            dedup.Load(dump_response);
+            loaded = true;
+        }
+    }
+}
+
+/**
+ * Tells callers which view we know of, see ShardkvManager::GetView.
+ *
+ * @param context - you can ignore this
+ * @param request An empty message
+ * @param response our view number, primary and backup
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status ShardkvServer::GetView(::grpc::ServerContext* context,
+                                      const Empty* request,
+                                      ::ViewResponse* response) {
+    auto view = CurrentView();
+    response->set_view(view->number);
+    response->set_primary(view->primary);
+    response->set_backup(view->backup);
+    return ::grpc::Status::OK;
+}
+
+void ShardkvServer::HintOwner(::grpc::ServerContext* context, const RoutingTable& table, uint64_t position) {
+    const std::string& owner = table.Owner(position);
+    if (owner.empty()) return;
+    shard_t shard = table.ShardOf(position);
+    context->AddTrailingMetadata(OWNER_METADATA, owner);
+    context->AddTrailingMetadata(OWNER_SHARD_METADATA, std::to_string(shard.lower) + "-" + std::to_string(shard.upper));
+    context->AddTrailingMetadata(CONFIG_VERSION_METADATA, std::to_string(table.Version()));
+}
+
+uint64_t ShardkvServer::ValueVersion(const std::string& value) {
+    uint64_t version = xxHash64(value.data(), value.size());
+    return version == 0 ? 1 : version;
+}
+
+std::vector<std::unique_lock<std::mutex>> ShardkvServer::LockKeys(const std::vector<std::string>& keys) {
+    std::vector<std::mutex*> mutexes;
+    for (const auto& key : keys) {
+        mutexes.push_back(&KeyLock(key));
+    }
+    // keys may share a lock, which is taken once
+    std::sort(mutexes.begin(), mutexes.end());
+    mutexes.erase(std::unique(mutexes.begin(), mutexes.end()), mutexes.end());
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto* mutex : mutexes) {
+        locks.emplace_back(*mutex);
+    }
+    return locks;
+}
+
+bool ShardkvServer::Stored(const std::string& key) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    return keyValueDatabase.count(key) > 0;
+}
+
+bool ShardkvServer::VersionChanged(const std::string& key, uint64_t ifVersion) {
+    if (ifVersion == 0) return false;
+    std::lock_guard<std::mutex> lock(serverMutex);
+    auto it = keyValueDatabase.find(key);
+    return (it == keyValueDatabase.end() ? 0 : ValueVersion(it->second)) != ifVersion;
+}
+
+void ShardkvServer::AnswerRead(const std::string& value, const GetRequest& request, GetResponse* response) {
+    uint64_t version = ValueVersion(value);
+    response->set_version(version);
+    if (request.known_version() == version) {
+        response->set_not_modified(true);
+    } else {
+        response->set_data(value);
+    }
+}
+
+bool ShardkvServer::Applied(const RequestId& id) {
+    if (id.client_id() == 0) return false;
+    std::lock_guard<std::mutex> lock(serverMutex);
+    return dedup.Seen(id);
+}
+
+::grpc::Status ShardkvServer::NotResponsible(::grpc::ServerContext* context, const RoutingTable& table,
+                                             uint64_t position) {
+    HintOwner(context, table, position);
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server not responsible for the specified key");
+}
+
+bool ShardkvServer::CheckView(::grpc::ServerContext* context, bool read) {
+    const auto& metadata = context->client_metadata();
+    auto view = metadata.find(VIEW_METADATA);
+    if (view == metadata.end()) {
+        return true;
+    }
+    auto current = CurrentView();
+    std::string ours = std::to_string(current->number);
+    std::string serving = read ? current->tail : current->primary;
+    if (serving == address && view->second == ours) {
+        return true;
+    }
+    context->AddTrailingMetadata(VIEW_METADATA, ours);
+    context->AddTrailingMetadata(PRIMARY_METADATA, serving);
+    return false;
+}
+
+::grpc::Status ShardkvServer::FollowerGet(const ::GetRequest& request, ::GetResponse* response) {
+    auto table = Routing();
+    uint64_t position;
+    if (!table->Position(request.key(), &position) || !table->Owns(position)) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Backup not responsible for the specified key");
+    }
+    std::lock_guard<std::mutex> lock(serverMutex);
+    bool fresh = request.consistency() == GetRequest::BOUNDED
+            ? std::chrono::steady_clock::now() - syncedAt < std::chrono::milliseconds(request.max_staleness_ms())
+            : syncedSeq >= request.min_seq();
+    // a range we are still pulling is only complete at the primary
+    if (CurrentView()->primary == address || !fresh || incomingRanges.Owner(position) != nullptr) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Backup too far behind");
+    }
+    auto it = keyValueDatabase.find(request.key());
+    if (it == keyValueDatabase.end()) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Specified key not found in the database");
+    }
+    AnswerRead(it->second, request, response);
+    return ::grpc::Status::OK;
+}
+
+void ShardkvServer::CountWrite(::grpc::ServerContext* context) {
+    if (CurrentView()->primary != address) {
+        return;
+    }
+    context->AddTrailingMetadata(SEQ_METADATA, std::to_string(++writeSeq));
+}
+
+void ShardkvServer::SyncBackup() {
+    if (CurrentView()->primary != address) {
+        return;
+    }
+    SyncStateRequest request;
+    request.set_primary(address);
+    // every write counted so far has reached the backup, it is replicated first
+    request.set_seq(writeSeq);
+    PassSync(request, std::chrono::system_clock::now() + SYNC_TIMEOUT);
+}
+
+void ShardkvServer::PassSync(const SyncStateRequest& request, std::chrono::system_clock::time_point deadline) {
+    std::string successor = CurrentView()->successor;
+    if (successor.empty()) {
+        return;
+    }
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(successor, grpc::InsecureChannelCredentials()));
+    ::grpc::ClientContext cc;
+    cc.set_deadline(deadline);
+    Empty response;
+    stub->SyncState(&cc, request, &response);
+}
+
+/**
+ * Called by our primary with every ping of its manager, or passed down a
+ * chain by the member before us. Every write it counted so far was replicated
+ * to us before it was counted, so we are in sync with the primary up to seq,
+ * and may serve reads that allow some staleness.
+ *
+ * @param context - you can ignore this
+ * @param request our primary, and its count of writes
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK, or FAILED_PRECONDITION if we are not the
+ * sender's backup or don't have its keys yet
+ */
+::grpc::Status ShardkvServer::SyncState(::grpc::ServerContext* context,
+                                        const ::SyncStateRequest* request,
+                                        Empty* response) {
+    auto view = CurrentView();
+    if (!loaded || request->primary() != view->primary || view->primary == address) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not the sender's backup");
+    }
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        syncedSeq = std::max(syncedSeq, request->seq());
+        syncedAt = std::chrono::steady_clock::now();
+        // so our count goes on from the primary's if we take over
+        uint64_t seq = writeSeq;
+        while (seq < request->seq() && !writeSeq.compare_exchange_weak(seq, request->seq())) {
         }
     }
-    return;
+    PassSync(*request, context->deadline());
+    return ::grpc::Status::OK;
 }
 
 /**
@@ -281,18 +1568,26 @@ void ShardkvServer::PingShardmanager(Shardkv::Stub* stub) {
  *
  * This method is called by a backup server when it joins the system for the firt time or after it crashed and restarted.
  * It allows the server to receive a snapshot of all key-value pairs stored by the primary server.
+ * It is only taken once we pass writes on to the caller, and after every
+ * write that was not passed on to it is applied, so the caller misses none.
  *
  * @param context - you can ignore this
- * @param request An empty message
+ * @param request the member asking, which must be our successor
  * @param response the whole database
- * @return ::grpc::Status::OK on success, or
- * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
- * here>")
+ * @return ::grpc::Status::OK on success, or FAILED_PRECONDITION while we are
+ * still loading our own keys or don't pass writes on to the caller yet
  */
-::grpc::Status ShardkvServer::Dump(::grpc::ServerContext* context, const Empty* request, ::DumpResponse* response) {
+::grpc::Status ShardkvServer::Dump(::grpc::ServerContext* context, const DumpRequest* request, ::DumpResponse* response) {
+    if (!loaded) return STILL_LOADING;
+    std::unique_lock<std::shared_mutex> forwarding(forwardMutex);
+    if (CurrentView()->successor != request->successor()) {
+        return ::grpc::Status(::grpc::StatusCode::FAILED_PRECONDITION, "Not passing writes on to the caller yet");
+    }
     auto dataset = response->mutable_database();
+    std::lock_guard<std::mutex> lock(serverMutex);
     for(const auto& kv : keyValueDatabase) {
         dataset->insert({kv.first, kv.second});
     }
+    dedup.Save(response);
     return ::grpc::Status::OK;
 }
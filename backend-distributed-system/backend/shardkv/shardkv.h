@@ -4,34 +4,106 @@
 #include <grpcpp/grpcpp.h>
 #include <thread>
 #include "../common/common.h"
+#include <array>
 #include <unordered_map>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <iostream>
 #include <fstream>
 
 #include "../build/shardkv.grpc.pb.h"
 #include "../build/shardmaster.grpc.pb.h"
+#include "../common/interval_map.h"
+#include "../common/retry.h"
+#include "../common/rpc.h"
+#include "dedup_table.h"
+#include "hot_keys.h"
+#include "migration_scheduler.h"
+#include "outbox.h"
+#include "routing_table.h"
+
+// how keys follow their range when it is handed to another group. every group
+// of a deployment must use the same mode
+enum class MigrationMode {
+  // the old owner pushes the keys once it sees the new configuration
+  PUSH,
+  // the new owner serves the range right away, pulling keys from the old owner
+  // on first access and back-filling the rest in the background
+  PULL
+};
+
+// tunables of a key-value server, see shardkv/main.cc for the matching flags
+struct ShardkvOptions {
+  // number of shard moves to different groups that may run at the same time
+  size_t migrationConcurrency = 4;
+  // bandwidth shared by all shard moves in bytes per second, 0 for no limit
+  uint64_t migrationBandwidth = 0;
+  MigrationMode migrationMode = MigrationMode::PUSH;
+  // number of other groups given a read-only copy of each of our hot keys, 0
+  // to never copy keys
+  size_t hotKeyCopies = 2;
+};
 
 class ShardkvServer : public Shardkv::Service {
   using Empty = google::protobuf::Empty;
 
  public:
-  explicit ShardkvServer(std::string addr, const std::string& shardmanager_addr)
-      : address(std::move(addr)), shardmanager_address(shardmanager_addr) {
+  explicit ShardkvServer(std::string addr, const std::string& shardmanager_addr,
+                         const ShardkvOptions& opts = ShardkvOptions())
+      : address(std::move(addr)), shardmanager_address(shardmanager_addr), options(opts),
+        requestCounts(LOAD_SLOTS), hotKeyReads(HOT_KEY_CAPACITY) {
 
-    // This thread will query the shardmaster every 100 milliseconds for updates
+    // moves of keys we are no longer responsible for run in the background so
+    // a slow or unreachable group never stalls the query thread
+    migrations = std::make_unique<MigrationScheduler>(
+            options.migrationConcurrency, options.migrationBandwidth,
+            [this](const std::string& destination, const std::string& key,
+                   const MigrationScheduler::ChargeFn& charge, uint64_t* bytes) {
+                return TransferKey(destination, key, charge, bytes);
+            });
+
+    // updates of other groups' keys implied by our writes, e.g. post lists,
+    // are sent in the background so a write never waits on another group.
+    // only the primary sends, the backup keeps its copy in case it takes over
+    outbox = std::make_unique<Outbox>(
+            [this](const std::string& key) -> std::string {
+                uint64_t id;
+                auto table = Routing();
+                if (CurrentView()->primary != address || !table->Position(key, &id)) return "";
+                return table->Owner(id);
+            },
+            [this](const std::string& group, const std::vector<OutboxEntry>& batch) {
+                return SendAppends(group, batch);
+            });
+
+    // This thread follows the shardmaster's configuration changes, falling
+    // back to querying it every 100 milliseconds while it cannot be watched.
+    // a replica of a replicated shardmaster that cannot be queried either is
+    // given up on for the next one. while none can be reached, we wait longer
+    // and longer, at random so the servers don't all come back at once
     std::thread query(
             [this]() {
                 // TODO: Assignment 2 Implement the QueryShardmaster(...) function
                 std::chrono::milliseconds timespan(100);
-                while (shardmaster_address.empty() && (this->primaryServerAddress != this->address)) {
+                while (shardmasters.Empty()) {
                     std::this_thread::sleep_for(timespan);
                 }
-                auto stub = Shardmaster::NewStub(
-                        grpc::CreateChannel(shardmaster_address, grpc::InsecureChannelCredentials()));
+                std::string target;
+                std::unique_ptr<Shardmaster::Stub> stub;
+                int failures = 0;
                 while (true) {
-                    this->QueryShardmaster(stub.get());
-                    std::this_thread::sleep_for(timespan);
+                    if (target != shardmasters.Current()) {
+                        target = shardmasters.Current();
+                        stub = Shardmaster::NewStub(grpc::CreateChannel(target, grpc::InsecureChannelCredentials()));
+                    }
+                    this->WatchShardmaster(stub.get());
+                    bool queried = this->QueryShardmaster(stub.get());
+                    if (!queried) shardmasters.Failed(target);
+                    failures = queried ? 0 : failures + 1;
+                    std::this_thread::sleep_for(failures == 0 ? timespan
+                                                              : timespan + JitteredBackoff(failures, timespan, MAX_QUERY_BACKOFF));
                 }
             }
             );
@@ -48,12 +120,35 @@ class ShardkvServer : public Shardkv::Service {
                     grpc::CreateChannel(sm_addr, grpc::InsecureChannelCredentials()));
             while (true) {
                 PingShardmanager(stub.get());
+                SyncBackup();
                 std::this_thread::sleep_for(timespan);
             }
         },
         shardmanager_addr);
     // we detach the thread so we don't have to wait for it to terminate later
     heartbeat.detach();
+
+    // This thread tells the shardmaster how busy our keys are, so it can split
+    // hot shards and merge cold ones
+    std::thread load(
+            [this]() {
+                std::chrono::milliseconds timespan(100);
+                while (shardmasters.Empty()) {
+                    std::this_thread::sleep_for(timespan);
+                }
+                std::string target;
+                std::unique_ptr<Shardmaster::Stub> stub;
+                while (true) {
+                    std::this_thread::sleep_for(LOAD_REPORT_INTERVAL);
+                    if (target != shardmasters.Current()) {
+                        target = shardmasters.Current();
+                        stub = Shardmaster::NewStub(grpc::CreateChannel(target, grpc::InsecureChannelCredentials()));
+                    }
+                    if (!this->ReportLoad(stub.get())) shardmasters.Failed(target);
+                }
+            });
+    // we detach the thread so we don't have to wait for it to terminate later
+    load.detach();
   };
 
   // TODO implement these three methods, should be fairly similar to your simple_shardkv
@@ -68,43 +163,336 @@ class ShardkvServer : public Shardkv::Service {
   ::grpc::Status Delete(::grpc::ServerContext* context,
                         const ::DeleteRequest* request,
                         Empty* response) override;
+  ::grpc::Status DeleteBatch(::grpc::ServerContext* context,
+                             const ::DeleteBatchRequest* request,
+                             Empty* response) override;
+  ::grpc::Status GetView(::grpc::ServerContext* context,
+                         const Empty* request,
+                         ::ViewResponse* response) override;
+  ::grpc::Status SyncState(::grpc::ServerContext* context,
+                           const ::SyncStateRequest* request,
+                           Empty* response) override;
     ::grpc::Status Dump(::grpc::ServerContext* context,
-                        const ::google::protobuf::Empty* request,
-                        ::DumpResponse* response);
+                        const ::DumpRequest* request,
+                        ::DumpResponse* response) override;
+  ::grpc::Status MigrationStatus(::grpc::ServerContext* context,
+                                 const ::MigrationStatusRequest* request,
+                                 ::MigrationStatusResponse* response) override;
+  ::grpc::Status Fetch(::grpc::ServerContext* context,
+                       const ::FetchRequest* request,
+                       ::DumpResponse* response) override;
+  ::grpc::Status AppendBatch(::grpc::ServerContext* context,
+                             const ::AppendBatchRequest* request,
+                             Empty* response) override;
+  ::grpc::Status TrimOutbox(::grpc::ServerContext* context,
+                            const ::AppendBatchRequest* request,
+                            Empty* response) override;
+  ::grpc::Status PutCopy(::grpc::ServerContext* context,
+                         const ::CopyRequest* request,
+                         Empty* response) override;
+  ::grpc::Status DropCopy(::grpc::ServerContext* context,
+                          const ::CopyRequest* request,
+                          Empty* response) override;
 
   // TODO this will be called in a separate thread, here is where you want to
   // query the shardmaster for configuration updates and respond to changes
-  // appropriately (i.e. transferring keys, no longer serving keys, etc.)
-  void QueryShardmaster(Shardmaster::Stub* stub);
+  // appropriately (i.e. transferring keys, no longer serving keys, etc.).
+  // returns false if the shardmaster could not be reached
+  bool QueryShardmaster(Shardmaster::Stub* stub);
+
+  // follows the shardmaster's Watch stream, applying every configuration it
+  // pushes. returns once the stream breaks or WATCH_TIMEOUT passes
+  void WatchShardmaster(Shardmaster::Stub* stub);
+
+  // sends the shardmaster the number of requests per range of our keys since
+  // the last report. only the primary reports. returns false if the
+  // shardmaster could not take the report, but another replica might
+  bool ReportLoad(Shardmaster::Stub* stub);
 
   // TODO this will be called in a separate thread, here is where you want to
   // ping the shardmanager to get updates about the sharmaster (part 2) and the views changes (part 3)
   void PingShardmanager(Shardkv::Stub* stub);
 
-  // Maximum number of server contact attempts
-  int32_t MAX_SERVER_ATTEMPTS = 1000;
+  // Longest a single watch stream is kept open, so a shardmaster that died
+  // without closing it is noticed
+  static constexpr std::chrono::seconds WATCH_TIMEOUT{30};
+
+  // How often load is reported, HOT_THRESH and COLD_THRESH are per second
+  static constexpr std::chrono::seconds LOAD_REPORT_INTERVAL{1};
+  // Number of ranges each of our shards is cut into for load reports, which
+  // are the points the shardmaster can split it at
+  static constexpr unsigned int LOAD_BUCKETS = 16;
+  // Number of request counters, each covering an equal part of the key space.
+  // Key spaces up to this size get a counter per id
+  static constexpr size_t LOAD_SLOTS = 4096;
+
+  // Number of keys the hot key tracker keeps, see HotKeyTracker
+  static constexpr size_t HOT_KEY_CAPACITY = 64;
+  // Number of clients whose writes we remember, see DedupTable
+  static constexpr size_t DEDUP_CLIENTS = 4096;
+  // Number of locks the keys are spread over, see keyLocks
+  static constexpr size_t KEY_LOCKS = 256;
+  // How long a copy of a hot key is served without being renewed. Copies are
+  // renewed with every load report while the key stays hot
+  static constexpr std::chrono::milliseconds COPY_TTL{3 * LOAD_REPORT_INTERVAL};
+  // Longest we wait on a group when placing or dropping a copy
+  static constexpr std::chrono::milliseconds COPY_TIMEOUT{500};
+  // Longest we wait on a group taking a batch of our outbox
+  static constexpr std::chrono::milliseconds OUTBOX_TIMEOUT{1000};
+  // Longest we wait on our backup taking a SyncState
+  static constexpr std::chrono::milliseconds SYNC_TIMEOUT{100};
+  // Longest we wait on our manager answering a ping. a server that misses
+  // pings for a while is taken for dead, so there is no point waiting longer
+  static constexpr std::chrono::milliseconds PING_TIMEOUT{500};
+  // Longest we wait on the shardmaster answering a query or taking a load
+  // report
+  static constexpr std::chrono::milliseconds QUERY_TIMEOUT{1000};
+  // Longest we wait on another group during a shard move made in the
+  // background
+  static constexpr std::chrono::milliseconds MIGRATION_TIMEOUT{5000};
+  // Longest we wait for the keys of the member we start from when we join
+  // our group
+  static constexpr std::chrono::seconds DUMP_TIMEOUT{30};
+  // Longest we wait between queries while the shardmaster cannot be reached
+  static constexpr std::chrono::milliseconds MAX_QUERY_BACKOFF{5000};
 
  private:
+  // copies of a hot key sent to other groups, or drops of them, by group
+  using CopyRequests = std::vector<std::pair<std::string, CopyRequest>>;
+
+  // drops queued while serverMutex is held, sent once the request handler is
+  // done with it. declare before the lock so it is released first
+  struct PendingDrops {
+    ShardkvServer* server;
+    CopyRequests drops;
+    ~PendingDrops() { server->SendCopies(&Shardkv::Stub::DropCopy, drops); }
+  };
+
+  // a key of ours other groups hold read-only copies of
+  struct HotKey {
+    // version of the copies the groups were last sent
+    uint64_t version;
+    std::vector<std::string> groups;
+  };
+
+  // a read-only copy of another group's hot key. a dropped copy is kept as
+  // a tombstone until it expires so older copies sent before it are ignored
+  struct KeyCopy {
+    std::string data;
+    uint64_t version = 0;
+    bool valid = false;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  // a request sent straight to us names the view its sender believes is
+  // current, see VIEW_METADATA. returns false, telling the sender the view we
+  // know of, unless we are the primary of that view, or the member serving
+  // strong reads for a read. requests without a view come from our manager or
+  // from the member before us and always pass
+  bool CheckView(::grpc::ServerContext* context, bool read = false);
+
+  // whether the write id names was applied already, see DedupTable
+  bool Applied(const RequestId& id);
+
+  // the version of value, see GetResponse.version. it is worked out from the
+  // value itself, so every member and every group the key moves to agree on
+  // it without keeping any state. 0 stands for no value
+  static uint64_t ValueVersion(const std::string& value);
+  // true if a write is conditional on ifVersion and key is no longer at it,
+  // see PutRequest.if_version. only checked by the member a write enters at,
+  // with the key's lock held, and passed on unconditionally so the members
+  // after it can never decide otherwise
+  bool VersionChanged(const std::string& key, uint64_t ifVersion);
+
+  // true if the key has a value here, see PutRequest.if_absent
+  bool Stored(const std::string& key);
+  // answers a read with value, or only with its version if the reader has
+  // that already, see GetRequest.known_version
+  static void AnswerRead(const std::string& value, const GetRequest& request, GetResponse* response);
+
+  // names the group owning the key at position in context's trailing
+  // metadata, as far as table knows, see OWNER_METADATA
+  static void HintOwner(::grpc::ServerContext* context, const RoutingTable& table, uint64_t position);
+  // turns a request for the key at position away, with HintOwner
+  static ::grpc::Status NotResponsible(::grpc::ServerContext* context, const RoutingTable& table,
+                                       uint64_t position);
+
+  // serves a read that allows some staleness as a backup, if we are in sync
+  // enough with our primary for it
+  ::grpc::Status FollowerGet(const ::GetRequest& request, ::GetResponse* response);
+
+  // counts a write as primary, handing its sequence number to the caller. must
+  // be called once the write has reached our backup
+  void CountWrite(::grpc::ServerContext* context);
+
+  // as primary, tells our backup that it has every write counted so far,
+  // which lets it serve reads. called with every ping of our manager
+  void SyncBackup();
+
+  // passes request on to the next member of our group, if there is one
+  void PassSync(const SyncStateRequest& request, std::chrono::system_clock::time_point deadline);
+
+  // delivers a batch of our outbox to group, then tells our backup it was
+  // delivered. used by the outbox, returns false if group did not take it
+  bool SendAppends(const std::string& group, const std::vector<OutboxEntry>& batch);
+
+  // sends a single key to the group now responsible for it and drops our copy,
+  // used by the migration scheduler. returns false if the group is unreachable
+  bool TransferKey(const std::string& destination, const std::string& key,
+                   const MigrationScheduler::ChargeFn& charge, uint64_t* bytes);
+
+  // updates our view of which group owns which ids and starts the resulting
+  // shard moves
+  void ApplyConfig(const QueryResponse& response);
+
+  // fetches a single key from the group that owned its range before us and
+  // stores it unless we already have a newer value. used for back-fills and
+  // pulls on miss, returns false if the old owner is unreachable. the
+  // following take the request they are done for, if any, whose deadline
+  // and cancellation carry over to the calls they make, see CallContext
+  bool PullKey(const std::string& source, const std::string& key, uint64_t* bytes,
+               const ::grpc::ServerContext* context = nullptr);
+
+  // in pull mode, makes sure a key of a range we are still pulling is here
+  // before we serve it. must be called without serverMutex held
+  void EnsureLocal(const std::string& key, const ::grpc::ServerContext* context = nullptr);
+
+  // in pull mode, makes sure every key of range that we are still pulling is
+  // here, so we can hand the range on. must be called without serverMutex held
+  void EnsureRangeLocal(const shard_t& range, const ::grpc::ServerContext* context = nullptr);
+
+  // asks source for the keys it holds in ranges. returns false if it could
+  // not be reached
+  bool ListKeys(const std::string& source, const std::vector<shard_t>& ranges,
+                std::vector<std::string>* keys, const ::grpc::ServerContext* context = nullptr);
+
+  // the request counter the key at id is counted in
+  size_t LoadSlot(uint64_t id) const;
+
+  // the routing table currently in use, safe to call without serverMutex
+  std::shared_ptr<const RoutingTable> Routing() const { return std::atomic_load(&routing); }
+
+  // what our manager last told us of the group, see View
+  struct View {
+    // the view number to acknowledge
+    int64_t number = 0;
+    std::string primary;
+    std::string backup;
+    // where we pass writes on to: the backup if we are primary, or the member
+    // after us in a chain. empty if no one
+    std::string successor;
+    // who serves strong reads: the primary, or the tail of a chain
+    std::string tail;
+  };
+
+  // the lock of key, see keyLocks
+  std::mutex& KeyLock(const std::string& key) { return keyLocks[std::hash<std::string>{}(key) % KEY_LOCKS]; }
+  // the locks of several keys, always taken in the order of keyLocks so two
+  // batches never wait on each other
+  std::vector<std::unique_lock<std::mutex>> LockKeys(const std::vector<std::string>& keys);
+
+  // the view currently in use, safe to call without serverMutex
+  std::shared_ptr<const View> CurrentView() const { return std::atomic_load(&view); }
+
+  // counts a request for the key at position towards the next load report
+  void CountRequest(uint64_t position);
+
+  // removes a user from the all_users list, must be called with serverMutex held
+  void RemoveFromUserList(const std::string& user);
+
+  // places copies of the keys read more than HOT_KEY_THRESH times per second
+  // since the last call on other groups, and drops the copies of keys that
+  // cooled down. only the primary copies keys
+  void UpdateHotKeys();
+
+  // the groups key is copied to while hot: up to hotKeyCopies groups other
+  // than ours, picked by the key's hash so every key gets its own
+  std::vector<std::string> CopyGroups(const std::string& key, const RoutingTable& table) const;
+
+  // called whenever key is written or leaves us, queues drops of its copies.
+  // must be called with serverMutex held
+  void KeyWritten(const std::string& key, CopyRequests* drops);
+
+  // a version newer than any copy or drop sent so far. based on the clock, so
+  // a backup taking over keeps going up from the old primary's versions. must
+  // be called with serverMutex held
+  uint64_t NextCopyVersion();
+
+  // sends every request to its group, must be called without serverMutex held
+  void SendCopies(::grpc::Status (Shardkv::Stub::*rpc)(::grpc::ClientContext*, const CopyRequest&, Empty*),
+                  const CopyRequests& requests);
+
   // address we're running on (hostname:port)
   const std::string address;
   // address of shardmanager passed as constructor's parameter
   std::string shardmanager_address;
-  // address of shardmaster sent by the shardmanager
-  std::string shardmaster_address;
+  // the replicas of the shardmaster as sent by the shardmanager, just one
+  // unless it is replicated
+  ReplicaList shardmasters;
   // Database of key-value pairs
   std::map<std::string, std::string> keyValueDatabase;
-  // Map of keys and their corresponding servers
-  std::map<int, std::string> keyServerMap;
+  // Which group owns which ids, replaced as a whole on every configuration
+  // change. Only accessed through std::atomic_load/std::atomic_store, and only
+  // replaced with serverMutex held so writes never race with a change of owner
+  std::shared_ptr<const RoutingTable> routing = std::make_shared<const RoutingTable>();
   // Map of posts and their corresponding users
   std::map<std::string, std::string> postUserMap;
+  // Which writes of every client were applied, so retried ones are not
+  // applied again. guarded by serverMutex
+  DedupTable dedup{DEDUP_CLIENTS};
   // Mutex for thread safety
   std::mutex serverMutex;
-  // Current view number to acknowledge
-  int64_t currentAcknowledgedViewNumber;
-  // Address of the backup server
-  std::string backupServerAddress;
-  // Address of the primary server
-  std::string primaryServerAddress;
+  // A write to a key holds its lock from checking the key's version until
+  // it is applied by us and every member after us, so all members apply the
+  // writes to a key in the same order. taken before forwardMutex
+  std::array<std::mutex, KEY_LOCKS> keyLocks;
+  // Held shared by a write from checking it is ours until it is applied.
+  // Held exclusively by Dump, so a dump for a new successor holds every write
+  // not passed on to it, and by ApplyConfig, so no key changes owner while a
+  // write to it is passed on. taken before serverMutex
+  std::shared_mutex forwardMutex;
+  // The view our last ping was answered with. Replaced as a whole by the
+  // heartbeat thread, and only accessed through std::atomic_load/std::atomic_store
+  std::shared_ptr<const View> view = std::make_shared<const View>();
+  // Tunables passed at construction
+  const ShardkvOptions options;
+  // Pull mode: ids we own but whose keys may still sit at their previous
+  // owner, mapped to that owner
+  IntervalMap incomingRanges;
+  // Requests per part of the key space since the last load report, also used
+  // to back-fill hot keys first in pull mode. see LoadSlot
+  std::vector<std::atomic<uint64_t>> requestCounts;
+  // When the last load report was made and the process CPU time then, only
+  // used by the load thread
+  std::chrono::steady_clock::time_point lastLoadReport = std::chrono::steady_clock::now();
+  double lastCpuSeconds = 0;
+  // Reads per key, to find hot keys
+  HotKeyTracker hotKeyReads;
+  // Our hot keys that other groups hold copies of, only kept by the primary
+  std::map<std::string, HotKey> hotKeys;
+  // Copies of other groups' hot keys we may serve reads from
+  std::map<std::string, KeyCopy> copies;
+  // Last version handed out by NextCopyVersion
+  uint64_t lastCopyVersion = 0;
+  // Writes counted by CountWrite. a backup follows its primary's count, so it
+  // keeps counting up if it takes over
+  std::atomic<uint64_t> writeSeq{0};
+  // set once we have the keys of the member before us, or started the group.
+  // until then we take no writes, give no dump and are not synced
+  std::atomic<bool> loaded{false};
+  // backup only: the primary's count of writes at its last SyncState, all of
+  // which we have, and when that was
+  uint64_t syncedSeq = 0;
+  std::chrono::steady_clock::time_point syncedAt;
+  // Serializes pulls so two requests never fetch the same key twice
+  std::mutex pullMutex;
+  // How calls to other servers are retried, and which of them are down
+  RetryPolicy retries;
+  // Appends our writes imply for other groups' keys, not delivered yet
+  std::unique_ptr<Outbox> outbox;
+  // Runs the transfers of keys to the groups now responsible for them. last so
+  // its workers are stopped before the state they use is destroyed
+  std::unique_ptr<MigrationScheduler> migrations;
 };
 
 #endif  // SHARDING_SHARDKV_H
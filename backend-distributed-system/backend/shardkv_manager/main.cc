@@ -4,12 +4,38 @@
 
 #include "shardkv_manager.h"
 
+static void usage() {
+  fprintf(stderr, "usage: ./shardmanager <PORT> <SHARDMASTER HOSTNAME> " \
+                  "<SHARDMASTER PORT> [--chain=<REPLICAS>] [--hedge=<PERCENT>] " \
+                  "[--shardmaster-replicas=<host:port>,...]\n");
+}
+
 int main(int argc, char** argv) {
-  if (argc != 4) {
-    fprintf(stderr, "usage: ./shardmanager <PORT> <SHARDMASTER HOSTNAME> " \
-                    "<SHARDMASTER PORT>\n");
+  if (argc < 4) {
+    usage();
     return 1;
   }
+  ShardkvManagerOptions options;
+  for (int i = 4; i < argc; i++) {
+    std::string flag(argv[i]);
+    std::string value = flag.substr(flag.find('=') + 1);
+    if (flag.rfind("--chain=", 0) == 0) {
+      options.chainLength = std::stoul(value);
+    } else if (flag.rfind("--hedge=", 0) == 0) {
+      options.hedge.budgetPercent = std::stoul(value);
+    } else if (flag.rfind("--shardmaster-replicas=", 0) == 0) {
+      size_t start = 0;
+      while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) end = value.size();
+        if (end > start) options.shardmasterReplicas.push_back(value.substr(start, end - start));
+        start = end + 1;
+      }
+    } else {
+      usage();
+      return 1;
+    }
+  }
   // get our hostname so we can construct address for shardkv. we need this
   // because the shardmaster will know us by our hostname and port, so we should
   // track that.
@@ -27,7 +53,7 @@ int main(int argc, char** argv) {
 
   ::grpc::ServerBuilder builder;
   builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
-  ShardkvManager shardkv(addr, shardmaster_addr);
+  ShardkvManager shardkv(addr, shardmaster_addr, options);
   builder.RegisterService(&shardkv);
   std::unique_ptr<::grpc::Server> server = builder.BuildAndStart();
 
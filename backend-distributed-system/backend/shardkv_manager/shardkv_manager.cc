@@ -1,7 +1,33 @@
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
 
 #include "shardkv_manager.h"
 
+// hands what our primary told about a request in its trailing metadata on to
+// the caller: the sequence number of a write, see SEQ_METADATA, or the owner
+// of a key we do not have, see OWNER_METADATA
+static void PassTrailer(const ::grpc::ClientContext& cc, ::grpc::ServerContext* context) {
+    const auto& trailer = cc.GetServerTrailingMetadata();
+    for (const char* key : {SEQ_METADATA, OWNER_METADATA, OWNER_SHARD_METADATA, CONFIG_VERSION_METADATA,
+                            VERSION_METADATA}) {
+        auto value = trailer.find(key);
+        if (value != trailer.end()) {
+            context->AddTrailingMetadata(key, std::string(value->second.begin(), value->second.end()));
+        }
+    }
+}
+
+// what the caller is told about a request our primary did not take. one
+// that could not be reached is reported as such, so the caller may retry,
+// and so is a conditional write that lost to another, so it may read again
+static ::grpc::Status Forwarded(const ::grpc::Status& status) {
+    if (status.ok() || status.error_code() == ::grpc::StatusCode::ABORTED) return status;
+    if (status.error_code() == ::grpc::StatusCode::UNAVAILABLE) {
+        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "Primary unreachable");
+    }
+    return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+}
+
 /**
  * This method is analogous to a hashmap lookup. A key is supplied in the
  * request and if its value can be found, we should either set the appropriate
@@ -18,12 +44,38 @@
 ::grpc::Status ShardkvManager::Get(::grpc::ServerContext* context,
                                   const ::GetRequest* request,
                                   ::GetResponse* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    auto serverChannel = ::grpc::CreateChannel(primaryServerAddress, ::grpc::InsecureChannelCredentials());
-    Shardkv::Stub shardkvStub(serverChannel);
-    ::grpc::ClientContext cc;
-    auto status = shardkvStub.Get(&cc, *request, response);
-    return status.ok() ? ::grpc::Status::OK : ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+    // reads don't hold the lock while they are forwarded, so a slow read
+    // holds up neither other requests nor the failure detector
+    std::string server, replica;
+    {
+        std::lock_guard<std::mutex> lock(serverMutex);
+        server = ReadServer();
+        replica = HedgeServer();
+    }
+    auto read = [](const std::string& to, const GetRequest& request) {
+        return [to, request](::grpc::ClientContext* cc, GetResponse* res) {
+            Shardkv::Stub shardkvStub(::grpc::CreateChannel(to, ::grpc::InsecureChannelCredentials()));
+            return shardkvStub.Get(cc, request, res);
+        };
+    };
+    ::grpc::Status status;
+    if (!hedging.Enabled() || replica.empty()) {
+        status = retries.Call(server, [&]() {
+            auto cc = CallContext(context);
+            auto status = read(server, *request)(cc.get(), response);
+            PassTrailer(*cc, context);
+            return status;
+        }, true, context->deadline());
+    } else {
+        // the replica only answers if it is close enough behind
+        GetRequest hedge(*request);
+        if (hedge.consistency() == GetRequest::STRONG) {
+            hedge.set_consistency(GetRequest::BOUNDED);
+            hedge.set_max_staleness_ms(hedging.Options().maxStalenessMs);
+        }
+        status = HedgedCall<GetResponse>(hedging, read(server, *request), read(replica, hedge), response, context);
+    }
+    return Forwarded(status);
 }
 
 /**
@@ -43,12 +95,16 @@
 ::grpc::Status ShardkvManager::Put(::grpc::ServerContext* context,
                                   const ::PutRequest* request,
                                   Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    auto serverChannel = ::grpc::CreateChannel(primaryServerAddress, ::grpc::InsecureChannelCredentials());
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
     Shardkv::Stub shardkvStub(serverChannel);
-    ::grpc::ClientContext cc;
-    auto status = shardkvStub.Put(&cc, *request, response);
-    return status.ok() ? ::grpc::Status::OK : ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.Put(cc.get(), *request, response);
+        PassTrailer(*cc, context);
+        return status;
+    }, request->id().client_id() != 0 || request->if_absent(), context->deadline());
+    return Forwarded(status);
 }
 
 /**
@@ -67,12 +123,16 @@
 ::grpc::Status ShardkvManager::Append(::grpc::ServerContext* context,
                                      const ::AppendRequest* request,
                                      Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    auto serverChannel = ::grpc::CreateChannel(primaryServerAddress, ::grpc::InsecureChannelCredentials());
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
     Shardkv::Stub shardkvStub(serverChannel);
-    ::grpc::ClientContext cc;
-    auto status = shardkvStub.Append(&cc, *request, response);
-    return status.ok() ? ::grpc::Status::OK : ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.Append(cc.get(), *request, response);
+        PassTrailer(*cc, context);
+        return status;
+    }, request->id().client_id() != 0, context->deadline());
+    return Forwarded(status);
 }
 
 /**
@@ -90,12 +150,141 @@
 ::grpc::Status ShardkvManager::Delete(::grpc::ServerContext* context,
                                            const ::DeleteRequest* request,
                                            Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    auto serverChannel = ::grpc::CreateChannel(primaryServerAddress, ::grpc::InsecureChannelCredentials());
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
+    Shardkv::Stub shardkvStub(serverChannel);
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.Delete(cc.get(), *request, response);
+        PassTrailer(*cc, context);
+        return status;
+    }, request->id().client_id() != 0, context->deadline());
+    return Forwarded(status);
+}
+
+/**
+ * Deletes several keys at once, see ShardkvServer::DeleteBatch.
+ *
+ * @param context - you can ignore this
+ * @param request the keys to remove
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvManager::DeleteBatch(::grpc::ServerContext* context,
+                                           const ::DeleteBatchRequest* request,
+                                           Empty* response) {
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
+    Shardkv::Stub shardkvStub(serverChannel);
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.DeleteBatch(cc.get(), *request, response);
+        return status;
+    }, true, context->deadline());
+    return Forwarded(status);
+}
+
+/**
+ * Hands keys over to the group now responsible for them, see ShardkvServer::Fetch.
+ *
+ * @param context - you can ignore this
+ * @param request the keys to hand over, and whether to drop them here
+ * @param response the keys we had, with their values
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvManager::Fetch(::grpc::ServerContext* context,
+                                     const ::FetchRequest* request,
+                                     ::DumpResponse* response) {
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
+    Shardkv::Stub shardkvStub(serverChannel);
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.Fetch(cc.get(), *request, response);
+        return status;
+    }, !request->erase(), context->deadline());
+    return Forwarded(status);
+}
+
+/**
+ * Applies appends another group's writes imply for our keys, see
+ * ShardkvServer::AppendBatch.
+ *
+ * @param context - you can ignore this
+ * @param request the appends, in order
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvManager::AppendBatch(::grpc::ServerContext* context,
+                                           const ::AppendBatchRequest* request,
+                                           Empty* response) {
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
+    Shardkv::Stub shardkvStub(serverChannel);
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.AppendBatch(cc.get(), *request, response);
+        return status;
+    }, false, context->deadline());
+    return Forwarded(status);
+}
+
+/**
+ * Places a read-only copy of another group's hot key on our primary, see
+ * ShardkvServer::PutCopy. Like every call it is forwarded without holding
+ * our lock: the owner sends it while serving a request of its own group, so
+ * two groups copying keys to each other would otherwise wait on each other's
+ * lock forever.
+ *
+ * @param context - you can ignore this
+ * @param request the key, its value and version
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvManager::PutCopy(::grpc::ServerContext* context,
+                                       const ::CopyRequest* request,
+                                       Empty* response) {
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
     Shardkv::Stub shardkvStub(serverChannel);
-    ::grpc::ClientContext cc;
-    auto status = shardkvStub.Delete(&cc, *request, response);
-    return status.ok() ? ::grpc::Status::OK : ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Operation failed");
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.PutCopy(cc.get(), *request, response);
+        return status;
+    }, true, context->deadline());
+    return Forwarded(status);
+}
+
+/**
+ * Invalidates a copy of another group's hot key on our primary, see PutCopy.
+ *
+ * @param context - you can ignore this
+ * @param request the key and the version of the write that invalidated it
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status ShardkvManager::DropCopy(::grpc::ServerContext* context,
+                                        const ::CopyRequest* request,
+                                        Empty* response) {
+    std::string primary = Primary();
+    auto serverChannel = ::grpc::CreateChannel(primary, ::grpc::InsecureChannelCredentials());
+    Shardkv::Stub shardkvStub(serverChannel);
+    auto status = retries.Call(primary, [&]() {
+        auto cc = CallContext(context);
+        auto status = shardkvStub.DropCopy(cc.get(), *request, response);
+        return status;
+    }, true, context->deadline());
+    return Forwarded(status);
 }
 
 /**
@@ -113,6 +302,14 @@
 ::grpc::Status ShardkvManager::Ping(::grpc::ServerContext* context, const PingRequest* request,
                                        ::PingResponse* response) {
     std::lock_guard<std::mutex> lock(serverMutex);
+    if (request->loaded()) {
+        loadedServers.insert(request->server());
+    } else {
+        loadedServers.erase(request->server());
+    }
+    if (options.chainLength > 0) {
+        return PingChain(request->server(), response);
+    }
     std::string serverAddress = request->server();
     std::vector<std::string> currentViewServers;
     if(primaryServerAddress.empty() || primaryServerAddress == serverAddress) {
@@ -145,5 +342,111 @@
     }
     pingIntervals[serverAddress].Push(std::chrono::high_resolution_clock::now());
     response->set_shardmaster(sm_address);
+    for (const auto& replica : shardmasters) {
+        response->add_shardmasters(replica);
+    }
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Publishes our current view, so callers can send requests straight to the
+ * primary instead of through us. They are turned away by any member that is
+ * not the primary of this view, see ShardkvServer::CheckView.
+ *
+ * @param context - you can ignore this
+ * @param request An empty message
+ * @param response the current view number, primary and backup
+ * @return ::grpc::Status::OK, or UNAVAILABLE while no server has pinged us
+ */
+::grpc::Status ShardkvManager::GetView(::grpc::ServerContext* context, const Empty* request,
+                                       ::ViewResponse* response) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if (primaryServerAddress.empty()) {
+        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No primary yet");
+    }
+    response->set_view(currentViewNumber);
+    response->set_primary(primaryServerAddress);
+    response->set_backup(backupServerAddress);
+    for (const auto& member : chain) {
+        response->add_chain(member);
+    }
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status ShardkvManager::PingChain(const std::string& server, ::PingResponse* response) {
+    if (std::find(chain.begin(), chain.end(), server) == chain.end()) {
+        if (chain.size() >= options.chainLength) {
+            return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Exceeded server capacity");
+        }
+        // a new member joins at the tail, starting from the old tail's keys
+        chain.push_back(server);
+        ChainChanged();
+    }
+    pingIntervals[server].Push(std::chrono::high_resolution_clock::now());
+    response->set_id(currentViewNumber);
+    response->set_primary(primaryServerAddress);
+    response->set_backup(backupServerAddress);
+    response->set_shardmaster(sm_address);
+    for (const auto& replica : shardmasters) {
+        response->add_shardmasters(replica);
+    }
+    for (const auto& member : chain) {
+        response->add_chain(member);
+    }
     return ::grpc::Status::OK;
 }
+
+void ShardkvManager::RepairChain() {
+    std::vector<std::string> alive;
+    std::vector<std::string> dead;
+    for (const auto& member : chain) {
+        auto pi = pingIntervals.find(member);
+        bool gone = pi != pingIntervals.end() && pi->second.GetPingInterval() > deadPingInterval;
+        (gone ? dead : alive).push_back(member);
+    }
+    // the head holds every key, it is only dropped for a member that has
+    // loaded them. until then the group waits for it to come back
+    if (!dead.empty() && dead.front() == chain.front() && !alive.empty() && loadedServers.count(alive.front()) == 0) {
+        alive.insert(alive.begin(), dead.front());
+        dead.erase(dead.begin());
+    }
+    if (dead.empty()) {
+        return;
+    }
+    // a member's neighbours learn of each other with their next ping, the
+    // member before it passing writes on to the one after it from then on
+    for (const auto& member : dead) {
+        pingIntervals.erase(member);
+    }
+    chain = std::move(alive);
+    ChainChanged();
+}
+
+void ShardkvManager::ChainChanged() {
+    currentViewNumber++;
+    lastAcknowledgedViewNumber = currentViewNumber;
+    primaryServerAddress = chain.empty() ? "" : chain.front();
+    backupServerAddress = chain.size() > 1 ? chain[1] : "";
+    views[currentViewNumber] = chain;
+}
+
+std::string ShardkvManager::Primary() {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    return primaryServerAddress;
+}
+
+const std::string& ShardkvManager::ReadServer() const {
+    // a new tail serves reads once it has loaded, the member before it until then
+    for (auto it = chain.rbegin(); it != chain.rend(); it++) {
+        if (loadedServers.count(*it) > 0) return *it;
+    }
+    return chain.empty() ? primaryServerAddress : chain.front();
+}
+
+std::string ShardkvManager::HedgeServer() const {
+    if (chain.empty()) {
+        return backupServerAddress;
+    }
+    // the head of a chain serves no relaxed reads
+    return chain.size() > 2 ? chain[chain.size() - 2] : "";
+}
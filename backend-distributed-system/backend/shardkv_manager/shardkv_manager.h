@@ -4,6 +4,10 @@
 #include <grpcpp/grpcpp.h>
 #include <thread>
 #include "../common/common.h"
+#include "../common/hedging.h"
+#include "../common/retry.h"
+#include "../common/rpc.h"
+#include <set>
 #include <unordered_map>
 #include <mutex>
 #include <iostream>
@@ -24,12 +28,32 @@ public:
     }
 };
 
+// tunables of the shardmanager, see shardkv_manager/main.cc for the matching
+// flags
+struct ShardkvManagerOptions {
+  // 0 for a primary that serves every request and one backup. otherwise the
+  // group is a chain of up to this many servers: writes enter at its head and
+  // are passed down to its tail, which serves strong reads
+  unsigned int chainLength = 0;
+  // reads that are slow to return from the primary, or the tail, are sent to
+  // the replica before it as well. off unless given a budget
+  HedgeOptions hedge;
+  // the other replicas of a replicated shardmaster. our servers move on to
+  // them when the one we were given cannot serve them
+  std::vector<std::string> shardmasterReplicas;
+};
+
 class ShardkvManager : public Shardkv::Service {
   using Empty = google::protobuf::Empty;
 
  public:
-  explicit ShardkvManager(std::string addr, const std::string& shardmaster_addr)
-      : address(std::move(addr)), sm_address(shardmaster_addr) {
+  explicit ShardkvManager(std::string addr, const std::string& shardmaster_addr,
+                          const ShardkvManagerOptions& opts = ShardkvManagerOptions())
+      : address(std::move(addr)), sm_address(shardmaster_addr), options(opts), hedging(opts.hedge) {
+      shardmasters.push_back(sm_address);
+      for (const auto& replica : options.shardmasterReplicas) {
+          if (replica != sm_address) shardmasters.push_back(replica);
+      }
       // TODO: Part 3
       // This thread will check for last shardkv server ping and update the view accordingly if needed
       std::thread heartbeatChecker(
@@ -37,10 +61,16 @@ class ShardkvManager : public Shardkv::Service {
                   std::chrono::milliseconds timespan(1000);
                   while (true) {
                       std::this_thread::sleep_for(timespan);
-                      if (!primaryServerAddress.empty()) {
+                      if (options.chainLength > 0) {
+                          std::lock_guard<std::mutex> lock(serverMutex);
+                          RepairChain();
+                      } else if (!primaryServerAddress.empty()) {
+                          std::lock_guard<std::mutex> lock(serverMutex);
                           auto pi = pingIntervals.find(primaryServerAddress);
-                          if (pi != pingIntervals.end() && pi->second.GetPingInterval() > deadPingInterval) {
-                              std::lock_guard<std::mutex> lock(serverMutex);
+                          // a backup still loading the primary's keys would
+                          // take over with none, so we wait for the primary
+                          bool ready = backupServerAddress.empty() || loadedServers.count(backupServerAddress) > 0;
+                          if (pi != pingIntervals.end() && pi->second.GetPingInterval() > deadPingInterval && ready) {
                               primaryServerAddress = backupServerAddress;
                               backupServerAddress.clear();
                               currentViewNumber = lastAcknowledgedViewNumber + 1;
@@ -65,15 +95,63 @@ class ShardkvManager : public Shardkv::Service {
   ::grpc::Status Delete(::grpc::ServerContext* context,
                         const ::DeleteRequest* request,
                         Empty* response) override;
+  ::grpc::Status DeleteBatch(::grpc::ServerContext* context,
+                             const ::DeleteBatchRequest* request,
+                             Empty* response) override;
   ::grpc::Status Ping(::grpc::ServerContext* context, const PingRequest* request,
                         ::PingResponse* response) override;
+  ::grpc::Status GetView(::grpc::ServerContext* context, const Empty* request,
+                         ::ViewResponse* response) override;
+  ::grpc::Status Fetch(::grpc::ServerContext* context, const ::FetchRequest* request,
+                       ::DumpResponse* response) override;
+  ::grpc::Status AppendBatch(::grpc::ServerContext* context, const ::AppendBatchRequest* request,
+                             Empty* response) override;
+  ::grpc::Status PutCopy(::grpc::ServerContext* context, const ::CopyRequest* request,
+                         Empty* response) override;
+  ::grpc::Status DropCopy(::grpc::ServerContext* context, const ::CopyRequest* request,
+                          Empty* response) override;
 
  private:
+    // the primary to forward a request to. it is copied under serverMutex,
+    // which no forward holds, so a slow primary holds up neither other
+    // requests nor the failure detector
+    std::string Primary();
+
+    // the following are for chain mode and must be called with serverMutex held
+    // adds server to the chain if it is new and there is room, and answers
+    // its ping with the current chain
+    ::grpc::Status PingChain(const std::string& server, ::PingResponse* response);
+    // drops the members that stopped pinging, joining their neighbours
+    void RepairChain();
+    // starts a new view after the chain changed
+    void ChainChanged();
+    // the server strong reads go to, the last member that has loaded its keys
+    // in chain mode
+    const std::string& ReadServer() const;
+    // the replica a hedged read goes to, empty if there is none
+    std::string HedgeServer() const;
+
     // address we're running on (hostname:port)
     const std::string address;
 
     // shardmaster address
     std::string sm_address;
+    // every replica of the shardmaster, sm_address first, as passed on to
+    // our servers
+    std::vector<std::string> shardmasters;
+
+    // Tunables passed at construction
+    const ShardkvManagerOptions options;
+
+    // chain mode: the group's members from head to tail. the head is also
+    // kept as primary, the member after it as backup
+    std::vector<std::string> chain;
+
+    // when to hedge reads, see options.hedge
+    HedgePolicy hedging;
+
+    // how forwards to our primary are retried
+    RetryPolicy retries;
 
     // Mutex for server synchronization
     std::mutex serverMutex;
@@ -93,6 +171,9 @@ class ShardkvManager : public Shardkv::Service {
     // Ping intervals for each server
     std::map<std::string, PingInterval> pingIntervals;
 
+    // servers whose last ping said they have their keys, see PingRequest.loaded
+    std::set<std::string> loadedServers;
+
     // Map of views with their corresponding servers
     std::map<int, std::vector<std::string>> views;
 
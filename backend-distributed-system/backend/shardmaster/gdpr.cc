@@ -0,0 +1,141 @@
+#include "shardmaster.h"
+
+#include <thread>
+
+#include "../build/shardkv.grpc.pb.h"
+#include "../common/retry.h"
+#include "../config/config.h"
+
+/*
+ * GDPR purges. A user's posts are spread over every group, so the shardmaster,
+ * which knows where every key lives, deletes them on the caller's behalf: it
+ * reads the user's post list, sends every group holding some of the posts
+ * batches of deletes, all groups at once, and finally deletes the list and
+ * the user, which also takes the user off its group's all_users list. The
+ * list goes last so a purge that failed half way can simply be run again.
+ */
+
+// calls a group until it answers, waiting longer after every failure, see
+// JitteredBackoff
+template <typename Request, typename Response>
+static ::grpc::Status CallGroup(const std::string& group,
+                                ::grpc::Status (Shardkv::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+                                const Request& request, Response* response) {
+    auto stub = Shardkv::NewStub(grpc::CreateChannel(group, grpc::InsecureChannelCredentials()));
+    ::grpc::Status status;
+    for(int attempt = 0; attempt < StaticShardmaster::GDPR_ATTEMPTS; attempt++) {
+        if(attempt > 0) {
+            std::this_thread::sleep_for(JitteredBackoff(attempt, StaticShardmaster::GDPR_RETRY_DELAY,
+                                                        StaticShardmaster::GDPR_TIMEOUT));
+        }
+        ::grpc::ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + StaticShardmaster::GDPR_TIMEOUT);
+        status = (stub.get()->*call)(&cc, request, response);
+        if(status.ok()) break;
+    }
+    return status;
+}
+
+// where keys are placed in config
+static Config Placement(const ::QueryResponse& config) {
+    Config placement;
+    // shardmasters always publish their key space, but be safe with empty ones
+    placement.SetKeySpace(config.max_key() != 0 ? config.max_key() : MAX_KEY,
+                          static_cast<Partitioning>(config.partitioning()));
+    for(const auto& entry : config.config()) {
+        for(const auto& shard : entry.shards()) {
+            placement.Insert(entry.server(), {shard.lower(), shard.upper()});
+        }
+    }
+    return placement;
+}
+
+void StaticShardmaster::PurgeUser(const std::string& user) {
+    std::string listKey = user + "_posts";
+    auto config = Snapshot();
+    auto listOwner = Placement(*config).GetServer(listKey);
+    if(!listOwner.has_value()) {
+        FinishPurge(user, GDPRStatusResponse::FAILED, "No group holds " + listKey);
+        return;
+    }
+    // Fetch, unlike Get, tells a missing list from an unreachable group
+    FetchRequest fetch;
+    DumpResponse list;
+    fetch.add_keys(listKey);
+    auto status = CallGroup(listOwner.value(), &Shardkv::Stub::Fetch, fetch, &list);
+    if(!status.ok()) {
+        FinishPurge(user, GDPRStatusResponse::FAILED, "Failed to read " + listKey + ": " + status.error_message());
+        return;
+    }
+    std::vector<std::string> posts;
+    auto it = list.database().find(listKey);
+    if(it != list.database().end()) {
+        posts = parse_value(it->second, ",");
+    }
+
+    // keys that moved while we deleted may have been missed, or turned away by
+    // a group that no longer owns them, so go over them again with the new
+    // configuration until it holds still
+    for(int pass = 0; ; pass++) {
+        bool deleted = DeleteEverywhere(user, *config, posts);
+        auto latest = Snapshot();
+        bool settled = latest->version() == config->version() || pass == 2;
+        if(!deleted && settled) {
+            FinishPurge(user, GDPRStatusResponse::FAILED, "A group holding posts of " + user + " is unreachable");
+            return;
+        }
+        if(settled) break;
+        config = latest;
+    }
+    if(!DeleteEverywhere(user, *config, {listKey, user})) {
+        FinishPurge(user, GDPRStatusResponse::FAILED, "The group holding " + user + " is unreachable");
+        return;
+    }
+    FinishPurge(user, GDPRStatusResponse::DONE);
+}
+
+bool StaticShardmaster::DeleteEverywhere(const std::string& user, const ::QueryResponse& config,
+                                         const std::vector<std::string>& keys) {
+    Config placement = Placement(config);
+    std::map<std::string, std::vector<std::string>> byGroup;
+    for(const auto& key : keys) {
+        auto group = placement.GetServer(key);
+        if(group.has_value()) byGroup[group.value()].push_back(key);
+    }
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> workers;
+    for(const auto& [group, groupKeys] : byGroup) {
+        workers.emplace_back([this, &user, &failed, group = group, groupKeys = &groupKeys]() {
+            for(size_t first = 0; first < groupKeys->size(); first += GDPR_BATCH) {
+                DeleteBatchRequest batch;
+                size_t last = std::min(groupKeys->size(), first + GDPR_BATCH);
+                for(size_t i = first; i < last; i++) {
+                    batch.add_keys((*groupKeys)[i]);
+                }
+                Empty empty;
+                if(!CallGroup(group, &Shardkv::Stub::DeleteBatch, batch, &empty).ok()) {
+                    failed = true;
+                    return;
+                }
+                std::lock_guard<std::mutex> gdprLock(gdprMutex);
+                auto& purge = purges[user];
+                purge.set_keys_deleted(purge.keys_deleted() + batch.keys_size());
+            }
+        });
+    }
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    return !failed;
+}
+
+void StaticShardmaster::FinishPurge(const std::string& user, GDPRStatusResponse::State state,
+                                    const std::string& error) {
+    if(state == GDPRStatusResponse::FAILED) {
+        std::cerr << "Failed to purge " << user << ": " << error << std::endl;
+    }
+    std::lock_guard<std::mutex> gdprLock(gdprMutex);
+    auto& purge = purges[user];
+    purge.set_state(state);
+    purge.set_error(error);
+}
@@ -3,18 +3,67 @@
 #include "shardmaster.h"
 
 int main(int argc, char** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "usage: ./shardmaster <PORT>\n");
+  ShardmasterOptions options;
+  bool maxKeySet = false;
+  // optional flags go after the port
+  for (int i = 2; i < argc; i++) {
+    std::string flag(argv[i]);
+    if (flag == "--rebalance=even") {
+      options.rebalance = RebalanceMode::EVEN;
+    } else if (flag == "--rebalance=minimal") {
+      options.rebalance = RebalanceMode::MINIMAL;
+    } else if (flag == "--load-aware") {
+      options.loadAware = true;
+    } else if (flag.rfind("--max-key=", 0) == 0) {
+      options.maxKey = std::min<uint64_t>(std::stoull(flag.substr(10)), MAX_KEY_LIMIT);
+      maxKeySet = true;
+    } else if (flag == "--partition=id") {
+      options.partitioning = Partitioning::ID;
+    } else if (flag == "--partition=hash") {
+      options.partitioning = Partitioning::HASH;
+    } else if (flag == "--partition=affinity") {
+      options.partitioning = Partitioning::AFFINITY;
+    } else if (flag.rfind("--replicas=", 0) == 0) {
+      std::string list = flag.substr(11);
+      size_t start = 0;
+      while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) options.replicas.push_back(list.substr(start, end - start));
+        start = end + 1;
+      }
+    } else if (flag.rfind("--state-file=", 0) == 0) {
+      options.stateFile = flag.substr(13);
+    } else {
+      argc = 0;
+    }
+  }
+  if (argc < 2) {
+    fprintf(stderr,
+            "usage: ./shardmaster <PORT> [--rebalance=even|minimal] "
+            "[--load-aware] [--max-key=N] [--partition=id|hash|affinity] "
+            "[--replicas=<host:port>,...] [--state-file=<path>]\n");
     return 1;
   }
-  // shardmaster service
-  StaticShardmaster shardmaster;
+  // hashes are 64 bits, use all of them unless told otherwise
+  if (options.partitioning == Partitioning::HASH && !maxKeySet) {
+    options.maxKey = MAX_KEY_LIMIT;
+  }
   // construct address
   char hostnamebuf[256];
   gethostname(hostnamebuf, 256);
   // construct addresses
   std::string hostname(hostnamebuf);
   std::string addr = hostname + ":" + std::string(argv[1]);
+  // replicas find themselves in the list by this address
+  options.self = addr;
+  if (options.replicas.size() > 1 &&
+      std::find(options.replicas.begin(), options.replicas.end(), addr) == options.replicas.end()) {
+    fprintf(stderr, "%s is not in --replicas\n", addr.c_str());
+    return 1;
+  }
+  // shardmaster service
+  StaticShardmaster shardmaster(options);
   ::grpc::ServerBuilder builder;
   builder.AddListeningPort(addr, ::grpc::InsecureServerCredentials());
   builder.RegisterService(&shardmaster);
@@ -0,0 +1,416 @@
+#include "shardmaster.h"
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <thread>
+
+/*
+ * Replication of the shardmaster between a fixed group of replicas. One
+ * replica leads: it makes every change and replicates it to the others before
+ * serving it, the way Raft does. Each log entry holds the whole configuration,
+ * so replicas only keep their latest entry and a lagging replica catches up by
+ * receiving that one entry. The other replicas serve Query from their own
+ * copy while the leader's heartbeats keep their read lease alive, and forward
+ * every change to the leader.
+ */
+
+static std::chrono::steady_clock::rep LeaseFrom(std::chrono::steady_clock::time_point start) {
+    return (start + StaticShardmaster::READ_LEASE).time_since_epoch().count();
+}
+
+// runs call(i) for every i below count at once, each on a thread of its
+// own, and waits for all of them
+static void CallEach(size_t count, const std::function<void(size_t)>& call) {
+    std::vector<std::thread> calls;
+    for(size_t i = 0; i < count; i++) {
+        calls.emplace_back(call, i);
+    }
+    for(auto& thread : calls) {
+        thread.join();
+    }
+}
+
+// sends request to a replica through stub, with entry if withEntry or once
+// the replica turns out to be behind. made without serverMutex. returns false
+// if the replica could not be reached, its answer is in response otherwise
+static bool SendReplicate(Shardmaster::Stub* stub, ReplicateRequest request, const LogEntry& entry,
+                          bool withEntry, ReplicateResponse* response) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        if(withEntry) {
+            *request.mutable_entry() = entry;
+        }
+        ::grpc::ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + StaticShardmaster::REPLICA_TIMEOUT);
+        response->Clear();
+        if(!stub->Replicate(&cc, request, response).ok()) {
+            return false;
+        }
+        if(response->success() || withEntry || response->term() > request.term()) {
+            return true;
+        }
+        withEntry = true;
+    }
+    return true;
+}
+
+bool StaticShardmaster::AppendEntry(std::unique_lock<std::mutex>& lock) {
+    LogEntry previous = accepted;
+    LogEntry entry;
+    entry.set_term(term);
+    entry.set_index(accepted.index() + 1);
+    *entry.mutable_config() = CurrentConfig();
+    for(const auto& [server, weight] : weights) {
+        (*entry.mutable_weights())[server] = weight;
+    }
+    uint64_t index = entry.index();
+    accepted = std::move(entry);
+    if(!Replicated()) {
+        commitIndex = index;
+        PersistState();
+        Publish(accepted.config());
+        return true;
+    }
+    PersistState();
+    if(!Sync(lock) || commitIndex < index) {
+        // the caller is told the change failed, so no later change may carry it
+        // into the log. the configuration before it goes out as the next entry
+        // instead, so replicas that have ours take it too. an entry that
+        // replaced ours meanwhile was installed with it
+        if(role == Role::LEADER && accepted.index() == index) {
+            previous.set_term(term);
+            previous.set_index(index + 1);
+            accepted = std::move(previous);
+            Install(accepted);
+            PersistState();
+        }
+        return false;
+    }
+    // tell the others it is committed, so they serve it right away
+    Sync(lock);
+    return true;
+}
+
+bool StaticShardmaster::Sync(std::unique_lock<std::mutex>& lock) {
+    auto start = std::chrono::steady_clock::now();
+    // what is sent is settled under the lock, the calls are made without it
+    uint64_t sentTerm = term;
+    LogEntry entry = accepted;
+    ReplicateRequest request;
+    request.set_term(term);
+    request.set_leader(options.self);
+    request.set_last_index(entry.index());
+    request.set_last_term(entry.term());
+    request.set_commit_index(commitIndex);
+    struct Call {
+        std::string peer;
+        Shardmaster::Stub* stub;
+        bool withEntry;
+        bool reached = false;
+        ReplicateResponse response;
+    };
+    std::vector<Call> calls;
+    for(const auto& peer : options.replicas) {
+        if(peer == options.self) continue;
+        auto it = matched.find(peer);
+        calls.push_back({peer, Peer(peer), it == matched.end() || it->second != entry.index()});
+    }
+    lock.unlock();
+    CallEach(calls.size(), [&](size_t i) {
+        calls[i].reached = SendReplicate(calls[i].stub, request, entry, calls[i].withEntry, &calls[i].response);
+    });
+    lock.lock();
+    for(const auto& call : calls) {
+        if(call.reached && call.response.term() > term) {
+            StepDown(call.response.term());
+            return false;
+        }
+    }
+    // we may have lost the lead while the calls were out
+    if(role != Role::LEADER || term != sentTerm) {
+        return false;
+    }
+    size_t acks = 1;
+    for(const auto& call : calls) {
+        if(!call.reached) continue;
+        if(call.response.success()) {
+            matched[call.peer] = std::max(matched[call.peer], entry.index());
+            acks++;
+        } else {
+            matched.erase(call.peer);
+        }
+    }
+    if(2 * acks <= options.replicas.size()) {
+        return false;
+    }
+    lastHeard = std::max(lastHeard, start);
+    leaseUntil = std::max(leaseUntil.load(), LeaseFrom(start));
+    // a later entry may be committed already by a change made meanwhile
+    if(commitIndex < entry.index()) {
+        commitIndex = entry.index();
+        PersistState();
+        Publish(entry.config());
+    }
+    return true;
+}
+
+/**
+ * Called by the leader on every other replica, with every change and as a
+ * heartbeat. The leader's latest entry replaces ours, since a leader always
+ * holds every committed entry, and is served once the leader says a majority
+ * has it. Every heartbeat of the current leader renews our read lease, as
+ * long as we are up to date with it.
+ *
+ * @param context - you can ignore this
+ * @param request the leader, its term, its latest entry and commit index
+ * @param response our term, and whether we have the leader's latest entry
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status StaticShardmaster::Replicate(::grpc::ServerContext* context,
+                                            const ::ReplicateRequest* request,
+                                            ::ReplicateResponse* response) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if(request->term() < term) {
+        response->set_term(term);
+        response->set_success(false);
+        return ::grpc::Status::OK;
+    }
+    if(request->term() > term) {
+        StepDown(request->term());
+    }
+    role = Role::FOLLOWER;
+    leader = request->leader();
+    lastHeard = start;
+    // the leader sends to us from several threads, so an entry may arrive
+    // after a later one of the same term, which already holds its change
+    bool stale = request->has_entry() && request->entry().term() == accepted.term() &&
+                 request->entry().index() < accepted.index();
+    if(request->has_entry() && !stale && request->entry().index() >= commitIndex) {
+        accepted = request->entry();
+        Install(accepted);
+        PersistState();
+    }
+    bool upToDate = accepted.index() >= request->last_index() && accepted.term() == request->last_term();
+    if(upToDate && request->commit_index() >= accepted.index() && commitIndex < accepted.index()) {
+        commitIndex = accepted.index();
+        PersistState();
+        Publish(accepted.config());
+    }
+    if(upToDate && commitIndex >= request->commit_index()) {
+        leaseUntil = LeaseFrom(start);
+    }
+    response->set_term(term);
+    response->set_success(upToDate);
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Called by a replica standing for leader. We vote for at most one candidate
+ * per term, and only for one whose latest entry is at least as recent as
+ * ours, so a new leader always has every committed change. While the read
+ * lease we acknowledged to the current leader lasts, which the leader serves
+ * Query under, the candidate is turned away without taking on its term.
+ *
+ * @param context - you can ignore this
+ * @param request the candidate, its term and its latest entry
+ * @param response our term, and whether we voted for the candidate
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status StaticShardmaster::RequestVote(::grpc::ServerContext* context,
+                                              const ::VoteRequest* request,
+                                              ::VoteResponse* response) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    if(HasLease()) {
+        response->set_term(term);
+        response->set_granted(false);
+        return ::grpc::Status::OK;
+    }
+    if(request->term() > term) {
+        StepDown(request->term());
+    }
+    bool upToDate = request->last_term() > accepted.term() ||
+                    (request->last_term() == accepted.term() && request->last_index() >= accepted.index());
+    bool granted = request->term() == term && upToDate &&
+                   (votedFor.empty() || votedFor == request->candidate());
+    if(granted) {
+        votedFor = request->candidate();
+        lastHeard = std::chrono::steady_clock::now();
+        PersistState();
+    }
+    response->set_term(term);
+    response->set_granted(granted);
+    return ::grpc::Status::OK;
+}
+
+::grpc::Status StaticShardmaster::ReplicaStatus(::grpc::ServerContext* context,
+                                                const Empty* request,
+                                                ::ReplicaStatusResponse* response) {
+    std::lock_guard<std::mutex> lock(serverMutex);
+    response->set_leader(leader);
+    response->set_term(term);
+    response->set_commit_index(commitIndex);
+    return ::grpc::Status::OK;
+}
+
+void StaticShardmaster::RunElection(std::unique_lock<std::mutex>& lock) {
+    term++;
+    role = Role::CANDIDATE;
+    votedFor = options.self;
+    leader.clear();
+    lastHeard = std::chrono::steady_clock::now();
+    PersistState();
+    uint64_t electionTerm = term;
+    VoteRequest request;
+    request.set_term(electionTerm);
+    request.set_candidate(options.self);
+    request.set_last_index(accepted.index());
+    request.set_last_term(accepted.term());
+    struct Call {
+        Shardmaster::Stub* stub;
+        bool reached = false;
+        VoteResponse response;
+    };
+    std::vector<Call> calls;
+    for(const auto& peer : options.replicas) {
+        if(peer != options.self) calls.push_back({Peer(peer)});
+    }
+    // never hold the lock across the calls, the others may be asking us
+    lock.unlock();
+    CallEach(calls.size(), [&](size_t i) {
+        ::grpc::ClientContext cc;
+        cc.set_deadline(std::chrono::system_clock::now() + REPLICA_TIMEOUT);
+        calls[i].reached = calls[i].stub->RequestVote(&cc, request, &calls[i].response).ok();
+    });
+    lock.lock();
+    size_t votes = 1;
+    for(const auto& call : calls) {
+        if(!call.reached) continue;
+        if(call.response.term() > term) {
+            StepDown(call.response.term());
+            return;
+        }
+        if(call.response.granted()) votes++;
+    }
+    if(role != Role::CANDIDATE || term != electionTerm || 2 * votes <= options.replicas.size()) {
+        return;
+    }
+    role = Role::LEADER;
+    leader = options.self;
+    matched.clear();
+    // an entry of our own term commits whatever earlier entry we still hold
+    AppendEntry(lock);
+}
+
+void StaticShardmaster::StepDown(uint64_t newTerm) {
+    // whatever lease we held was our old leader's, or our own as leader
+    leaseUntil = 0;
+    // a vote holds for the whole term
+    if(newTerm > term) {
+        term = newTerm;
+        votedFor.clear();
+        leader.clear();
+    }
+    if(role != Role::FOLLOWER) {
+        role = Role::FOLLOWER;
+        leader.clear();
+    }
+    PersistState();
+}
+
+void StaticShardmaster::Install(const LogEntry& entry) {
+    servers.clear();
+    weights.clear();
+    ShardMap shardMap;
+    for(const auto& config : entry.config().config()) {
+        servers.push_back(config.server());
+        auto it = entry.weights().find(config.server());
+        weights[config.server()] = it == entry.weights().end() ? 1 : it->second;
+        auto& shards = shardMap[config.server()];
+        for(const auto& shard : config.shards()) {
+            shards.push_back({shard.lower(), shard.upper()});
+        }
+    }
+    ownership = IntervalMap(shardMap);
+    version = entry.config().version();
+    for(auto it = stats.begin(); it != stats.end();) {
+        it = weights.count(it->first) ? std::next(it) : stats.erase(it);
+    }
+}
+
+void StaticShardmaster::PersistState() {
+    if(options.stateFile.empty()) {
+        return;
+    }
+    ReplicaState state;
+    state.set_term(term);
+    state.set_voted_for(votedFor);
+    *state.mutable_entry() = accepted;
+    state.set_commit_index(commitIndex);
+    // written aside and renamed, so a crash never leaves half a file
+    std::string tmp = options.stateFile + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if(!out || !state.SerializeToOstream(&out)) {
+            std::cerr << "Failed to write " << tmp << std::endl;
+            return;
+        }
+    }
+    if(std::rename(tmp.c_str(), options.stateFile.c_str()) != 0) {
+        std::cerr << "Failed to replace " << options.stateFile << std::endl;
+    }
+}
+
+void StaticShardmaster::LoadState() {
+    if(options.stateFile.empty()) {
+        return;
+    }
+    std::ifstream in(options.stateFile, std::ios::binary);
+    ReplicaState state;
+    if(!in || !state.ParseFromIstream(&in)) {
+        return;
+    }
+    term = state.term();
+    votedFor = state.voted_for();
+    accepted = state.entry();
+    commitIndex = state.commit_index();
+    Install(accepted);
+    if(commitIndex >= accepted.index()) {
+        Publish(accepted.config());
+    }
+}
+
+void StaticShardmaster::ReplicationLoop() {
+    std::mt19937_64 random(std::hash<std::string>()(options.self) ^
+                           std::chrono::steady_clock::now().time_since_epoch().count());
+    auto timeout = [&random]() {
+        std::uniform_int_distribution<int64_t> spread(0, ELECTION_TIMEOUT.count());
+        return ELECTION_TIMEOUT + std::chrono::milliseconds(spread(random));
+    };
+    auto electionTimeout = timeout();
+    while(true) {
+        std::this_thread::sleep_for(HEARTBEAT_INTERVAL);
+        std::unique_lock<std::mutex> lock(serverMutex);
+        auto quiet = std::chrono::steady_clock::now() - lastHeard;
+        if(role == Role::LEADER) {
+            // a leader cut off from the majority stops leading, so it never
+            // serves changes the others don't know about
+            if(!Sync(lock) && role == Role::LEADER &&
+               std::chrono::steady_clock::now() - lastHeard > ELECTION_TIMEOUT) {
+                StepDown(term);
+            }
+        } else if(quiet > electionTimeout) {
+            RunElection(lock);
+            electionTimeout = timeout();
+        }
+    }
+}
+
+Shardmaster::Stub* StaticShardmaster::Peer(const std::string& peer) {
+    auto& stub = peers[peer];
+    if(!stub) {
+        stub = Shardmaster::NewStub(grpc::CreateChannel(peer, grpc::InsecureChannelCredentials()));
+    }
+    return stub.get();
+}
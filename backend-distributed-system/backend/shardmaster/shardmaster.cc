@@ -1,12 +1,52 @@
 #include "shardmaster.h"
 
+#include <thread>
+
+StaticShardmaster::StaticShardmaster(const ShardmasterOptions& opts) : options(opts) {
+    LoadState();
+    if (!Replicated()) {
+        return;
+    }
+    role = Role::FOLLOWER;
+    // This thread sends heartbeats while we lead, and stands for leader once
+    // the leader goes quiet
+    std::thread replication([this]() { ReplicationLoop(); });
+    // we detach the thread so we don't have to wait for it to terminate later
+    replication.detach();
+}
+
+template <typename Request, typename Response>
+::grpc::Status StaticShardmaster::Forward(
+        std::unique_lock<std::mutex>& lock,
+        ::grpc::Status (Shardmaster::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+        const Request& request, Response* response) {
+    std::string to = leader;
+    // never hold the lock across an RPC, the leader may be calling us
+    lock.unlock();
+    if (to.empty()) {
+        return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No leader, try again later");
+    }
+    auto stub = Shardmaster::NewStub(grpc::CreateChannel(to, grpc::InsecureChannelCredentials()));
+    ::grpc::ClientContext cc;
+    cc.set_deadline(std::chrono::system_clock::now() + DEFAULT_RPC_TIMEOUT);
+    return (stub.get()->*call)(&cc, request, response);
+}
+
+::grpc::Status StaticShardmaster::NoLease() {
+    return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "No read lease, try another replica");
+}
+
+::grpc::Status StaticShardmaster::NotCommitted() {
+    return ::grpc::Status(::grpc::StatusCode::UNAVAILABLE, "Change not committed by a majority of replicas");
+}
+
 /**
  * Based on the server specified in JoinRequest, you should update the
  * shardmaster's internal representation that this server has joined. Remember,
  * you get to choose how to represent everything the shardmaster tracks in
- * shardmaster.h! Be sure to rebalance the shards in equal proportions to all
- * the servers. This function should fail if the server already exists in the
- * configuration.
+ * shardmaster.h! Be sure to rebalance the shards in proportion to the weights
+ * of the servers, which are equal unless given on Join. This function should
+ * fail if the server already exists in the configuration.
  *
  * @param context - you can ignore this
  * @param request A message containing the address of a key-value server that's
@@ -19,14 +59,29 @@
 ::grpc::Status StaticShardmaster::Join(::grpc::ServerContext* context,
                                        const ::JoinRequest* request,
                                        Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    if(serverShardMap.find(request->server()) != serverShardMap.end()) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::Join, *request, response);
+    }
+    auto status = ApplyJoin(ownership, servers, weights, request->server(), request->weight());
+    if(status.ok() && !ConfigChanged(lock)) {
+        return NotCommitted();
+    }
+    return status;
+}
+
+::grpc::Status StaticShardmaster::ApplyJoin(IntervalMap& layout, std::vector<std::string>& serverList,
+                                            WeightMap& weightMap, const std::string& server,
+                                            unsigned int weight) {
+    if(weightMap.find(server) != weightMap.end()) {
         return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server already exists");
     }
-    servers.push_back(request->server());
-    std::vector<shard_t> newShardVector;
-    serverShardMap[request->server()] = newShardVector;
-    RebalanceShards(serverShardMap, servers);
+    serverList.push_back(server);
+    weightMap[server] = std::max(weight, 1u);
+    // rebalancing looks at every server anyway, so it works on the per-server form
+    ShardMap shardMap = layout.ToShardMap(serverList);
+    Rebalance(shardMap, serverList, weightMap);
+    layout = IntervalMap(shardMap);
     return ::grpc::Status::OK;
 }
 
@@ -49,19 +104,79 @@
 ::grpc::Status StaticShardmaster::Leave(::grpc::ServerContext* context,
                                         const ::LeaveRequest* request,
                                         Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    for(int i = 0; i < request->servers_size(); i++) {
-        auto it = std::find(servers.begin(), servers.end(), request->servers(i));
-        if(it == servers.end()) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::Leave, *request, response);
+    }
+    auto status = ApplyLeave(ownership, servers, weights, request->servers());
+    if(status.ok()) {
+        for(const auto& server : request->servers()) {
+            stats.erase(server);
+        }
+        if(!ConfigChanged(lock)) {
+            return NotCommitted();
+        }
+    }
+    return status;
+}
+
+::grpc::Status StaticShardmaster::ApplyLeave(IntervalMap& layout, std::vector<std::string>& serverList,
+                                             WeightMap& weightMap,
+                                             const google::protobuf::RepeatedPtrField<std::string>& leaving) {
+    // check everything first, a failed leave must not change the configuration
+    for(const auto& server : leaving) {
+        if(weightMap.find(server) == weightMap.end()) {
             return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server doesn't exist!");
         }
-        serverShardMap.erase(request->servers(i));
-        servers.erase(it);
     }
-    RebalanceShards(serverShardMap, servers);
+    for(const auto& server : leaving) {
+        auto it = std::find(serverList.begin(), serverList.end(), server);
+        if(it == serverList.end()) {
+            continue;
+        }
+        weightMap.erase(server);
+        serverList.erase(it);
+    }
+    // the shards of the leaving servers are left out, so they are up for grabs
+    ShardMap shardMap = layout.ToShardMap(serverList);
+    Rebalance(shardMap, serverList, weightMap);
+    layout = IntervalMap(shardMap);
     return ::grpc::Status::OK;
 }
 
+void StaticShardmaster::Rebalance(ShardMap& shardMap, const std::vector<std::string>& serverList,
+                                  const WeightMap& weightMap) {
+    if(serverList.empty()) {
+        return;
+    }
+    std::vector<unsigned int> serverWeights;
+    for(const auto& server : serverList) {
+        auto it = weightMap.find(server);
+        serverWeights.push_back(it == weightMap.end() ? 1 : it->second);
+    }
+    if(options.rebalance == RebalanceMode::MINIMAL) {
+        RebalanceShardsMinimal(shardMap, serverList, serverWeights, options.maxKey);
+        return;
+    }
+    std::vector<key_cost_t> costs;
+    double totalLoad = 0;
+    if(options.loadAware) {
+        costs = KeyLoads();
+        for(const auto& range : costs) totalLoad += range.per_key * static_cast<double>(size({range.lower, range.upper}));
+    }
+    if(totalLoad == 0) {
+        RebalanceShardsWeighted(shardMap, serverList, serverWeights, options.maxKey);
+        return;
+    }
+    // a key costs its share of the keys plus its share of the load, so busy
+    // ranges are spread thin without piling all the idle keys on one server
+    double numKeys = static_cast<double>(options.maxKey - MIN_KEY) + 1;
+    for(auto& range : costs) {
+        range.per_key = 1.0 / numKeys + range.per_key / totalLoad;
+    }
+    RebalanceShardsByCost(shardMap, serverList, serverWeights, costs, options.maxKey);
+}
+
 /**
  * Move the specified shard to the target server (passed in MoveRequest) in the
  * shardmaster's internal representation of which server has which shard. Note
@@ -80,32 +195,28 @@
 ::grpc::Status StaticShardmaster::Move(::grpc::ServerContext* context,
                                        const ::MoveRequest* request,
                                        Empty* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    auto serverIt = serverShardMap.find(request->server());
-    if(serverIt == serverShardMap.end()) {
-        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server doesn't exist. Move Error!");
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::Move, *request, response);
     }
     shard_t shardToMove = {request->shard().lower(), request->shard().upper()};
-    for(auto& serverShards : serverShardMap) {
-        std::vector<shard_t>& shards = serverShards.second;
-        std::vector<shard_t> newShardVector;
-        for(const auto& shard : shards) {
-            auto overlapStatus = get_overlap(shard, shardToMove);
-            if(overlapStatus == OverlapStatus::OVERLAP_START) {
-                newShardVector.push_back({shardToMove.upper + 1, shard.upper});
-            } else if(overlapStatus == OverlapStatus::OVERLAP_END) {
-                newShardVector.push_back({shard.lower, shardToMove.lower - 1});
-            } else if(overlapStatus == OverlapStatus::COMPLETELY_CONTAINS) {
-                newShardVector.push_back({shard.lower, shardToMove.lower - 1});
-                newShardVector.push_back({shardToMove.upper + 1, shard.upper});
-            } else if (overlapStatus == OverlapStatus::NO_OVERLAP) {
-                newShardVector.push_back(shard);
-            }
-        }
-        shards = std::move(newShardVector);
-    }
-    serverShardMap[request->server()].push_back(shardToMove);
-    sortAscendingInterval(serverShardMap[request->server()]);
+    auto status = ApplyMove(ownership, weights, request->server(), shardToMove);
+    if(status.ok() && !ConfigChanged(lock)) {
+        return NotCommitted();
+    }
+    return status;
+}
+
+::grpc::Status StaticShardmaster::ApplyMove(IntervalMap& layout, const WeightMap& weightMap,
+                                            const std::string& server, const shard_t& shardToMove) {
+    if(weightMap.find(server) == weightMap.end()) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server doesn't exist. Move Error!");
+    }
+    if(shardToMove.lower > shardToMove.upper || shardToMove.upper > options.maxKey) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Invalid shard. Move Error!");
+    }
+    // only the intervals overlapping the shard are touched
+    layout.Assign(shardToMove, server);
     return ::grpc::Status::OK;
 }
 
@@ -116,6 +227,10 @@
  * that its a list of ConfigEntry, which is a struct that has a server's address
  * and a list of the shards its currently responsible for.
  *
+ * A replica of a replicated shardmaster answers from its own copy, but only
+ * while its read lease from the leader lasts, so a replica that lost touch
+ * with the others stops serving an outdated configuration.
+ *
  * @param context - you can ignore this
  * @param request An empty message, as we don't need to send any data
  * @param response A message that specifies which shards are on which servers
@@ -126,15 +241,450 @@
 ::grpc::Status StaticShardmaster::Query(::grpc::ServerContext* context,
                                         const StaticShardmaster::Empty* request,
                                         ::QueryResponse* response) {
-    std::lock_guard<std::mutex> lock(serverMutex);
-    for(const auto& server : servers) {
-        auto configEntry = response->add_config();
+    if(!HasLease()) {
+        return NoLease();
+    }
+    // the snapshot is only replaced, never modified, so no lock is needed
+    response->CopyFrom(*Snapshot());
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Streams the configuration to the caller every time it changes, starting
+ * right away if it changed since the version the caller last saw. A caller
+ * ahead of us (we restarted and lost our history) gets the current
+ * configuration too. The stream ends when the caller goes away, or, like
+ * Query, once a replica's read lease runs out, so the caller moves on to
+ * another replica.
+ *
+ * @param context used to notice that the caller went away
+ * @param request the last version the caller has seen
+ * @param writer the stream we send configurations on
+ * @return ::grpc::Status::OK on success, UNAVAILABLE without a read lease, or
+ * ::grpc::Status(::grpc::StatusCode::CANCELLED, "<your error message here>")
+ */
+::grpc::Status StaticShardmaster::Watch(::grpc::ServerContext* context,
+                                        const ::WatchRequest* request,
+                                        ::grpc::ServerWriter<::QueryResponse>* writer) {
+    uint64_t sent = request->from_version();
+    std::unique_lock<std::mutex> lock(serverMutex);
+    while (!context->IsCancelled()) {
+        if (!HasLease()) {
+            return NoLease();
+        }
+        if (Snapshot()->version() == sent) {
+            configChanged.wait_for(lock, WATCH_POLL);
+            continue;
+        }
+        auto current = Snapshot();
+        sent = current->version();
+        // never hold the lock while the caller reads, it may be slow
+        lock.unlock();
+        if (!writer->Write(*current)) {
+            return ::grpc::Status::OK;
+        }
+        lock.lock();
+    }
+    return ::grpc::Status(::grpc::StatusCode::CANCELLED, "Watch cancelled");
+}
+
+bool StaticShardmaster::ConfigChanged(std::unique_lock<std::mutex>& lock) {
+    version++;
+    if(!Replicated() && options.stateFile.empty()) {
+        Publish(CurrentConfig());
+        return true;
+    }
+    return AppendEntry(lock);
+}
+
+::QueryResponse StaticShardmaster::CurrentConfig() {
+    ::QueryResponse response;
+    AddConfigEntries(ownership, servers, response.mutable_config());
+    response.set_version(version);
+    response.set_max_key(options.maxKey);
+    response.set_partitioning(static_cast<QueryResponse::Partitioning>(options.partitioning));
+    return response;
+}
+
+void StaticShardmaster::Publish(::QueryResponse config) {
+    std::atomic_store(&snapshot, std::shared_ptr<const ::QueryResponse>(
+            std::make_shared<::QueryResponse>(std::move(config))));
+    configChanged.notify_all();
+}
+
+/**
+ * Records the request counts a group reports for its keys, then uses them to
+ * rebalance: every shard of that group above HOT_THRESH is split and a piece
+ * handed to the least loaded group, and neighbouring shards of the group that
+ * are both below COLD_THRESH are merged back together.
+ *
+ * @param context - you can ignore this
+ * @param request the reporting group and its request counts per range
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status StaticShardmaster::ReportLoad(::grpc::ServerContext* context,
+                                             const ::LoadReport* request,
+                                             Empty* response) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::ReportLoad, *request, response);
+    }
+    if(weights.find(request->server()) == weights.end()) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Server doesn't exist!");
+    }
+    for(const auto& range : request->ranges()) {
+        if(range.shard().lower() > range.shard().upper()) {
+            return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Invalid range");
+        }
+    }
+    stats[request->server()] = {request->bytes(), request->cpu_percent()};
+    for(const auto& range : request->ranges()) {
+        uint64_t lower = range.shard().lower();
+        uint64_t upper = range.shard().upper();
+        // drop whatever older figures overlap this range
+        auto first = loads.lower_bound(lower);
+        if(first != loads.begin() && std::prev(first)->second.upper >= lower) {
+            --first;
+        }
+        loads.erase(first, loads.upper_bound(upper));
+        loads[lower] = {upper, range.requests()};
+    }
+
+    bool changed = false;
+    // split works on a copy, it changes the server's shards as it goes
+    std::vector<shard_t> shards = ownership.Shards(request->server());
+    for(const auto& shard : shards) {
+        if(ShardLoad(shard) > HOT_THRESH) {
+            changed |= SplitHotShard(request->server(), shard);
+        }
+    }
+    changed |= MergeColdShards(request->server());
+    if(changed && !ConfigChanged(lock)) {
+        return NotCommitted();
+    }
+    return ::grpc::Status::OK;
+}
+
+uint64_t StaticShardmaster::ShardLoad(const shard_t& shard) {
+    uint64_t total = 0;
+    for(auto it = loads.lower_bound(shard.lower); it != loads.end() && it->first <= shard.upper; ++it) {
+        total += it->second.requests;
+    }
+    return total;
+}
+
+uint64_t StaticShardmaster::ServerLoad(const std::string& server) {
+    uint64_t total = 0;
+    for(const auto& shard : ownership.Shards(server)) {
+        total += ShardLoad(shard);
+    }
+    return total;
+}
+
+std::vector<key_cost_t> StaticShardmaster::KeyLoads() {
+    std::vector<key_cost_t> keyLoads;
+    uint64_t next = MIN_KEY;
+    for(const auto& [lower, bucket] : loads) {
+        if(lower > options.maxKey) break;
+        uint64_t upper = std::min(bucket.upper, options.maxKey);
+        if(lower > next) keyLoads.push_back({next, lower - 1, 0});
+        keyLoads.push_back({lower, upper, static_cast<double>(bucket.requests) / static_cast<double>(size({lower, upper}))});
+        next = upper + 1;
+        if(upper == options.maxKey) return keyLoads;
+    }
+    keyLoads.push_back({next, options.maxKey, 0});
+    return keyLoads;
+}
+
+bool StaticShardmaster::LessBusy(const std::string& candidate, const std::string& best) {
+    if(best.empty()) {
+        return true;
+    }
+    // compare load / weight without dividing
+    uint64_t candidateLoad = ServerLoad(candidate) * weights[best];
+    uint64_t bestLoad = ServerLoad(best) * weights[candidate];
+    if(candidateLoad != bestLoad) {
+        return candidateLoad < bestLoad;
+    }
+    if(stats[candidate].cpuPercent != stats[best].cpuPercent) {
+        return stats[candidate].cpuPercent < stats[best].cpuPercent;
+    }
+    return stats[candidate].bytes * weights[best] < stats[best].bytes * weights[candidate];
+}
+
+bool StaticShardmaster::HasLoad(const shard_t& shard) {
+    auto it = loads.lower_bound(shard.lower);
+    return it != loads.end() && it->first <= shard.upper;
+}
+
+bool StaticShardmaster::SplitHotShard(const std::string& server, const shard_t& shard) {
+    // split at the reported range boundary that halves the load best
+    uint64_t total = ShardLoad(shard);
+    uint64_t left = 0;
+    uint64_t bestLeft = 0;
+    uint64_t bestDiff = UINT64_MAX;
+    uint64_t splitAt = shard.upper;
+    for(auto it = loads.lower_bound(shard.lower); it != loads.end() && it->first <= shard.upper; ++it) {
+        if(it->second.upper >= shard.upper) {
+            break;
+        }
+        left += it->second.requests;
+        uint64_t diff = 2 * left > total ? 2 * left - total : total - 2 * left;
+        if(diff < bestDiff) {
+            bestDiff = diff;
+            bestLeft = left;
+            splitAt = it->second.upper;
+        }
+    }
+    if(splitAt == shard.upper) {
+        return false;
+    }
+
+    std::string target;
+    for(const auto& candidate : servers) {
+        if(candidate == server) continue;
+        if(LessBusy(candidate, target)) {
+            target = candidate;
+        }
+    }
+    if(target.empty()) {
+        return false;
+    }
+
+    // hand over whichever piece leaves the busier of the two groups (relative
+    // to their capacity) least loaded, the upper one on a tie. only if that is
+    // an improvement, so a single hot key never bounces between groups
+    shard_t lowerPiece = {shard.lower, splitAt};
+    shard_t upperPiece = {splitAt + 1, shard.upper};
+    double ownWeight = weights[server];
+    double targetWeight = weights[target];
+    uint64_t load = ServerLoad(server);
+    uint64_t targetLoad = ServerLoad(target);
+    double giveLower = std::max((load - bestLeft) / ownWeight, (targetLoad + bestLeft) / targetWeight);
+    double giveUpper = std::max((load - (total - bestLeft)) / ownWeight,
+                                (targetLoad + (total - bestLeft)) / targetWeight);
+    bool lower = giveLower < giveUpper;
+    if(std::min(giveLower, giveUpper) >= load / ownWeight) {
+        return false;
+    }
+
+    // the piece we keep stays a shard of its own
+    ownership.Assign(lower ? lowerPiece : upperPiece, target);
+    return true;
+}
+
+bool StaticShardmaster::MergeColdShards(const std::string& server) {
+    std::vector<shard_t> shards = ownership.Shards(server);
+    std::vector<shard_t> merged;
+    for(const auto& shard : shards) {
+        if(!merged.empty() && merged.back().upper + 1 == shard.lower &&
+           HasLoad(merged.back()) && HasLoad(shard) &&
+           ShardLoad(merged.back()) < COLD_THRESH && ShardLoad(shard) < COLD_THRESH) {
+            merged.back().upper = shard.upper;
+        } else {
+            merged.push_back(shard);
+        }
+    }
+    if(merged.size() == shards.size()) {
+        return false;
+    }
+    for(const auto& shard : merged) {
+        ownership.Assign(shard, server);
+    }
+    return true;
+}
+
+/**
+ * Works out what the given joins followed by the given leaves would do to the
+ * configuration, without changing anything. Used by operators to check how
+ * much data a change would move before making it.
+ *
+ * @param context - you can ignore this
+ * @param request the servers that would join, and the ones that would leave
+ * @param response the resulting configuration and the number of keys moved
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status StaticShardmaster::PlanRebalance(::grpc::ServerContext* context,
+                                                const ::PlanRequest* request,
+                                                ::PlanResponse* response) {
+    // planning reads the load figures, so it works on the copies with the lock
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::PlanRebalance, *request, response);
+    }
+    IntervalMap plannedShards = ownership;
+    std::vector<std::string> plannedServers = servers;
+    WeightMap plannedWeights = weights;
+    for(const auto& server : request->joins()) {
+        auto it = request->weights().find(server);
+        unsigned int weight = it == request->weights().end() ? 1 : it->second;
+        auto status = ApplyJoin(plannedShards, plannedServers, plannedWeights, server, weight);
+        if(!status.ok()) return status;
+    }
+    if(request->leaves_size() > 0) {
+        auto status = ApplyLeave(plannedShards, plannedServers, plannedWeights, request->leaves());
+        if(!status.ok()) return status;
+    }
+    response->set_keys_moved(countMovedKeys(ownership.ToShardMap(servers), plannedShards.ToShardMap(plannedServers)));
+    AddConfigEntries(plannedShards, plannedServers, response->mutable_config());
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Applies a list of joins, leaves and moves as one change. The steps run in
+ * order on a copy of the configuration, which replaces ours only once all of
+ * them succeeded, so watchers see one new version and the shardkv servers
+ * move their keys straight to the final layout.
+ *
+ * @param context - you can ignore this
+ * @param request the steps, and whether to only report what they would do
+ * @param response the resulting configuration, its version and the number of
+ * keys that change server
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status StaticShardmaster::Reconfigure(::grpc::ServerContext* context,
+                                              const ::ReconfigureRequest* request,
+                                              ::ReconfigureResponse* response) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::Reconfigure, *request, response);
+    }
+    IntervalMap newShards = ownership;
+    std::vector<std::string> newServers = servers;
+    WeightMap newWeights = weights;
+    for(int i = 0; i < request->steps_size(); i++) {
+        const auto& step = request->steps(i);
+        ::grpc::Status status;
+        switch(step.step_case()) {
+            case ReconfigureStep::kJoin:
+                status = ApplyJoin(newShards, newServers, newWeights, step.join().server(), step.join().weight());
+                break;
+            case ReconfigureStep::kLeave:
+                status = ApplyLeave(newShards, newServers, newWeights, step.leave().servers());
+                break;
+            case ReconfigureStep::kMove:
+                status = ApplyMove(newShards, newWeights, step.move().server(),
+                                   {step.move().shard().lower(), step.move().shard().upper()});
+                break;
+            default:
+                status = ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Empty step");
+        }
+        if(!status.ok()) {
+            return ::grpc::Status(status.error_code(), "Step " + std::to_string(i) + ": " + status.error_message());
+        }
+    }
+    response->set_keys_moved(countMovedKeys(ownership.ToShardMap(servers), newShards.ToShardMap(newServers)));
+    AddConfigEntries(newShards, newServers, response->mutable_config());
+    if(!request->dry_run() && request->steps_size() > 0) {
+        for(auto it = stats.begin(); it != stats.end();) {
+            it = newWeights.count(it->first) ? std::next(it) : stats.erase(it);
+        }
+        ownership = std::move(newShards);
+        servers = std::move(newServers);
+        weights = std::move(newWeights);
+        // other changes may be made while this one is replicated
+        uint64_t changedTo = version + 1;
+        if(!ConfigChanged(lock)) {
+            return NotCommitted();
+        }
+        response->set_version(changedTo);
+        return ::grpc::Status::OK;
+    }
+    response->set_version(version);
+    return ::grpc::Status::OK;
+}
+
+void StaticShardmaster::AddConfigEntries(const IntervalMap& layout, const std::vector<std::string>& serverList,
+                                         google::protobuf::RepeatedPtrField<ConfigEntry>* entries) {
+    ShardMap shardMap = layout.ToShardMap(serverList);
+    for(const auto& server : serverList) {
+        auto configEntry = entries->Add();
         configEntry->set_server(server);
-        for(const auto& shard : serverShardMap[server]) {
+        for(const auto& shard : shardMap[server]) {
             auto shardEntry = configEntry->add_shards();
             shardEntry->set_lower(shard.lower);
             shardEntry->set_upper(shard.upper);
         }
     }
+}
+
+/**
+ * Starts purging a user: the user, its post list and every post in it are
+ * deleted from whichever groups hold them, see PurgeUser. Returns as soon as
+ * the purge is started, its progress is reported by GDPRStatus. Asking again
+ * while a purge of the user runs does not start a second one; asking again
+ * once it finished runs it again, which picks up anything it missed.
+ *
+ * @param context - you can ignore this
+ * @param request the user to purge, e.g. user_5
+ * @param response An empty message, as we don't need to return any data
+ * @return ::grpc::Status::OK on success, or
+ * ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "<your error message
+ * here>")
+ */
+::grpc::Status StaticShardmaster::GDPRDelete(::grpc::ServerContext* context,
+                                             const ::GDPRDeleteRequest* request,
+                                             Empty* response) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::GDPRDelete, *request, response);
+    }
+    lock.unlock();
+    const std::string& user = request->key();
+    const std::string postsSuffix = "_posts";
+    uint64_t position;
+    if(user.rfind("user_", 0) != 0 ||
+       (user.size() > postsSuffix.size() &&
+        user.compare(user.size() - postsSuffix.size(), postsSuffix.size(), postsSuffix) == 0) ||
+       !keyPosition(user, options.partitioning, options.maxKey, &position)) {
+        return ::grpc::Status(::grpc::StatusCode::INVALID_ARGUMENT, "Not a user");
+    }
+    {
+        std::lock_guard<std::mutex> gdprLock(gdprMutex);
+        auto& purge = purges[user];
+        if(purge.state() == GDPRStatusResponse::RUNNING) {
+            return ::grpc::Status::OK;
+        }
+        purge.Clear();
+        purge.set_state(GDPRStatusResponse::RUNNING);
+    }
+    std::thread purge([this, user]() { PurgeUser(user); });
+    // we detach the thread so we don't have to wait for it to terminate later
+    purge.detach();
+    return ::grpc::Status::OK;
+}
+
+/**
+ * Reports how the latest purge of a user started by GDPRDelete is going.
+ * Purges are tracked in the memory of the leader that runs them and are not
+ * replicated, so after a failover or restart the new leader reports UNKNOWN,
+ * and a purge it was running is lost. Calling GDPRDelete again runs it again,
+ * which picks up whatever the lost one missed.
+ *
+ * @param context - you can ignore this
+ * @param request the user
+ * @param response the state of the purge and how many keys it deleted so far
+ * @return ::grpc::Status::OK
+ */
+::grpc::Status StaticShardmaster::GDPRStatus(::grpc::ServerContext* context,
+                                             const ::GDPRDeleteRequest* request,
+                                             ::GDPRStatusResponse* response) {
+    std::unique_lock<std::mutex> lock(serverMutex);
+    if(!Leads()) {
+        return Forward(lock, &Shardmaster::Stub::GDPRStatus, *request, response);
+    }
+    lock.unlock();
+    std::lock_guard<std::mutex> gdprLock(gdprMutex);
+    auto it = purges.find(request->key());
+    if(it != purges.end()) {
+        *response = it->second;
+    }
     return ::grpc::Status::OK;
 }
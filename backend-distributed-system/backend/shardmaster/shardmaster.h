@@ -2,18 +2,62 @@
 #define SHARDING_SHARDMASTER_H
 
 #include "../common/common.h"
+#include "../common/interval_map.h"
+#include "../common/key_hash.h"
+#include "../common/rpc.h"
 
 #include <grpcpp/grpcpp.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include <mutex>
 #include "../build/shardmaster.grpc.pb.h"
 
+// how Join and Leave spread the keys over the servers
+enum class RebalanceMode {
+  // every server gets one contiguous slice, in join order. simple, but a join
+  // or leave moves almost every key
+  EVEN,
+  // servers keep their keys unless they hold more than their share, so only
+  // the keys needed to even things out move
+  MINIMAL
+};
+
+// tunables of the shardmaster, see shardmaster/main.cc for the matching flags
+struct ShardmasterOptions {
+  RebalanceMode rebalance = RebalanceMode::EVEN;
+  // in EVEN mode, slice by reported load as well as by key count, so servers
+  // get fewer keys where they are busy
+  bool loadAware = false;
+  // keys are [MIN_KEY, maxKey], at most MAX_KEY_LIMIT
+  uint64_t maxKey = MAX_KEY;
+  // how keys are placed, published with every configuration. HASH lets keys
+  // of any form be stored, AFFINITY keeps tagged keys with their owner
+  Partitioning partitioning = Partitioning::ID;
+  // addresses of all replicas of a replicated shardmaster, this one included.
+  // empty, or just one address, for a standalone shardmaster
+  std::vector<std::string> replicas;
+  // our own address as it appears in replicas
+  std::string self;
+  // where the configuration is kept across restarts, nowhere if empty
+  std::string stateFile;
+};
+
 class StaticShardmaster : public Shardmaster::Service {
   using Empty = google::protobuf::Empty;
+  using ShardMap = std::unordered_map<std::string, std::vector<shard_t>>;
+  using WeightMap = std::unordered_map<std::string, unsigned int>;
 
  public:
+  explicit StaticShardmaster(const ShardmasterOptions& opts = ShardmasterOptions());
+
   // TODO implement these four methods!
   ::grpc::Status Join(::grpc::ServerContext* context,
                       const ::JoinRequest* request, Empty* response) override;
@@ -23,11 +67,216 @@ class StaticShardmaster : public Shardmaster::Service {
                       const ::MoveRequest* request, Empty* response) override;
   ::grpc::Status Query(::grpc::ServerContext* context, const Empty* request,
                        ::QueryResponse* response) override;
+  ::grpc::Status Watch(::grpc::ServerContext* context,
+                       const ::WatchRequest* request,
+                       ::grpc::ServerWriter<::QueryResponse>* writer) override;
+  ::grpc::Status ReportLoad(::grpc::ServerContext* context,
+                            const ::LoadReport* request, Empty* response) override;
+  ::grpc::Status PlanRebalance(::grpc::ServerContext* context,
+                               const ::PlanRequest* request,
+                               ::PlanResponse* response) override;
+  ::grpc::Status Reconfigure(::grpc::ServerContext* context,
+                             const ::ReconfigureRequest* request,
+                             ::ReconfigureResponse* response) override;
+  ::grpc::Status Replicate(::grpc::ServerContext* context,
+                           const ::ReplicateRequest* request,
+                           ::ReplicateResponse* response) override;
+  ::grpc::Status RequestVote(::grpc::ServerContext* context,
+                             const ::VoteRequest* request,
+                             ::VoteResponse* response) override;
+  ::grpc::Status ReplicaStatus(::grpc::ServerContext* context, const Empty* request,
+                               ::ReplicaStatusResponse* response) override;
+  ::grpc::Status GDPRDelete(::grpc::ServerContext* context,
+                            const ::GDPRDeleteRequest* request, Empty* response) override;
+  ::grpc::Status GDPRStatus(::grpc::ServerContext* context,
+                            const ::GDPRDeleteRequest* request,
+                            ::GDPRStatusResponse* response) override;
+
+  // how often an idle watch checks whether its caller went away
+  static constexpr std::chrono::milliseconds WATCH_POLL{500};
+
+  // How often the leader of a replicated shardmaster sends heartbeats
+  static constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{100};
+  // How long a replica waits for a heartbeat before it stands for leader,
+  // picked at random between this and twice this for every attempt
+  static constexpr std::chrono::milliseconds ELECTION_TIMEOUT{500};
+  // How long a heartbeat lets a replica serve Query. shorter than
+  // ELECTION_TIMEOUT, so leases have run out before a new leader takes over
+  static constexpr std::chrono::milliseconds READ_LEASE{400};
+  // Longest a single call to another replica may take
+  static constexpr std::chrono::milliseconds REPLICA_TIMEOUT{100};
+
+  // Number of keys a GDPR purge deletes per call to a group
+  static constexpr size_t GDPR_BATCH = 256;
+  // Attempts at every call to a group before a GDPR purge fails, the wait
+  // between them picked at random up to GDPR_RETRY_DELAY, doubling every time
+  static constexpr int GDPR_ATTEMPTS = 8;
+  static constexpr std::chrono::milliseconds GDPR_RETRY_DELAY{50};
+  // Longest a single call to a group may take during a GDPR purge
+  static constexpr std::chrono::milliseconds GDPR_TIMEOUT{2000};
 
  private:
+  // the current configuration, safe to call without serverMutex
+  std::shared_ptr<const ::QueryResponse> Snapshot() const { return std::atomic_load(&snapshot); }
+  // bumps the version and, once a majority of replicas has it, rebuilds the
+  // snapshot and wakes up watchers. must be called with lock holding
+  // serverMutex after every change, it is released while the change is sent
+  // to the other replicas. returns false if the change could not be committed,
+  // in which case the configuration is back to the one before it, unless
+  // another change went out on top of it meanwhile
+  bool ConfigChanged(std::unique_lock<std::mutex>& lock);
+  // the error a change that was not committed fails with
+  static ::grpc::Status NotCommitted();
+  // the error Query and Watch fail with without a read lease
+  static ::grpc::Status NoLease();
+  // the configuration in ownership, servers and weights as served by Query
+  ::QueryResponse CurrentConfig();
+
+  // the following are in replication.cc and must be called with serverMutex
+  // held unless noted otherwise
+  bool Replicated() const { return options.replicas.size() > 1; }
+  bool Leads() const { return role == Role::LEADER; }
+  // whether Query and Watch may be served from our snapshot: always when
+  // standalone, only while our read lease lasts otherwise. safe to call
+  // without serverMutex
+  bool HasLease() const {
+    return !Replicated() || std::chrono::steady_clock::now().time_since_epoch().count() < leaseUntil.load();
+  }
+  // hands a change to the leader, releasing lock for the duration of the call
+  template <typename Request, typename Response>
+  ::grpc::Status Forward(std::unique_lock<std::mutex>& lock,
+                         ::grpc::Status (Shardmaster::Stub::*call)(::grpc::ClientContext*, const Request&, Response*),
+                         const Request& request, Response* response);
+  // makes a new log entry of the current configuration and commits it, or
+  // puts the previous configuration back if it can't
+  bool AppendEntry(std::unique_lock<std::mutex>& lock);
+  // sends our latest entry, or just a heartbeat, to every other replica at
+  // once, releasing lock while the calls are out. commits the entry and
+  // extends our read lease if a majority has it. returns false if no
+  // majority could be reached or we stopped leading meanwhile
+  bool Sync(std::unique_lock<std::mutex>& lock);
+  // stands for leader, releasing lock while asking the others for votes
+  void RunElection(std::unique_lock<std::mutex>& lock);
+  // adopts a term at least as high as ours seen from another replica, or
+  // gives up leading in ours
+  void StepDown(uint64_t newTerm);
+  // makes the configuration in entry ours, without publishing it
+  void Install(const LogEntry& entry);
+  // serves config to Query and Watch
+  void Publish(::QueryResponse config);
+  void PersistState();
+  void LoadState();
+  // heartbeats and elections, runs in its own thread. never returns
+  void ReplicationLoop();
+  Shardmaster::Stub* Peer(const std::string& peer);
+
+  // the following are in gdpr.cc and run without serverMutex
+  // deletes user, every post in its post list and the list itself from the
+  // groups holding them, recording progress in purges. runs in its own thread
+  void PurgeUser(const std::string& user);
+  // deletes keys at the groups owning them in config, in parallel across
+  // groups and in batches of GDPR_BATCH. returns false if a group could not
+  // be reached or turned keys away as no longer its own
+  bool DeleteEverywhere(const std::string& user, const ::QueryResponse& config,
+                        const std::vector<std::string>& keys);
+  // records the outcome of the purge of user
+  void FinishPurge(const std::string& user, GDPRStatusResponse::State state,
+                   const std::string& error = "");
+
+  // join, leave and move on the given layout, which is either ours or a copy
+  // used for planning. serverMutex must be held either way, load figures are
+  // used. weightMap has an entry for every server in the layout
+  ::grpc::Status ApplyJoin(IntervalMap& layout, std::vector<std::string>& serverList,
+                           WeightMap& weightMap, const std::string& server,
+                           unsigned int weight);
+  ::grpc::Status ApplyLeave(IntervalMap& layout, std::vector<std::string>& serverList,
+                            WeightMap& weightMap,
+                            const google::protobuf::RepeatedPtrField<std::string>& leaving);
+  ::grpc::Status ApplyMove(IntervalMap& layout, const WeightMap& weightMap,
+                           const std::string& server, const shard_t& shardToMove);
+  // spreads the keys over serverList as configured in options
+  void Rebalance(ShardMap& shardMap, const std::vector<std::string>& serverList,
+                 const WeightMap& weightMap);
+  // adds one entry per server of the given layout to entries
+  static void AddConfigEntries(const IntervalMap& layout, const std::vector<std::string>& serverList,
+                               google::protobuf::RepeatedPtrField<ConfigEntry>* entries);
+
+  // the following must be called with serverMutex held
+  // requests reported for the keys in shard
+  uint64_t ShardLoad(const shard_t& shard);
+  // requests reported for all the keys of server
+  uint64_t ServerLoad(const std::string& server);
+  // requests reported per key, spread evenly over each reported range, for
+  // the whole key space
+  std::vector<key_cost_t> KeyLoads();
+  // true if candidate is a better home for extra load than best: less load
+  // per unit of capacity, then less CPU, then less data per unit of capacity
+  bool LessBusy(const std::string& candidate, const std::string& best);
+  // true if we have load figures for any key in shard
+  bool HasLoad(const shard_t& shard);
+  // splits a hot shard of server and hands one piece to the least loaded
+  // group, if that lowers the load of the busier of the two. returns whether
+  // the configuration changed
+  bool SplitHotShard(const std::string& server, const shard_t& shard);
+  // merges neighbouring cold shards of server, returns whether the
+  // configuration changed
+  bool MergeColdShards(const std::string& server);
+
+  const ShardmasterOptions options;
   std::mutex serverMutex;
-  std::unordered_map<std::string, std::vector<shard_t>> serverShardMap;
+  std::condition_variable configChanged;
+  // version of the configuration in ownership, servers and weights. it is
+  // only served once committed, see snapshot
+  uint64_t version = 0;
+  // Immutable copy of the configuration at `version`, served by Query and
+  // Watch without taking serverMutex. Only accessed through
+  // std::atomic_load/std::atomic_store
+  std::shared_ptr<const ::QueryResponse> snapshot = std::make_shared<const ::QueryResponse>();
+
+  struct LoadBucket {
+    uint64_t upper;
+    uint64_t requests;
+  };
+  // latest reported request counts, keyed by the lower end of their range
+  std::map<uint64_t, LoadBucket> loads;
+  struct ServerStats {
+    uint64_t bytes = 0;
+    uint32_t cpuPercent = 0;
+  };
+  // latest reported data size and CPU use of each server
+  std::unordered_map<std::string, ServerStats> stats;
+  // capacity of each server as given on Join, 1 by default. has an entry for
+  // every server, so it doubles as the set of servers
+  WeightMap weights;
+  // which server owns which keys
+  IntervalMap ownership;
+  // in join order
   std::vector<std::string> servers;
+
+  enum class Role { FOLLOWER, CANDIDATE, LEADER };
+  // a standalone shardmaster always leads
+  Role role = Role::LEADER;
+  uint64_t term = 0;
+  std::string votedFor;
+  // empty while we don't know of any
+  std::string leader;
+  // our latest entry, it holds the configuration in ownership, servers and
+  // weights. only kept when replicated or persisted
+  LogEntry accepted;
+  // index of the latest entry a majority of replicas has
+  uint64_t commitIndex = 0;
+  // leader only: the index of the latest entry each replica has
+  std::unordered_map<std::string, uint64_t> matched;
+  std::unordered_map<std::string, std::unique_ptr<Shardmaster::Stub>> peers;
+  std::chrono::steady_clock::time_point lastHeard = std::chrono::steady_clock::now();
+  // progress of every GDPR purge started here, by user. guarded by gdprMutex
+  // rather than serverMutex, purges run for a while and never change the
+  // configuration. only kept in memory and not replicated, see GDPRStatus
+  std::mutex gdprMutex;
+  std::map<std::string, GDPRStatusResponse> purges;
+  // until when Query may be served from our snapshot, in steady_clock ticks.
+  // atomic so Query can check it without serverMutex
+  std::atomic<std::chrono::steady_clock::rep> leaseUntil{0};
 };
 
 #endif  // SHARDING_SHARDMASTER_H
@@ -26,6 +26,12 @@ void start_shardmanager(const std::string& addr, const std::string& shardmaster_
             const std::string&>(addr, addr, shardmaster_addr);
 }
 
+void start_shardmanager(const std::string& addr, const std::string& shardmaster_addr,
+                        const ShardkvManagerOptions& options) {
+    spawn_service_in_thread<ShardkvManager, const std::string&,
+            const std::string&, const ShardkvManagerOptions&>(addr, addr, shardmaster_addr, options);
+}
+
 void start_shardkvs(const Addrs& addrs, const std::string& shardmaster_addr) {
   for (const std::string& addr : addrs) {
     start_shardkv(addr, shardmaster_addr);
@@ -40,6 +46,14 @@ void start_shardkv(const std::string& addr,
                           const std::string&>(addr, addr, shardmaster_addr);
 }
 
+void start_shardkv(const std::string& addr,
+                   const std::string& shardmaster_addr,
+                   const ShardkvOptions& options) {
+  spawn_service_in_thread<ShardkvServer, const std::string&,
+                          const std::string&, const ShardkvOptions&>(
+      addr, addr, shardmaster_addr, options);
+}
+
 std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
                                        const std::string& shardmaster_addr) {
   std::vector<pid_t> pids;
@@ -74,10 +88,302 @@ pid_t start_shardkv_proc(const std::string& addr,
   return pid;
 }
 
+pid_t start_shardmaster_proc(const std::string& addr, const Addrs& replicas) {
+  std::string list;
+  for (const auto& replica : replicas) {
+    list += (list.empty() ? "" : ",") + replica;
+  }
+  std::string port = split(addr, ':')[1];
+  std::string replicasFlag = "--replicas=" + list;
+  pid_t pid = fork();
+  assert(pid != -1);
+  if (!pid) {
+    std::vector<char*> args;
+    args.push_back(const_cast<char*>("./shardmaster"));
+    args.push_back(const_cast<char*>(port.c_str()));
+    args.push_back(const_cast<char*>(replicasFlag.c_str()));
+    args.push_back(0);
+    execv("./shardmaster", args.data());
+  }
+  return pid;
+}
+
+std::string shardmaster_leader(const std::string& addr) {
+  auto stub = Shardmaster::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  Empty req;
+  ReplicaStatusResponse response;
+  auto status = stub->ReplicaStatus(&cc, req, &response);
+  return status.ok() ? response.leader() : "";
+}
+
+bool get_copies(const std::string& addr, const std::string& key,
+                std::string* value, Addrs* copies) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  auto status = stub->Get(&cc, req, &res);
+  *value = res.data();
+  copies->assign(res.copies().begin(), res.copies().end());
+  return status.ok();
+}
+
+bool get_view(const std::string& addr, uint32_t* view, std::string* primary) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  ViewResponse res;
+  auto status = stub->GetView(&cc, Empty(), &res);
+  *view = res.view();
+  *primary = res.primary();
+  return status.ok();
+}
+
+bool get_chain(const std::string& addr, Addrs* chain) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  ViewResponse res;
+  auto status = stub->GetView(&cc, Empty(), &res);
+  chain->assign(res.chain().begin(), res.chain().end());
+  return status.ok();
+}
+
+grpc::Status get_at_view(const std::string& addr, const std::string& key,
+                         uint32_t view, std::string* value,
+                         std::string* redirect) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  cc.AddMetadata(VIEW_METADATA, std::to_string(view));
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  auto status = stub->Get(&cc, req, &res);
+  *value = res.data();
+  const auto& trailer = cc.GetServerTrailingMetadata();
+  auto primary = trailer.find(PRIMARY_METADATA);
+  redirect->assign(primary == trailer.end() ? "" : std::string(primary->second.begin(), primary->second.end()));
+  return status;
+}
+
+grpc::Status get_relaxed(const std::string& addr, const std::string& key,
+                         uint32_t max_staleness_ms, uint64_t min_seq,
+                         std::string* value) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  req.set_consistency(max_staleness_ms > 0 ? GetRequest::BOUNDED
+                                           : GetRequest::READ_YOUR_WRITES);
+  req.set_max_staleness_ms(max_staleness_ms);
+  req.set_min_seq(min_seq);
+  auto status = stub->Get(&cc, req, &res);
+  *value = res.data();
+  return status;
+}
+
+// the sequence number in the trailing metadata of a write, 0 if none
+static uint64_t write_seq(const ::grpc::ClientContext& cc) {
+  const auto& trailer = cc.GetServerTrailingMetadata();
+  auto seq = trailer.find(SEQ_METADATA);
+  if (seq == trailer.end()) return 0;
+  return std::stoull(std::string(seq->second.begin(), seq->second.end()));
+}
+
+bool put_seq(const std::string& addr, const std::string& key,
+             const std::string& value, const std::string& user, uint64_t* seq) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  PutRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.set_user(user);
+  auto status = stub->Put(&cc, req, &res);
+  *seq = write_seq(cc);
+  return status.ok();
+}
+
+bool append_seq(const std::string& addr, const std::string& key,
+                const std::string& value, uint64_t* seq) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  AppendRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  auto status = stub->Append(&cc, req, &res);
+  *seq = write_seq(cc);
+  return status.ok();
+}
+
+bool append_id(const std::string& addr, const std::string& key,
+               const std::string& value, uint64_t client_id, uint64_t seq) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  AppendRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.mutable_id()->set_client_id(client_id);
+  req.mutable_id()->set_seq(seq);
+  return stub->Append(&cc, req, &res).ok();
+}
+
+grpc::Status put_within(const std::string& addr, const std::string& key,
+                        const std::string& value, const std::string& user,
+                        std::chrono::milliseconds timeout) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  cc.set_deadline(std::chrono::system_clock::now() + timeout);
+  PutRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.set_user(user);
+  return stub->Put(&cc, req, &res);
+}
+
+grpc::Status get_within(const std::string& addr, const std::string& key,
+                        std::chrono::milliseconds timeout, std::string* value) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  cc.set_deadline(std::chrono::system_clock::now() + timeout);
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  auto status = stub->Get(&cc, req, &res);
+  *value = res.data();
+  return status;
+}
+
+static void read_hint(const ::grpc::ClientContext& cc, OwnerHint* hint) {
+  const auto& trailer = cc.GetServerTrailingMetadata();
+  auto value = [&trailer](const char* key) {
+    auto found = trailer.find(key);
+    return found == trailer.end() ? std::string() : std::string(found->second.begin(), found->second.end());
+  };
+  *hint = OwnerHint();
+  hint->owner = value(OWNER_METADATA);
+  if (hint->owner.empty()) return;
+  std::string shard = value(OWNER_SHARD_METADATA);
+  size_t dash = shard.find('-');
+  hint->shard = {std::stoull(shard.substr(0, dash)), std::stoull(shard.substr(dash + 1))};
+  hint->version = std::stoull(value(CONFIG_VERSION_METADATA));
+}
+
+grpc::Status put_hinted(const std::string& addr, const std::string& key,
+                        const std::string& value, const std::string& user,
+                        OwnerHint* hint) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  PutRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.set_user(user);
+  auto status = stub->Put(&cc, req, &res);
+  read_hint(cc, hint);
+  return status;
+}
+
+grpc::Status get_hinted(const std::string& addr, const std::string& key,
+                        OwnerHint* hint) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  GetRequest req;
+  GetResponse res;
+  req.set_key(key);
+  auto status = stub->Get(&cc, req, &res);
+  read_hint(cc, hint);
+  return status;
+}
+
+grpc::Status get_versioned(const std::string& addr, const std::string& key,
+                           uint64_t known_version, GetResponse* res) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  GetRequest req;
+  req.set_key(key);
+  req.set_known_version(known_version);
+  return stub->Get(&cc, req, res);
+}
+
+static void read_version(const ::grpc::ClientContext& cc, uint64_t* version) {
+  const auto& trailer = cc.GetServerTrailingMetadata();
+  auto found = trailer.find(VERSION_METADATA);
+  *version = found == trailer.end() ? 0 : std::stoull(std::string(found->second.begin(), found->second.end()));
+}
+
+grpc::Status put_if(const std::string& addr, const std::string& key,
+                    const std::string& value, uint64_t if_version, uint64_t* version) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  PutRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.set_if_version(if_version);
+  auto status = stub->Put(&cc, req, &res);
+  read_version(cc, version);
+  return status;
+}
+
+grpc::Status append_if(const std::string& addr, const std::string& key,
+                       const std::string& value, uint64_t if_version, uint64_t* version) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  AppendRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_data(value);
+  req.set_if_version(if_version);
+  auto status = stub->Append(&cc, req, &res);
+  read_version(cc, version);
+  return status;
+}
+
+grpc::Status delete_if(const std::string& addr, const std::string& key,
+                       uint64_t if_version, uint64_t* version) {
+  auto stub = Shardkv::NewStub(
+      grpc::CreateChannel(addr, grpc::InsecureChannelCredentials()));
+  ::grpc::ClientContext cc;
+  DeleteRequest req;
+  Empty res;
+  req.set_key(key);
+  req.set_if_version(if_version);
+  auto status = stub->Delete(&cc, req, &res);
+  read_version(cc, version);
+  return status;
+}
+
 void start_shardmaster(const std::string& addr) {
   spawn_service_in_thread<StaticShardmaster>(addr);
 }
 
+void start_shardmaster(const std::string& addr,
+                       const ShardmasterOptions& options) {
+  spawn_service_in_thread<StaticShardmaster, const ShardmasterOptions&>(
+      addr, options);
+}
+
 bool test_get_impl(const std::string& addr, std::string key,
                    const std::optional<std::string>& value) {
   auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
@@ -166,10 +472,31 @@ bool test_delete(const std::string& addr, std::string key,
   return status.ok() == success;
 }
 
+bool test_delete_batch(const std::string& addr, const std::vector<std::string>& keys,
+                       bool success) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  DeleteBatchRequest req;
+  Empty res;
+  for (const auto& key : keys) {
+    req.add_keys(key);
+  }
+
+  auto status = stub->DeleteBatch(&cc, req, &res);
+  return status.ok() == success;
+}
+
 // testing functions for shardmaster - for join/leave/move we will have to call
 // query anyway so maybe bundle them?
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
                bool success) {
+  return test_join(shardmaster_addr, addr, 0, success);
+}
+
+bool test_join(const std::string& shardmaster_addr, const std::string& addr,
+               unsigned int weight, bool success) {
   auto channel =
       grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
   auto stub = Shardmaster::NewStub(channel);
@@ -179,6 +506,7 @@ bool test_join(const std::string& shardmaster_addr, const std::string& addr,
   Empty response;
 
   req.set_server(addr);
+  req.set_weight(weight);
 
   auto status = stub->Join(&cc, req, &response);
   return status.ok() == success;
@@ -219,21 +547,9 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
   return status.ok() == success;
 }
 
-bool test_query(const std::string& shardmaster_addr,
-                const std::map<std::string, std::vector<shard_t>>& m) {
-  auto channel =
-      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
-  auto stub = Shardmaster::NewStub(channel);
-
-  ::grpc::ClientContext cc;
-  Empty req;
-  QueryResponse response;
-
-  auto status = stub->Query(&cc, req, &response);
-  if (!status.ok()) {
-    return false;
-  }
-
+// checks that a configuration from the shardmaster is what we expect (m)
+static bool config_matches(const QueryResponse& response,
+                           const std::map<std::string, std::vector<shard_t>>& m) {
   // read response into a map then check if it's equal to what we expect (m)
   std::map<std::string, std::vector<shard_t>> res_map;
 
@@ -277,6 +593,120 @@ bool test_query(const std::string& shardmaster_addr,
   return true;
 }
 
+bool test_query(const std::string& shardmaster_addr,
+                const std::map<std::string, std::vector<shard_t>>& m) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  Empty req;
+  QueryResponse response;
+
+  auto status = stub->Query(&cc, req, &response);
+  if (!status.ok()) {
+    return false;
+  }
+  return config_matches(response, m);
+}
+
+bool test_watch(const std::string& shardmaster_addr, uint64_t from_version,
+                const std::map<std::string, std::vector<shard_t>>& m,
+                uint64_t* version) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  cc.set_deadline(std::chrono::system_clock::now() +
+                  std::chrono::milliseconds(2000));
+  WatchRequest req;
+  QueryResponse response;
+  req.set_from_version(from_version);
+
+  auto reader = stub->Watch(&cc, req);
+  bool received = reader->Read(&response);
+  cc.TryCancel();
+  reader->Finish();
+  if (!received || response.version() <= from_version) {
+    return false;
+  }
+  *version = response.version();
+  return config_matches(response, m);
+}
+
+bool test_report_load(const std::string& shardmaster_addr,
+                      const std::string& server,
+                      const std::vector<std::pair<shard_t, uint64_t>>& ranges,
+                      bool success) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  LoadReport req;
+  Empty response;
+  req.set_server(server);
+  for (const auto& [shard, requests] : ranges) {
+    auto range = req.add_ranges();
+    range->mutable_shard()->set_lower(shard.lower);
+    range->mutable_shard()->set_upper(shard.upper);
+    range->set_requests(requests);
+  }
+
+  auto status = stub->ReportLoad(&cc, req, &response);
+  return status.ok() == success;
+}
+
+bool test_plan(const std::string& shardmaster_addr, const Addrs& joins,
+               const Addrs& leaves,
+               const std::map<std::string, std::vector<shard_t>>& m,
+               size_t* moved) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  PlanRequest req;
+  PlanResponse response;
+  for (const auto& addr : joins) {
+    req.add_joins(addr);
+  }
+  for (const auto& addr : leaves) {
+    req.add_leaves(addr);
+  }
+
+  auto status = stub->PlanRebalance(&cc, req, &response);
+  if (!status.ok()) {
+    return false;
+  }
+  *moved = response.keys_moved();
+  QueryResponse planned;
+  planned.mutable_config()->CopyFrom(response.config());
+  return config_matches(planned, m);
+}
+
+bool test_reconfigure(const std::string& shardmaster_addr,
+                      const ReconfigureRequest& req,
+                      const std::map<std::string, std::vector<shard_t>>& m,
+                      uint64_t* version) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  ReconfigureResponse response;
+
+  auto status = stub->Reconfigure(&cc, req, &response);
+  if (!status.ok()) {
+    return false;
+  }
+  *version = response.version();
+  QueryResponse result;
+  result.mutable_config()->CopyFrom(response.config());
+  return config_matches(result, m);
+}
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user, bool success){
     auto channel =
       grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
@@ -292,6 +722,51 @@ bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user, boo
     return status.ok() == success;
 }
 
+bool test_gdpr_status(const std::string& shardmaster_addr,
+                      const std::string& user, bool done) {
+  auto channel =
+      grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardmaster::NewStub(channel);
+
+  for (int i = 0; i < 5 * RETRIES; i++) {
+    ::grpc::ClientContext cc;
+    GDPRDeleteRequest req;
+    GDPRStatusResponse res;
+    req.set_key(user);
+    auto status = stub->GDPRStatus(&cc, req, &res);
+    if (!status.ok()) {
+      return false;
+    }
+    bool finished = res.state() == GDPRStatusResponse::DONE;
+    if (finished == done || !done) {
+      return finished == done;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return false;
+}
+
+bool test_migration_status(const std::string& addr,
+                           const std::string& peer, bool done) {
+  auto channel = grpc::CreateChannel(addr, grpc::InsecureChannelCredentials());
+  auto stub = Shardkv::NewStub(channel);
+
+  ::grpc::ClientContext cc;
+  MigrationStatusRequest req;
+  MigrationStatusResponse res;
+
+  auto status = stub->MigrationStatus(&cc, req, &res);
+  if (!status.ok()) {
+    return false;
+  }
+  for (const auto& move : res.moves()) {
+    if (move.peer() == peer) {
+      return (move.state() == MoveStatus::DONE) == done;
+    }
+  }
+  return false;
+}
+
 /**
  * sends signal to all specified pids and then waitpids until they're all gone
  * @param pids list of pids to kill - must be children of current process
@@ -13,6 +13,12 @@
 
 using Addrs = std::vector<std::string>;
 
+struct ShardkvOptions;
+struct ShardkvManagerOptions;
+struct ShardmasterOptions;
+class ReconfigureRequest;
+class GetResponse;
+
 #define RETRIES 10
 
 /**
@@ -65,12 +71,98 @@ std::vector<pid_t> start_shardkvs_proc(const Addrs& addrs,
 void start_shardkv(const std::string& addr,
                    const std::string& shardmaster_addr);
 
+void start_shardkv(const std::string& addr,
+                   const std::string& shardmaster_addr,
+                   const ShardkvOptions& options);
+
 pid_t start_shardkv_proc(const std::string& addr,
                          const std::string& shardmaster_addr);
 
 void start_shardmaster(const std::string& addr);
 
+void start_shardmaster(const std::string& addr,
+                       const ShardmasterOptions& options);
+
+// runs ./shardmaster on addr in its own process, as one of replicas
+pid_t start_shardmaster_proc(const std::string& addr, const Addrs& replicas);
+
+// the leader the shardmaster replica at addr knows of, empty if none
+std::string shardmaster_leader(const std::string& addr);
+
+// reads key at addr, storing its value and the groups holding copies of it.
+// returns false if the read failed
+bool get_copies(const std::string& addr, const std::string& key,
+                std::string* value, Addrs* copies);
+
+// reads the view of the group whose manager or member is at addr
+bool get_view(const std::string& addr, uint32_t* view, std::string* primary);
+
+// reads the chain of the group whose manager is at addr, head first. empty
+// unless the manager runs a chain
+bool get_chain(const std::string& addr, Addrs* chain);
+
+// reads key straight from the group member at addr, sending view as the view
+// we believe is current. a member that turns us away stores the primary it
+// knows of in redirect
+grpc::Status get_at_view(const std::string& addr, const std::string& key,
+                         uint32_t view, std::string* value,
+                         std::string* redirect);
+
+// reads key from the group member at addr, allowing the read to be served
+// by a backup at most max_staleness_ms behind its primary, or by one that
+// has every write up to min_seq if max_staleness_ms is 0
+grpc::Status get_relaxed(const std::string& addr, const std::string& key,
+                         uint32_t max_staleness_ms, uint64_t min_seq,
+                         std::string* value);
+
+// put and append that store the sequence number the write got, see
+// SEQ_METADATA
+bool put_seq(const std::string& addr, const std::string& key,
+             const std::string& value, const std::string& user, uint64_t* seq);
+bool append_seq(const std::string& addr, const std::string& key,
+                const std::string& value, uint64_t* seq);
+
+// append that names itself as write seq of client_id, see RequestId
+bool append_id(const std::string& addr, const std::string& key,
+               const std::string& value, uint64_t client_id, uint64_t seq);
+
+// put and get that give up once timeout has passed
+grpc::Status put_within(const std::string& addr, const std::string& key,
+                        const std::string& value, const std::string& user,
+                        std::chrono::milliseconds timeout);
+grpc::Status get_within(const std::string& addr, const std::string& key,
+                        std::chrono::milliseconds timeout, std::string* value);
+
+// the owner of a key a group that turned a request for it away named, see
+// OWNER_METADATA. owner is empty if it named none
+struct OwnerHint {
+  std::string owner;
+  shard_t shard{0, 0};
+  uint64_t version = 0;
+};
+
+// put and get that store the owner the group at addr names in hint
+grpc::Status put_hinted(const std::string& addr, const std::string& key,
+                        const std::string& value, const std::string& user,
+                        OwnerHint* hint);
+grpc::Status get_hinted(const std::string& addr, const std::string& key,
+                        OwnerHint* hint);
+
+// a read sending known_version, see GetRequest.known_version
+grpc::Status get_versioned(const std::string& addr, const std::string& key,
+                           uint64_t known_version, GetResponse* res);
+// writes conditional on if_version, see PutRequest.if_version. they store
+// the version they leave key at in version
+grpc::Status put_if(const std::string& addr, const std::string& key,
+                    const std::string& value, uint64_t if_version, uint64_t* version);
+grpc::Status append_if(const std::string& addr, const std::string& key,
+                       const std::string& value, uint64_t if_version, uint64_t* version);
+grpc::Status delete_if(const std::string& addr, const std::string& key,
+                       uint64_t if_version, uint64_t* version);
+
 void start_shardmanager(const std::string& addr, const std::string& shardmaster_addr);
+void start_shardmanager(const std::string& addr, const std::string& shardmaster_addr,
+                        const ShardkvManagerOptions& options);
 
 // testing functions for simple shardkv and shardkv
 bool test_get(const std::string& addr, std::string key,
@@ -84,11 +176,17 @@ bool test_append(const std::string& addr, std::string key,
 
 bool test_delete(const std::string& addr, std::string key,
                  bool success);
+bool test_delete_batch(const std::string& addr, const std::vector<std::string>& keys,
+                       bool success);
 
 // testing functions for shardmaster
 bool test_join(const std::string& shardmaster_addr, const std::string& addr,
                bool success);
 
+// joins addr with the given capacity weight
+bool test_join(const std::string& shardmaster_addr, const std::string& addr,
+               unsigned int weight, bool success);
+
 bool test_leave(const std::string& shardmaster_addr, const Addrs& addrs,
                 bool success);
 
@@ -98,9 +196,45 @@ bool test_move(const std::string& shardmaster_addr, const std::string& addr,
 bool test_query(const std::string& shardmaster_addr,
                 const std::map<std::string, std::vector<shard_t>>& m);
 
+// watches the shardmaster from from_version and checks that the next pushed
+// configuration is m, storing its version
+bool test_watch(const std::string& shardmaster_addr, uint64_t from_version,
+                const std::map<std::string, std::vector<shard_t>>& m,
+                uint64_t* version);
+
+// reports requests per range to the shardmaster on behalf of server
+bool test_report_load(const std::string& shardmaster_addr,
+                      const std::string& server,
+                      const std::vector<std::pair<shard_t, uint64_t>>& ranges,
+                      bool success);
+
+// plans joins followed by leaves on the shardmaster and checks that the
+// resulting configuration is m, storing how many keys would move
+bool test_plan(const std::string& shardmaster_addr, const Addrs& joins,
+               const Addrs& leaves,
+               const std::map<std::string, std::vector<shard_t>>& m,
+               size_t* moved);
+
+// sends req to the shardmaster and checks that the resulting configuration is
+// m, storing its version
+bool test_reconfigure(const std::string& shardmaster_addr,
+                      const ReconfigureRequest& req,
+                      const std::map<std::string, std::vector<shard_t>>& m,
+                      uint64_t* version);
+
 bool test_gdpr_delete(const std::string& shardmaster_addr, std::string user,
                bool success);
 
+// checks whether the GDPR purge of user has completed, waiting for it a while
+// if done is expected
+bool test_gdpr_status(const std::string& shardmaster_addr,
+                      const std::string& user, bool done);
+
+// testing functions for shard migrations - checks that the shardkv at addr has
+// a move to or from peer and whether it has completed
+bool test_migration_status(const std::string& addr,
+                           const std::string& peer, bool done);
+
 void cleanup_children(const std::vector<pid_t>& pids);
 
 #endif  // SHARDING_TEST_UTILS_H
@@ -0,0 +1,81 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":13000";
+  string sv1_primary = hostname + ":13001";
+  string sv1_backup = hostname + ":13002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  auto pid_primary = start_shardkvs_proc({sv1_primary}, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  auto pid_backup = start_shardkvs_proc({sv1_backup}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+  // writes through the manager get their sequence number too
+  uint64_t seq;
+  string value;
+  assert(put_seq(skv_1, "post_200", "hello", "user_1", &seq));
+  assert(seq > 0);
+
+  // the backup serves reads while it keeps up with the primary
+  std::chrono::milliseconds sync(500);
+  std::this_thread::sleep_for(sync);
+  assert(get_relaxed(sv1_backup, "post_200", 1000, 0, &value).ok());
+  assert(value == "hello");
+  assert(get_relaxed(sv1_backup, "post_200", 0, seq, &value).ok());
+  assert(value == "hello");
+  // but not ones that need writes it has not been told about
+  auto status = get_relaxed(sv1_backup, "post_200", 0, seq + 100, &value);
+  assert(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+
+  // appends and deletes reach the backup as well
+  uint64_t appended;
+  assert(append_seq(skv_1, "post_200", " world", &appended));
+  assert(appended > seq);
+  std::this_thread::sleep_for(sync);
+  assert(get_relaxed(sv1_backup, "post_200", 0, appended, &value).ok());
+  assert(value == "hello world");
+  assert(test_delete(skv_1, "post_200", true));
+  std::this_thread::sleep_for(sync);
+  status = get_relaxed(sv1_backup, "post_200", 1000, 0, &value);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+
+  // the primary serves relaxed reads like any other
+  assert(put_seq(skv_1, "post_201", "again", "user_1", &seq));
+  assert(get_relaxed(sv1_primary, "post_201", 0, seq, &value).ok());
+  assert(value == "again");
+  std::this_thread::sleep_for(sync);
+
+  // a backup that stops hearing from its primary falls behind the bound,
+  // but still has the writes it was told about
+  kill(pid_primary[0], SIGKILL);
+  std::this_thread::sleep_for(sync);
+  status = get_relaxed(sv1_backup, "post_201", 200, 0, &value);
+  assert(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+  assert(get_relaxed(sv1_backup, "post_201", 0, seq, &value).ok());
+
+  for (auto pid : pid_backup) {
+    kill(pid, SIGKILL);
+  }
+  return 0;
+}
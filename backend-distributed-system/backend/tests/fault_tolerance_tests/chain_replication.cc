@@ -0,0 +1,101 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":14000";
+  string sv1 = hostname + ":14001";
+  string sv2 = hostname + ":14002";
+  string sv3 = hostname + ":14003";
+  string sv4 = hostname + ":14004";
+
+  ShardkvManagerOptions options;
+  options.chainLength = 3;
+  start_shardmanager(skv_1, shardmaster_addr, options);
+  // members join the chain in the order they first ping
+  vector<pid_t> pids;
+  for (const auto& sv : {sv1, sv2, sv3}) {
+    pids.push_back(start_shardkv_proc(sv, skv_1));
+    std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  }
+  pid_t pid_sv4 = start_shardkv_proc(sv4, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+  // the chain is full, so the last server waits outside it
+  Addrs chain;
+  assert(get_chain(skv_1, &chain));
+  assert((chain == Addrs{sv1, sv2, sv3}));
+
+  // a write reaches every member before it is acknowledged
+  assert(test_put(skv_1, "post_200", "hello", "user_1", true));
+  for (const auto& sv : chain) {
+    assert(test_get(sv, "post_200", "hello"));
+  }
+  assert(test_get(skv_1, "post_200", "hello"));
+
+  // strong reads sent straight to the group are served by the tail, the
+  // head points to it
+  uint32_t view;
+  string primary, value, redirect;
+  assert(get_view(skv_1, &view, &primary));
+  assert(primary == sv1);
+  assert(get_at_view(sv3, "post_200", view, &value, &redirect).ok());
+  assert(value == "hello");
+  auto status = get_at_view(sv1, "post_200", view, &value, &redirect);
+  assert(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+  assert(redirect == sv3);
+
+  // a member that goes away is spliced out, and the waiting server joins at
+  // the tail with the keys of the member before it
+  kill(pids[1], SIGKILL);
+  // writes keep coming while it joins. one the chain can't take yet is only
+  // turned away for now, so each goes through in the end and reaches the new
+  // tail
+  for (int i = 0; i < 100; i++) {
+    string key = "post_" + to_string(300 + i);
+    auto put = put_within(skv_1, key, "while joining", "", std::chrono::milliseconds{2000});
+    for (int attempt = 0; !put.ok(); attempt++) {
+      assert(put.error_code() == grpc::StatusCode::UNAVAILABLE ||
+             put.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED);
+      assert(attempt < 100);
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      put = put_within(skv_1, key, "while joining", "", std::chrono::milliseconds{2000});
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+  }
+  assert(get_chain(skv_1, &chain));
+  assert((chain == Addrs{sv1, sv3, sv4}));
+  assert(test_get(sv4, "post_200", "hello"));
+  for (int i = 0; i < 100; i++) {
+    assert(test_get(sv4, "post_" + to_string(300 + i), "while joining"));
+  }
+
+  assert(test_put(skv_1, "post_201", "world", "user_1", true));
+  for (const auto& sv : chain) {
+    assert(test_get(sv, "post_201", "world"));
+  }
+  assert(test_get(skv_1, "post_201", "world"));
+
+  kill(pids[0], SIGKILL);
+  kill(pids[2], SIGKILL);
+  kill(pid_sv4, SIGKILL);
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":16000";
+  string sv1_primary = hostname + ":16001";
+  string sv1_backup = hostname + ":16002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  auto pid_primary = start_shardkvs_proc({sv1_primary}, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  auto pid_backup = start_shardkvs_proc({sv1_backup}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+  std::chrono::milliseconds timeout(500);
+  string value;
+  assert(put_within(skv_1, "post_200", "hello", "user_1", timeout).ok());
+
+  // a write stuck on a stalled backup gives up when its sender does
+  kill(pid_backup[0], SIGSTOP);
+  auto start = std::chrono::steady_clock::now();
+  assert(!put_within(skv_1, "post_201", "world", "user_1", timeout).ok());
+  assert(std::chrono::steady_clock::now() - start < 3 * timeout);
+
+  // and leaves neither the manager nor the primary tied up
+  assert(get_within(skv_1, "post_200", timeout, &value).ok());
+  assert(value == "hello");
+  kill(pid_backup[0], SIGCONT);
+
+  for (auto pid : pid_primary) {
+    kill(pid, SIGKILL);
+  }
+  for (auto pid : pid_backup) {
+    kill(pid, SIGKILL);
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":13000";
+  string sv1_primary = hostname + ":13001";
+  string sv1_backup = hostname + ":13002";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  auto pid_primary = start_shardkvs_proc({sv1_primary}, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  auto pid_backup = start_shardkvs_proc({sv1_backup}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::chrono::milliseconds timespan(2000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "post_200", "hello", "user_1", true));
+
+  // the manager publishes its view, and its primary serves requests sent
+  // straight to it
+  uint32_t view;
+  string primary, value, redirect;
+  assert(get_view(skv_1, &view, &primary));
+  assert(primary == sv1_primary);
+  assert(get_at_view(sv1_primary, "post_200", view, &value, &redirect).ok());
+  assert(value == "hello");
+
+  // anyone else, or the primary of another view, points to the primary
+  auto status = get_at_view(sv1_backup, "post_200", view, &value, &redirect);
+  assert(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+  assert(redirect == sv1_primary);
+  status = get_at_view(sv1_primary, "post_200", view + 1, &value, &redirect);
+  assert(status.error_code() == grpc::StatusCode::FAILED_PRECONDITION);
+  assert(redirect == sv1_primary);
+
+  // once the primary is gone the published view names the backup, which
+  // then serves requests sent straight to it
+  kill(pid_primary[0], SIGKILL);
+  std::this_thread::sleep_for(std::chrono::milliseconds{5000});
+  uint32_t newView;
+  assert(get_view(skv_1, &newView, &primary));
+  assert(primary == sv1_backup && newView != view);
+  status = get_at_view(sv1_backup, "post_200", newView, &value, &redirect);
+  assert(status.ok() && value == "hello");
+  assert(!get_at_view(sv1_backup, "post_200", view, &value, &redirect).ok());
+
+  for (auto pid : pid_backup) {
+    kill(pid, SIGKILL);
+  }
+  return 0;
+}
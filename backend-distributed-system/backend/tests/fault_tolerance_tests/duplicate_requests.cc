@@ -0,0 +1,77 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":17000";
+  string sv1_primary = hostname + ":17001";
+  string sv1_backup = hostname + ":17002";
+  string sv1_spare = hostname + ":17003";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  pid_t pid_primary = start_shardkv_proc(sv1_primary, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  pid_t pid_backup = start_shardkv_proc(sv1_backup, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+  const uint64_t client = 42;
+  assert(test_put(skv_1, "post_5", "a", "", true));
+
+  // a write sent again is acknowledged but applied once, by the whole group
+  assert(append_id(skv_1, "post_5", "b", client, 1));
+  assert(append_id(skv_1, "post_5", "b", client, 1));
+  assert(append_id(sv1_primary, "post_5", "b", client, 1));
+  assert(test_get(skv_1, "post_5", "ab"));
+  assert(test_get(sv1_backup, "post_5", "ab"));
+
+  // writes may arrive out of order
+  assert(append_id(skv_1, "post_5", "d", client, 3));
+  assert(append_id(skv_1, "post_5", "c", client, 2));
+  assert(append_id(skv_1, "post_5", "d", client, 3));
+  assert(append_id(skv_1, "post_5", "c", client, 2));
+  assert(test_get(skv_1, "post_5", "abdc"));
+
+  // other clients, and writes without an id, are not affected
+  assert(append_id(skv_1, "post_5", "e", client + 1, 1));
+  assert(append_id(skv_1, "post_5", "f", 0, 0));
+  assert(append_id(skv_1, "post_5", "f", 0, 0));
+  assert(test_get(skv_1, "post_5", "abdceff"));
+
+  // the backup knows what the primary applied, so a retry after a failover
+  // is not applied again either
+  assert(append_id(skv_1, "post_5", "g", client, 4));
+  kill(pid_primary, SIGKILL);
+  std::this_thread::sleep_for(std::chrono::milliseconds{5000});
+  assert(append_id(skv_1, "post_5", "g", client, 4));
+  assert(test_get(skv_1, "post_5", "abdceffg"));
+
+  // and so does a new member, which gets it along with the keys
+  pid_t pid_spare = start_shardkv_proc(sv1_spare, skv_1);
+  std::this_thread::sleep_for(std::chrono::milliseconds{3000});
+  assert(test_get(sv1_spare, "post_5", "abdceffg"));
+  kill(pid_backup, SIGKILL);
+  std::this_thread::sleep_for(std::chrono::milliseconds{5000});
+  assert(append_id(skv_1, "post_5", "g", client, 4));
+  assert(append_id(skv_1, "post_5", "h", client, 5));
+  assert(test_get(skv_1, "post_5", "abdceffgh"));
+
+  kill(pid_spare, SIGKILL);
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":15000";
+  string sv1_primary = hostname + ":15001";
+  string sv1_backup = hostname + ":15002";
+
+  ShardkvManagerOptions options;
+  options.hedge.budgetPercent = 100;
+  start_shardmanager(skv_1, shardmaster_addr, options);
+  auto pid_primary = start_shardkvs_proc({sv1_primary}, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  auto pid_backup = start_shardkvs_proc({sv1_backup}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::this_thread::sleep_for(std::chrono::milliseconds{2000});
+
+  assert(test_put(skv_1, "post_200", "hello", "user_1", true));
+  // fast reads save up hedges
+  for (int i = 0; i < 10; i++) {
+    assert(test_get(skv_1, "post_200", "hello"));
+  }
+
+  // a primary that stalls, but is not yet taken for dead, no longer holds up
+  // reads: the backup answers them
+  kill(pid_primary[0], SIGSTOP);
+  for (int i = 0; i < 3; i++) {
+    auto start = std::chrono::steady_clock::now();
+    assert(test_get(skv_1, "post_200", "hello"));
+    assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{500});
+  }
+  kill(pid_primary[0], SIGCONT);
+
+  for (auto pid : pid_primary) {
+    kill(pid, SIGKILL);
+  }
+  for (auto pid : pid_backup) {
+    kill(pid, SIGKILL);
+  }
+  return 0;
+}
@@ -0,0 +1,91 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "../../build/shardmaster.grpc.pb.h"
+#include "../../common/retry.h"
+#include "../../common/rpc.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  // nothing listens here until the end
+  string shardmaster_addr = hostname + ":16100";
+
+  RetryOptions options;
+  options.initialBackoff = std::chrono::milliseconds{5};
+  options.breakerThreshold = 4;
+  options.openFor = std::chrono::milliseconds{500};
+  RetryPolicy retries(options);
+
+  int attempts = 0;
+  auto query = [&]() {
+    attempts++;
+    auto stub = Shardmaster::NewStub(grpc::CreateChannel(shardmaster_addr, grpc::InsecureChannelCredentials()));
+    auto cc = CallContext(nullptr, std::chrono::milliseconds{500});
+    google::protobuf::Empty request;
+    QueryResponse response;
+    return stub->Query(cc.get(), request, &response);
+  };
+
+  // a peer that is down is tried a few times
+  auto status = retries.Call(shardmaster_addr, query);
+  assert(status.error_code() == grpc::StatusCode::UNAVAILABLE);
+  assert(attempts == options.maxAttempts);
+
+  // calls that must not be made twice are tried once
+  attempts = 0;
+  status = retries.Call(shardmaster_addr, query, false);
+  assert(status.error_code() == grpc::StatusCode::UNAVAILABLE);
+  assert(attempts == 1);
+
+  // then its breaker is open, and calls to it fail without trying
+  attempts = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 10; i++) {
+    status = retries.Call(shardmaster_addr, query);
+    assert(status.error_code() == grpc::StatusCode::UNAVAILABLE);
+  }
+  assert(attempts == 0);
+  assert(std::chrono::steady_clock::now() - start < std::chrono::milliseconds{100});
+
+  // once it is back, a probe finds out and calls go through again. a probe
+  // is sent every openFor, the calls in between still fail right away
+  start_shardmaster(shardmaster_addr);
+  bool back = false;
+  for (int i = 0; i < 20 && !back; i++) {
+    std::this_thread::sleep_for(options.openFor);
+    attempts = 0;
+    back = retries.Call(shardmaster_addr, query).ok();
+    assert(attempts <= 1);
+    attempts = 0;
+    if (!back) {
+      assert(!retries.Call(shardmaster_addr, query).ok());
+      assert(attempts == 0);
+    }
+  }
+  assert(back);
+  for (int i = 0; i < 10; i++) {
+    assert(retries.Call(shardmaster_addr, query).ok());
+  }
+
+  // other failures do not mean the peer is down
+  RetryPolicy fresh(options);
+  attempts = 0;
+  auto invalid = [&]() {
+    attempts++;
+    return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "no");
+  };
+  for (int i = 0; i < 10; i++) {
+    assert(fresh.Call(shardmaster_addr, invalid).error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  }
+  assert(attempts == 10);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <signal.h>
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardkv_manager/shardkv_manager.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// waits until some replica in addrs knows of a leader, returning it
+static string wait_for_leader(const Addrs& addrs) {
+  for (int i = 0; i < 50; i++) {
+    for (const auto& addr : addrs) {
+      string leader = shardmaster_leader(addr);
+      if (!leader.empty()) return leader;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return "";
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  Addrs replicas = {hostname + ":8090", hostname + ":8091", hostname + ":8092"};
+  map<string, pid_t> pids;
+  for (const auto& replica : replicas) {
+    pids[replica] = start_shardmaster_proc(replica, replicas);
+  }
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string sv1 = hostname + ":8085";
+  map<string, vector<shard_t>> m;
+
+  string leader = wait_for_leader(replicas);
+  assert(!leader.empty());
+  string follower = replicas[0] == leader ? replicas[1] : replicas[0];
+
+  // the group is given the leader, and told of the other replicas
+  ShardkvManagerOptions options;
+  options.shardmasterReplicas = replicas;
+  start_shardmanager(skv_1, leader, options);
+  start_shardkvs({sv1}, skv_1);
+
+  // a change sent to a follower is made by the leader, and every replica
+  // serves the result
+  assert(test_join(follower, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  for (const auto& replica : replicas) {
+    assert(test_query(replica, m));
+  }
+  m.clear();
+  std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  assert(test_put(skv_1, "user_700", "edith", "", true));
+
+  // the others take over once the leader is gone, keeping the configuration
+  kill(pids[leader], SIGKILL);
+  Addrs survivors;
+  for (const auto& replica : replicas) {
+    if (replica != leader) survivors.push_back(replica);
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+  string newLeader = wait_for_leader(survivors);
+  assert(!newLeader.empty() && newLeader != leader);
+
+  assert(test_join(survivors[0], skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  for (const auto& replica : survivors) {
+    assert(test_query(replica, m));
+  }
+  // which is still checked by the new leader
+  assert(test_join(survivors[1], skv_2, false));
+
+  // the group moved on to another replica, so it knows it gave up the key
+  std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+  assert(test_put(skv_1, "user_700", "mary", "", false));
+
+  for (const auto& [replica, pid] : pids) {
+    kill(pid, SIGKILL);
+  }
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <signal.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../build/shardkv.grpc.pb.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":18000";
+  string sv1_primary = hostname + ":18001";
+  string sv1_backup = hostname + ":18002";
+
+  string skv_2 = hostname + ":18100";
+  string sv2 = hostname + ":18101";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  pid_t pid_primary = start_shardkv_proc(sv1_primary, skv_1);
+  // wait to make sure the primary is set
+  std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+  pid_t pid_backup = start_shardkv_proc(sv1_backup, skv_1);
+  pid_t pid_2 = start_shardkv_proc(sv2, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(2 * timespan);
+
+  assert(test_put(skv_1, "user_700", "edith", "", true));
+
+  // reads tell the version, and leave the value out if the caller has it
+  GetResponse res;
+  assert(get_versioned(skv_1, "user_700", 0, &res).ok());
+  assert(res.data() == "edith" && !res.not_modified());
+  uint64_t version = res.version();
+  assert(version != 0);
+  res.Clear();
+  assert(get_versioned(skv_1, "user_700", version, &res).ok());
+  assert(res.not_modified() && res.data().empty() && res.version() == version);
+  res.Clear();
+  assert(get_versioned(sv1_backup, "user_700", version, &res).ok());
+  assert(res.not_modified());
+
+  // a write at a version the key is no longer at is turned away
+  uint64_t written, unchanged;
+  assert(put_if(skv_1, "user_700", "mary", version + 1, &unchanged).error_code() == grpc::StatusCode::ABORTED);
+  assert(test_get(skv_1, "user_700", "edith"));
+  assert(put_if(skv_1, "user_700", "mary", version, &written).ok());
+  assert(written != version);
+  assert(put_if(skv_1, "user_700", "sybil", version, &unchanged).error_code() == grpc::StatusCode::ABORTED);
+  assert(test_get(sv1_backup, "user_700", "mary"));
+  res.Clear();
+  assert(get_versioned(sv1_backup, "user_700", version, &res).ok());
+  assert(res.data() == "mary" && res.version() == written);
+
+  // an append tells the version it leaves the key at as well
+  version = written;
+  assert(append_if(skv_1, "user_700", "-crawley", version, &written).ok());
+  res.Clear();
+  assert(get_versioned(skv_1, "user_700", 0, &res).ok());
+  assert(res.data() == "mary-crawley" && res.version() == written);
+
+  // conditional writes racing for one version: a single one goes ahead, and
+  // the backup ends up where the primary does
+  assert(test_put(skv_1, "user_701", "anna", "", true));
+  res.Clear();
+  assert(get_versioned(skv_1, "user_701", 0, &res).ok());
+  uint64_t raced = res.version();
+  std::atomic<int> won{0};
+  vector<thread> racers;
+  for (int i = 0; i < 8; i++) {
+    racers.emplace_back([&, i]() {
+      uint64_t ignored;
+      if (put_if(skv_1, "user_701", "bates-" + to_string(i), raced, &ignored).ok()) won++;
+    });
+  }
+  for (auto& racer : racers) racer.join();
+  assert(won == 1);
+  GetResponse at_primary, at_backup;
+  assert(get_versioned(sv1_primary, "user_701", 0, &at_primary).ok());
+  assert(get_versioned(sv1_backup, "user_701", 0, &at_backup).ok());
+  assert(at_primary.data() == at_backup.data() && at_primary.data() != "anna");
+
+  // and a delete only goes ahead at the current version
+  version = written;
+  assert(delete_if(skv_1, "user_700", version + 1, &unchanged).error_code() == grpc::StatusCode::ABORTED);
+  assert(test_get(skv_1, "user_700", "mary-crawley"));
+  assert(delete_if(skv_1, "user_700", version, &written).ok());
+  assert(written == 0);
+  assert(test_get(skv_1, "user_700", std::nullopt));
+
+  // a key keeps its version when it moves to another group
+  assert(test_put(skv_1, "user_700", "edith", "", true));
+  res.Clear();
+  assert(get_versioned(skv_1, "user_700", 0, &res).ok());
+  version = res.version();
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_move(shardmaster_addr, skv_2, {600, 800}, true));
+  std::this_thread::sleep_for(timespan);
+  res.Clear();
+  assert(get_versioned(skv_2, "user_700", version, &res).ok());
+  assert(res.not_modified());
+  assert(put_if(skv_2, "user_700", "mary", version, &written).ok());
+  assert(test_get(skv_2, "user_700", "mary"));
+
+  kill(pid_primary, SIGKILL);
+  kill(pid_backup, SIGKILL);
+  kill(pid_2, SIGKILL);
+  return 0;
+}
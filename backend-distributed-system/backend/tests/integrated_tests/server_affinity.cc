@@ -0,0 +1,55 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  ShardmasterOptions options;
+  options.partitioning = Partitioning::AFFINITY;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+  string skv_2 = hostname + ":12000";
+
+  // skv_2 has no server at all, nothing written for user_100 may need it
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // a post tagged with its owner lives with the owner whatever its own id, so
+  // the owner's post list is updated locally
+  assert(test_put(skv_1, "user_100", "anna", "", true));
+  assert(test_put(skv_1, "post_900{user_100}", "hello", "user_100", true));
+  assert(test_put(skv_1, "post_901{user_100}", "again", "user_100", true));
+  assert(test_get(skv_1, "post_900{user_100}", "hello"));
+  assert(test_get(skv_1, "user_100_posts", "post_900{user_100},post_901{user_100},"));
+  assert(test_append(skv_1, "post_900{user_100}", " world", true));
+  assert(test_get(skv_1, "post_900{user_100}", "hello world"));
+
+  // untagged keys are still placed by their own id
+  assert(test_put(skv_1, "post_900", "elsewhere", "", false));
+  assert(test_put(skv_1, "post_400", "here", "", true));
+  assert(test_get(skv_1, "post_400", "here"));
+
+  return 0;
+}
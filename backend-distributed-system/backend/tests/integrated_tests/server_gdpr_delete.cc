@@ -0,0 +1,80 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // user_5 and its list live on skv_1, its posts on both groups
+  assert(test_put(skv_1, "user_5", "alice", "", true));
+  assert(test_put(skv_1, "user_6", "bob", "", true));
+  assert(test_put(skv_1, "post_10", "first", "user_5", true));
+  assert(test_put(skv_2, "post_600", "second", "user_5", true));
+  assert(test_put(skv_2, "post_900", "third", "user_5", true));
+  assert(test_put(skv_2, "post_901", "other", "user_6", true));
+  assert(test_get(skv_1, "user_5_posts", "post_10,post_600,post_900,"));
+  assert(test_get(skv_1, "all_users", "user_5,user_6,"));
+
+  // a batch holding a key of another group is turned away as a whole
+  assert(test_delete_batch(skv_2, {"post_901", "user_6"}, false));
+  assert(test_get(skv_2, "post_901", "other"));
+
+  // only user keys can be purged
+  assert(test_gdpr_delete(shardmaster_addr, "post_10", false));
+  assert(test_gdpr_delete(shardmaster_addr, "user_5_posts", false));
+
+  // the purge runs in the background, progress is polled separately
+  assert(test_gdpr_status(shardmaster_addr, "user_5", false));
+  auto start = std::chrono::steady_clock::now();
+  assert(test_gdpr_delete(shardmaster_addr, "user_5", true));
+  assert(std::chrono::steady_clock::now() - start < timespan);
+  assert(test_gdpr_status(shardmaster_addr, "user_5", true));
+
+  assert(test_get(skv_1, "user_5", nullopt));
+  assert(test_get(skv_1, "user_5_posts", nullopt));
+  assert(test_get(skv_1, "post_10", nullopt));
+  assert(test_get(skv_2, "post_600", nullopt));
+  assert(test_get(skv_2, "post_900", nullopt));
+  assert(test_get(skv_1, "all_users", "user_6,"));
+
+  // other users keep their data
+  assert(test_get(skv_1, "user_6", "bob"));
+  assert(test_get(skv_2, "post_901", "other"));
+  assert(test_get(skv_1, "user_6_posts", "post_901,"));
+
+  // purging again finds nothing left and still completes
+  assert(test_gdpr_delete(shardmaster_addr, "user_5", true));
+  assert(test_gdpr_status(shardmaster_addr, "user_5", true));
+
+  return 0;
+}
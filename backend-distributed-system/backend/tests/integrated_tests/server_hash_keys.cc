@@ -0,0 +1,86 @@
+#include <unistd.h>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../common/key_hash.h"
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+// the first key of the form prefix<n> that hashes into [lower, upper]
+static string key_in(const string& prefix, uint64_t lower, uint64_t upper) {
+  for (int i = 0;; i++) {
+    string key = prefix + to_string(i);
+    uint64_t position = hashPosition(key, MAX_KEY_LIMIT);
+    if (position >= lower && position <= upper) return key;
+  }
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  ShardmasterOptions options;
+  options.partitioning = Partitioning::HASH;
+  options.maxKey = MAX_KEY_LIMIT;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":13000";
+  string skv_2 = hostname + ":12000";
+
+  string sv1 = hostname + ":13001";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  const uint64_t half = uint64_t(1) << 63;
+  // keys of any form, one for each half of the key space once skv_2 joins
+  string stays = key_in("session:", 0, half - 1);
+  string moves = key_in("session:", half, MAX_KEY_LIMIT);
+  // keys sharing a hash tag are placed together
+  string tag = "{" + key_in("cart:", half, MAX_KEY_LIMIT) + "}";
+  assert(hashPosition(tag + ".items", MAX_KEY_LIMIT) ==
+         hashPosition(tag + ".total", MAX_KEY_LIMIT));
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(5000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, stays, "a", "", true));
+  assert(test_put(skv_1, moves, "b", "", true));
+  assert(test_put(skv_1, tag + ".items", "book", "", true));
+  assert(test_put(skv_1, tag + ".total", "12", "", true));
+  assert(test_append(skv_1, moves, "c", true));
+  assert(test_get(skv_1, moves, "bc"));
+  // arbitrary keys are not listed as users
+  assert(test_get(skv_1, "all_users", nullopt));
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_get(skv_1, stays, "a"));
+  assert(test_get(skv_1, moves, nullopt));
+  assert(test_get(skv_2, moves, "bc"));
+  assert(test_get(skv_2, tag + ".items", "book"));
+  assert(test_get(skv_2, tag + ".total", "12"));
+
+  // and each group only takes the keys it owns
+  assert(test_put(skv_1, tag + ".total", "13", "", false));
+  assert(test_put(skv_2, tag + ".total", "13", "", true));
+  assert(test_put(skv_2, stays, "d", "", false));
+
+  return 0;
+}
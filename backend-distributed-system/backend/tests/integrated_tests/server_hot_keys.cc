@@ -0,0 +1,94 @@
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  string skv_3 = hostname + ":13000";
+  string sv3 = hostname + ":13001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardmanager(skv_3, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+  start_shardkvs({sv3}, skv_3);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_join(shardmaster_addr, skv_3, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // a cold key is only served by its owner
+  assert(test_put(skv_1, "user_100", "anna", "", true));
+  assert(test_get(skv_2, "user_100", nullopt));
+
+  // hammer a single key of skv_1 until it is read far more than a group is
+  // meant to serve
+  atomic<bool> stop(false);
+  vector<thread> readers;
+  for (int i = 0; i < 4; i++) {
+    readers.emplace_back([&]() {
+      string value;
+      Addrs copies;
+      while (!stop) get_copies(skv_1, "user_100", &value, &copies);
+    });
+  }
+
+  // its owner tells readers where the copies are, and both other groups
+  // serve them
+  string value;
+  Addrs copies;
+  for (int i = 0; i < 50 && copies.size() < 2; i++) {
+    std::this_thread::sleep_for(timespan / 10);
+    assert(get_copies(skv_1, "user_100", &value, &copies));
+  }
+  sort(copies.begin(), copies.end());
+  assert(copies == Addrs({skv_2, skv_3}));
+  assert(test_get(skv_2, "user_100", "anna"));
+  assert(test_get(skv_3, "user_100", "anna"));
+
+  // once the write returns no copy serves the old value, and the key is
+  // copied again while it stays hot
+  assert(test_put(skv_1, "user_100", "bob", "", true));
+  assert(!get_copies(skv_2, "user_100", &value, &copies) || value == "bob");
+  assert(!get_copies(skv_3, "user_100", &value, &copies) || value == "bob");
+  assert(test_get(skv_2, "user_100", "bob"));
+
+  // and dropped once it cools down
+  stop = true;
+  for (auto& reader : readers) reader.join();
+  std::this_thread::sleep_for(3 * timespan);
+  assert(get_copies(skv_1, "user_100", &value, &copies));
+  assert(value == "bob" && copies.empty());
+  assert(test_get(skv_2, "user_100", nullopt));
+  assert(test_get(skv_3, "user_100", nullopt));
+
+  return 0;
+}
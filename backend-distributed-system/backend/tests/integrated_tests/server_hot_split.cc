@@ -0,0 +1,65 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_100", "anna", "", true));
+  assert(test_put(skv_1, "user_400", "john", "", true));
+
+  // all the traffic goes to skv_1 while skv_2 idles. the writes for user_400
+  // follow it to whichever group owns it
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(4);
+  while (std::chrono::steady_clock::now() < until) {
+    test_put(skv_1, "user_100", "anna", "", true);
+    test_put(skv_1, "user_400", "john", "", true);
+    test_put(skv_2, "user_400", "john", "", true);
+  }
+
+  // skv_1's shard got split between the two hot users, and once the traffic
+  // stopped the piece skv_2 took over was merged with its own shard
+  std::this_thread::sleep_for(3 * timespan);
+  m[skv_1].push_back({0, 127});
+  m[skv_2].push_back({128, 1000});
+  assert(test_query(shardmaster_addr, m));
+
+  assert(test_get(skv_1, "user_100", "anna"));
+  assert(test_get(skv_2, "user_400", "john"));
+  assert(test_get(skv_1, "user_400", nullopt));
+
+  return 0;
+}
@@ -0,0 +1,56 @@
+#include <unistd.h>
+#include <cassert>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  // skv_1 owns the users' lists but has no server yet
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  // posts are stored right away, whatever the state of the group holding the
+  // user's post list
+  auto start = std::chrono::steady_clock::now();
+  assert(test_put(skv_2, "post_600", "hello", "user_1", true));
+  assert(test_put(skv_2, "post_601", "world", "user_1", true));
+  assert(test_put(skv_2, "post_602", "again", "user_2", true));
+  assert(std::chrono::steady_clock::now() - start < timespan);
+  assert(test_get(skv_2, "post_600", "hello"));
+
+  // and the lists are updated once that group is back, each post once
+  start_shardkvs({sv1}, skv_1);
+  assert(test_get(skv_1, "user_1_posts", "post_600,post_601,"));
+  assert(test_get(skv_1, "user_2_posts", "post_602,"));
+
+  assert(test_put(skv_2, "post_603", "more", "user_1", true));
+  assert(test_get(skv_1, "user_1_posts", "post_600,post_601,post_603,"));
+
+  return 0;
+}
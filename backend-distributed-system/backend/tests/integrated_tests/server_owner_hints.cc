@@ -0,0 +1,77 @@
+#include <unistd.h>
+#include <cassert>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_move(shardmaster_addr, skv_1, {600, 800}, true));
+
+  // sleep to allow shardkvs to query and get the config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_700", "edith", "", true));
+
+  // a group that does not own a key names the one that does, through its
+  // manager and when asked directly
+  OwnerHint hint;
+  auto status = put_hinted(skv_2, "user_700", "mary", "", &hint);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  assert(hint.owner == skv_1);
+  assert((hint.shard == shard_t{600, 800}));
+  assert(hint.version > 0);
+  uint64_t version = hint.version;
+  status = put_hinted(sv2, "user_700", "mary", "", &hint);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  assert(hint.owner == skv_1);
+
+  // reads of a key the group does not have say where it is
+  status = get_hinted(skv_2, "user_700", &hint);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  assert(hint.owner == skv_1);
+  assert(test_get(hint.owner, "user_700", "edith"));
+
+  // after a move the hint follows the key, with the newer configuration
+  assert(test_move(shardmaster_addr, skv_2, {650, 750}, true));
+  std::this_thread::sleep_for(timespan);
+  status = put_hinted(skv_1, "user_700", "sybil", "", &hint);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  assert(hint.owner == skv_2);
+  assert((hint.shard == shard_t{650, 750}));
+  assert(hint.version > version);
+  assert(test_put(hint.owner, "user_700", "sybil", "", true));
+  assert(test_get(skv_2, "user_700", "sybil"));
+
+  // a key that is just missing at its owner names no one
+  status = get_hinted(skv_2, "user_701", &hint);
+  assert(status.error_code() == grpc::StatusCode::INVALID_ARGUMENT);
+  assert(hint.owner.empty());
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  // skv_3 never gets a key-value server, so moves towards it cannot complete
+  string skv_3 = hostname + ":13000";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+  start_shardmanager(skv_3, shardmaster_addr);
+
+  start_shardkvs({sv1}, skv_1);
+  start_shardkvs({sv2}, skv_2);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  assert(test_join(shardmaster_addr, skv_2, true));
+  assert(test_join(shardmaster_addr, skv_3, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_100", "anna", "", true));
+  assert(test_put(skv_1, "user_200", "john", "", true));
+  assert(test_put(skv_1, "user_300", "cora", "", true));
+
+  // first hand part of skv_1's range to the unreachable skv_3...
+  assert(test_move(shardmaster_addr, skv_3, {0, 150}, true));
+  std::this_thread::sleep_for(timespan);
+  assert(test_migration_status(sv1, skv_3, false));
+
+  // ...then another part to skv_2, which must not wait behind skv_3
+  assert(test_move(shardmaster_addr, skv_2, {151, 250}, true));
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_get(skv_2, "user_200", "john"));
+  assert(test_migration_status(sv1, skv_2, true));
+  assert(test_get(skv_1, "user_200", nullopt));
+
+  // the key for the unreachable group stays put until it can be delivered
+  assert(test_migration_status(sv1, skv_3, false));
+  assert(test_get(skv_1, "user_100", "anna"));
+  assert(test_get(skv_1, "user_300", "cora"));
+
+  return 0;
+}
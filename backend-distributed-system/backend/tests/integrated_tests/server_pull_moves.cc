@@ -0,0 +1,77 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../shardkv/shardkv.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":11000";
+  string sv1 = hostname + ":11001";
+
+  string skv_2 = hostname + ":12000";
+  string sv2 = hostname + ":12001";
+
+  start_shardmanager(skv_1, shardmaster_addr);
+  start_shardmanager(skv_2, shardmaster_addr);
+
+  // the back-fill is throttled to a crawl, so within this test keys can only
+  // reach skv_2 by being pulled on first access
+  ShardkvOptions options;
+  options.migrationMode = MigrationMode::PULL;
+  start_shardkv(sv1, skv_1, options);
+  options.migrationBandwidth = 1;
+  start_shardkv(sv2, skv_2, options);
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+
+  // sleep to allow shardkvs to query and get initial config
+  std::chrono::milliseconds timespan(1000);
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_put(skv_1, "user_600", "anna", "", true));
+  assert(test_put(skv_1, "user_700", "john", "", true));
+  assert(test_put(skv_1, "user_800", "cora", "", true));
+  assert(test_put(skv_1, "post_650", "hello", "user_600", true));
+  assert(test_put(skv_1, "item_750", "lamp", "", true));
+
+  // skv_2 takes over [501, 1000] and serves it right away
+  assert(test_join(shardmaster_addr, skv_2, true));
+  std::this_thread::sleep_for(timespan);
+
+  assert(test_get(skv_2, "user_800", "cora"));
+  assert(test_get(skv_2, "user_700", "john"));
+  assert(test_get(skv_1, "user_800", nullopt));
+  assert(test_get(skv_1, "user_700", nullopt));
+
+  // a pulled key is only listed if it is a user
+  assert(test_get(skv_2, "item_750", "lamp"));
+  GetResponse users;
+  assert(get_versioned(skv_2, "all_users", 0, &users).ok());
+  assert(users.data().find("user_700,") != string::npos);
+  assert(users.data().find("item_750") == string::npos);
+
+  // a write to a list that was not pulled yet must extend the old list
+  assert(test_put(skv_2, "post_900", "world", "user_600", true));
+  assert(test_get(skv_2, "user_600_posts", "post_650,post_900,"));
+
+  // a key not pulled yet is not served by its old owner either
+  assert(test_get(skv_1, "user_600", nullopt));
+
+  // the rest is still trickling in
+  assert(test_migration_status(sv2, skv_1, false));
+
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <unistd.h>
+#include <cassert>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  ShardmasterOptions options;
+  options.maxKey = MAX_KEY_LIMIT;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  map<string, vector<shard_t>> m;
+
+  const uint64_t half = uint64_t(1) << 63;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({0, MAX_KEY_LIMIT});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({0, half - 1});
+  m[skv_2].push_back({half, MAX_KEY_LIMIT});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // keys past the end of the key space can't be moved
+  assert(!test_move(shardmaster_addr, skv_1, {half, UINT64_MAX}, true));
+
+  // carve thousands of small shards out of the second half, the cost of a
+  // move must not depend on the size of the key space
+  for (uint64_t i = 0; i < 2000; i++) {
+    uint64_t lower = half + i * 1000000;
+    assert(test_move(shardmaster_addr, skv_1, {lower, lower + 9}, true));
+  }
+  for (uint64_t i = 0; i < 2000; i++) {
+    uint64_t lower = half + i * 1000000;
+    m[skv_1].push_back({lower, lower + 9});
+    m[skv_2].push_back({lower + 10, lower + 999999});
+  }
+  m[skv_1].insert(m[skv_1].begin(), {0, half - 1});
+  m[skv_2].back().upper = MAX_KEY_LIMIT;
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // and rebalancing still spreads the whole space evenly
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1].push_back({0, 6148914691236517204ULL});
+  m[skv_2].push_back({6148914691236517205ULL, 12297829382473034409ULL});
+  m[skv_3].push_back({12297829382473034410ULL, MAX_KEY_LIMIT});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_leave(shardmaster_addr, {skv_2}, true));
+  m[skv_1].push_back({0, half - 1});
+  m[skv_3].push_back({half, MAX_KEY_LIMIT});
+  assert(test_query(shardmaster_addr, m));
+
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  ShardmasterOptions options;
+  options.rebalance = RebalanceMode::MINIMAL;
+  start_shardmaster(shardmaster_addr, options);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  map<string, vector<shard_t>> m;
+
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_join(shardmaster_addr, skv_2, true));
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // the new server only takes the surplus of the other two
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1].push_back({0, 333});
+  m[skv_2].push_back({501, 834});
+  m[skv_3].push_back({334, 500});
+  m[skv_3].push_back({835, 1000});
+  assert(test_query(shardmaster_addr, m));
+  map<string, vector<shard_t>> joined = m;
+  m.clear();
+
+  // and a leaving server's keys are handed out without touching the rest.
+  // planning the leave shows exactly that, but changes nothing yet
+  size_t moved = 0;
+  m[skv_1].push_back({0, 333});
+  m[skv_1].push_back({501, 667});
+  m[skv_3].push_back({334, 500});
+  m[skv_3].push_back({668, 1000});
+  assert(test_plan(shardmaster_addr, {}, {skv_2}, m, &moved));
+  assert(moved == 334);
+  assert(test_query(shardmaster_addr, joined));
+  assert(test_leave(shardmaster_addr, {skv_2}, true));
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // with ten servers, an eleventh should only move about a tenth of the keys
+  assert(test_leave(shardmaster_addr, {skv_1, skv_3}, true));
+  for (int i = 1; i <= 10; i++) {
+    assert(test_join(shardmaster_addr, hostname + ":" + to_string(8100 + i),
+                     true));
+  }
+  string skv_11 = hostname + ":8111";
+  // we don't care about the exact layout here, only check the volume
+  test_plan(shardmaster_addr, {skv_11}, {}, m, &moved);
+  assert(moved >= 90 && moved <= 92);
+
+  // the plan wasn't applied, so the newcomer can still join
+  assert(test_join(shardmaster_addr, skv_11, true));
+  // and a bad plan is rejected
+  assert(!test_plan(shardmaster_addr, {skv_11}, {}, m, &moved));
+
+  return 0;
+}
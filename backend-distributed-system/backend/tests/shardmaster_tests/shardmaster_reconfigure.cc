@@ -0,0 +1,94 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+static void add_join(ReconfigureRequest& req, const string& server) {
+  req.add_steps()->mutable_join()->set_server(server);
+}
+
+static void add_leave(ReconfigureRequest& req, const string& server) {
+  req.add_steps()->mutable_leave()->add_servers(server);
+}
+
+static void add_move(ReconfigureRequest& req, const string& server,
+                     const shard_t& shard) {
+  auto move = req.add_steps()->mutable_move();
+  move->set_server(server);
+  move->mutable_shard()->set_lower(shard.lower);
+  move->mutable_shard()->set_upper(shard.upper);
+}
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  string skv_4 = hostname + ":8084";
+  map<string, vector<shard_t>> m;
+  uint64_t version = 0;
+
+  // a whole script of changes is published as a single new version
+  ReconfigureRequest script;
+  add_join(script, skv_1);
+  add_join(script, skv_2);
+  add_join(script, skv_3);
+  add_leave(script, skv_3);
+  add_move(script, skv_1, {501, 600});
+  m[skv_1].push_back({0, 500});
+  m[skv_1].push_back({501, 600});
+  m[skv_2].push_back({601, 1000});
+  assert(test_reconfigure(shardmaster_addr, script, m, &version));
+  assert(version == 1);
+  assert(test_query(shardmaster_addr, m));
+  map<string, vector<shard_t>> current = m;
+  m.clear();
+
+  // a dry run reports the result without applying it
+  ReconfigureRequest dry_run;
+  dry_run.set_dry_run(true);
+  add_leave(dry_run, skv_2);
+  m[skv_1].push_back({0, 1000});
+  assert(test_reconfigure(shardmaster_addr, dry_run, m, &version));
+  assert(version == 1);
+  assert(test_query(shardmaster_addr, current));
+  m.clear();
+
+  // if any step fails, none of them take effect
+  ReconfigureRequest bad;
+  add_join(bad, skv_3);
+  add_leave(bad, skv_4);
+  assert(!test_reconfigure(shardmaster_addr, bad, m, &version));
+  assert(test_query(shardmaster_addr, current));
+  ReconfigureRequest empty;
+  empty.set_dry_run(true);
+  assert(test_reconfigure(shardmaster_addr, empty, current, &version));
+  assert(version == 1);
+
+  // and watchers only ever see the final layout
+  ReconfigureRequest again;
+  add_join(again, skv_3);
+  add_move(again, skv_3, {0, 100});
+  add_leave(again, skv_1);
+  m[skv_2].push_back({0, 500});
+  m[skv_3].push_back({501, 1000});
+  assert(test_reconfigure(shardmaster_addr, again, m, &version));
+  assert(version == 2);
+  uint64_t watched = 0;
+  assert(test_watch(shardmaster_addr, 1, m, &watched));
+  assert(watched == 2);
+
+  return 0;
+}
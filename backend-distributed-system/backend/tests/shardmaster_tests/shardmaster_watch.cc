@@ -0,0 +1,59 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  map<string, vector<shard_t>> m;
+  uint64_t version = 0;
+
+  // a watcher that has seen nothing gets the current config right away
+  assert(test_join(shardmaster_addr, skv_1, true));
+  m[skv_1].push_back({0, 1000});
+  assert(test_watch(shardmaster_addr, 0, m, &version));
+  m.clear();
+
+  // an up to date watcher is told about the next change as it happens
+  std::thread joiner([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    assert(test_join(shardmaster_addr, skv_2, true));
+  });
+  uint64_t seen = version;
+  m[skv_1].push_back({0, 500});
+  m[skv_2].push_back({501, 1000});
+  assert(test_watch(shardmaster_addr, seen, m, &version));
+  assert(version == seen + 1);
+  joiner.join();
+  m.clear();
+
+  std::thread mover([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    assert(test_move(shardmaster_addr, skv_2, {0, 100}, true));
+  });
+  m[skv_1].push_back({101, 500});
+  m[skv_2].push_back({0, 100});
+  m[skv_2].push_back({501, 1000});
+  assert(test_watch(shardmaster_addr, version, m, &version));
+  mover.join();
+
+  // failed requests change nothing, so nothing is pushed
+  assert(test_join(shardmaster_addr, skv_1, false));
+  assert(!test_watch(shardmaster_addr, version, m, &version));
+
+  return 0;
+}
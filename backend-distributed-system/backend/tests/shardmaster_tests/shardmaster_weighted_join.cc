@@ -0,0 +1,66 @@
+#include <unistd.h>
+#include <cassert>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../../shardmaster/shardmaster.h"
+#include "../../test_utils/test_utils.h"
+
+using namespace std;
+
+int main() {
+  char hostnamebuf[256];
+  gethostname(hostnamebuf, 256);
+  string hostname(hostnamebuf);
+
+  string shardmaster_addr = hostname + ":8080";
+  start_shardmaster(shardmaster_addr);
+
+  string skv_1 = hostname + ":8081";
+  string skv_2 = hostname + ":8082";
+  string skv_3 = hostname + ":8083";
+  map<string, vector<shard_t>> m;
+
+  // a server three times the size of the other gets three times the keys
+  assert(test_join(shardmaster_addr, skv_1, 3, true));
+  assert(test_join(shardmaster_addr, skv_2, 1, true));
+  m[skv_1].push_back({0, 750});
+  m[skv_2].push_back({751, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // no weight counts as 1
+  assert(test_join(shardmaster_addr, skv_3, true));
+  m[skv_1].push_back({0, 600});
+  m[skv_2].push_back({601, 800});
+  m[skv_3].push_back({801, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  assert(test_leave(shardmaster_addr, {skv_1}, true));
+  m[skv_2].push_back({0, 500});
+  m[skv_3].push_back({501, 1000});
+  assert(test_query(shardmaster_addr, m));
+  m.clear();
+
+  // a load aware shardmaster also slices by reported load, so the busy keys
+  // of skv_1 are spread over more servers
+  string load_aware_addr = hostname + ":8090";
+  ShardmasterOptions options;
+  options.loadAware = true;
+  start_shardmaster(load_aware_addr, options);
+  assert(test_join(load_aware_addr, skv_1, true));
+  assert(test_join(load_aware_addr, skv_2, true));
+  assert(test_report_load(load_aware_addr, skv_1,
+                          {{{0, 249}, 90}, {{250, 500}, 0}}, true));
+  assert(test_report_load(load_aware_addr, skv_2, {{{501, 1000}, 0}}, true));
+  assert(test_join(load_aware_addr, skv_3, true));
+  m[skv_1].push_back({0, 132});
+  m[skv_2].push_back({133, 333});
+  m[skv_3].push_back({334, 1000});
+  assert(test_query(load_aware_addr, m));
+  m.clear();
+
+  return 0;
+}
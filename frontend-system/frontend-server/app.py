@@ -37,6 +37,26 @@ def updateShardConfig(sc, sm_server):
     response = stub.Query(Empty())
     sc.updateConfig(response)
 
+def learnOwner(sc, err):
+    """
+    Updates the shard config from the owner a shardkv server that turned a request away named
+    in its trailing metadata.
+
+    Inputs:
+    - sc: the shard config
+    - err: the error the request failed with
+
+    Returns:
+    - True if the error named the owner, so the request can be sent there right away
+    """
+    if not isinstance(err, grpc.Call):
+        return False
+    hint = dict(err.trailing_metadata() or ())
+    if not all(key in hint for key in ("x-owner", "x-owner-shard", "x-config-version")):
+        return False
+    lower, upper = (int(bound) for bound in hint["x-owner-shard"].split("-"))
+    return sc.assign(lower, upper, hint["x-owner"], int(hint["x-config-version"]))
+
 def shardmasterGDPRDelete(sm_server, key):
     """
     Sends GDPR Delete request to the shardmaster. 
@@ -69,7 +89,28 @@ def shardkvGet(server, key):
     return response.data
 
 
-def shardkvPut(server, key, data, user=None):
+def shardkvGetVersioned(server, key):
+    """
+    Helper function to make a get request to a shardkv server that also returns the version of
+    the value, for a later conditional write.
+
+    Inputs:
+    - server: the shardkv server
+    - key: the Get request's key
+
+    Returns:
+    - the data and its version
+
+    Raises:
+    - grpc.RpcError: if the status is not grpc.StatusCode.OK
+    """
+    channel = grpc.insecure_channel(server)
+    stub = ShardkvStub(channel)
+    response = stub.Get(GetRequest(key=key))
+    return response.data, response.version
+
+
+def shardkvPut(server, key, data, user=None, if_version=0):
     """
     Helper function to make a put request to a shardkv server.
 
@@ -78,15 +119,17 @@ def shardkvPut(server, key, data, user=None):
     - key: the Put request's key
     - data: the Put request's data
     - user: the Put request's user; only matters if post, so defaults to None
+    - if_version: if not 0, the put only goes ahead if the key is still at this version
 
     Raises:
-    - grpc.RpcError: if the status is not grpc.StatusCode.OK
+    - grpc.RpcError: if the status is not grpc.StatusCode.OK, ABORTED if the key is no longer
+      at if_version
     """
     # Connect to server
     channel = grpc.insecure_channel(server)
     stub = ShardkvStub(channel)
     # Send Put request
-    stub.Put(PutRequest(key=key, data=data, user=user))
+    stub.Put(PutRequest(key=key, data=data, user=user, if_version=if_version))
 
 
 def shardkvAppend(server, key, data):
@@ -126,6 +169,32 @@ def shardkvDelete(server, key):
     stub.Delete(DeleteRequest(key=key))
 
 
+def removePost(server, user_id, post_id):
+    """
+    Removes a post from the list of its user's posts. The list is written back only if no post
+    was added to it since it was read, and read again otherwise.
+
+    Inputs:
+    - server: the shardkv server holding the list
+    - user_id: the user's key
+    - post_id: the post's key
+
+    Raises:
+    - grpc.RpcError: if the status is not grpc.StatusCode.OK
+    """
+    for attempt in range(TRIES):
+        posts, version = shardkvGetVersioned(server, user_id + "_posts")
+        new_posts = filter(None, [s.strip() for s in posts.split(",")])
+        new_posts = ",".join(list(filter(lambda x: x != post_id and x != extractId(post_id), new_posts))) + ","
+        try:
+            shardkvPut(server, user_id + "_posts", new_posts, if_version=version)
+            return
+        except grpc.RpcError as e:
+            # someone else changed the list, read it again unless we are out of tries
+            if e.code() != grpc.StatusCode.ABORTED or attempt == TRIES - 1:
+                raise
+
+
 ### FLASK SERVER
 
 
@@ -168,6 +237,9 @@ def getAllUsers():
             )
         except (IndexError, grpc.RpcError) as e:
             err = e
+            if learnOwner(sc, e):
+                # the server named the current owner, try it right away
+                continue
             print("Error encountered in getAllUsers! Updating cache...")
             updateShardConfig(sc, app.config.get("shardmaster_location"))
         sleep(0.1)
@@ -203,6 +275,9 @@ def addUser():
         # if getShardServer or stub.Put throws an error, cache is outdated, so update and retry
         except (IndexError, grpc.RpcError) as e:
             err = e
+            if learnOwner(sc, e):
+                # the server named the current owner, try it right away
+                continue
             print("Error encountered in addUser! Updating cache...")
             updateShardConfig(sc, app.config.get("shardmaster_location"))
         sleep(0.1)
@@ -233,6 +308,9 @@ def allUserPosts():
             return jsonify({"posts": []})
         except (grpc.RpcError) as e:
             err = e
+            if learnOwner(sc, e):
+                # the server named the current owner, try it right away
+                continue
             print("Error encountered in allUserPosts! Updating cache...")
             updateShardConfig(sc, app.config.get("shardmaster_location"))
         # Sleep for 100ms between queries
@@ -262,6 +340,9 @@ def allUserPosts():
                 break
             except (IndexError, grpc.RpcError) as e:
                 err = e
+                if learnOwner(sc, e):
+                    # the server named the current owner, try it right away
+                    continue
                 print("Error encountered in allUserPosts 2! Updating cache...")
                 updateShardConfig(sc, app.config.get("shardmaster_location"))
             # Sleep for 100ms between queries
@@ -301,6 +382,9 @@ def addPost():
         # if getShardServer or stub.Put throws an error, cache is outdated, so update and retry
         except (IndexError, grpc.RpcError) as e:
             err = e
+            if learnOwner(sc, e):
+                # the server named the current owner, try it right away
+                continue
             print("Error encountered in addPost! Updating cache...")
             updateShardConfig(sc, app.config.get("shardmaster_location"))
         # Sleep for 100ms between queries
@@ -350,14 +434,14 @@ def deletePost():
             post_server = sc.getShardServer(extractId(post_id))
             shardkvDelete(post_server, post_id)
             user_server = sc.getShardServer(extractId(user_id))
-            posts = shardkvGet(user_server, user_id + "_posts")
-            new_posts = filter(None, [s.strip() for s in posts.split(",")])
-            new_posts = ",".join(list(filter(lambda x: x != post_id and x != extractId(post_id), new_posts))) + ","
-            shardkvPut(user_server, user_id + "_posts", new_posts)
+            removePost(user_server, user_id, post_id)
 
             return jsonify({"postServer": post_server, "userServer": user_server})
         except (IndexError, grpc.RpcError) as e:
             err = e
+            if learnOwner(sc, e):
+                # the server named the current owner, try it right away
+                continue
             print("Error encountered in deletePost! Updating cache...")
             updateShardConfig(sc, app.config.get("shardmaster_location"))
         # Sleep for 100ms between queries
@@ -18,6 +18,7 @@ class ShardConfig:
 
     def __init__(self):
         self.config = SortedDict()
+        self.version = 0
 
     def __repr__(self):
         config_str = "Shard Config: [\n"
@@ -35,10 +36,40 @@ class ShardConfig:
         - proto_config: a shardmaster_pb2.QueryResponse
         """
         self.config.clear()
+        self.version = proto_config.version
         for config in proto_config.config:
             for shard in config.shards:
                 self.config[shard.upper] = Shard(shard.lower, config.server)
 
+    def assign(self, lower, upper, server, version):
+        """
+        Puts the shard [lower, upper] on server, taking it off the servers holding parts of it,
+        unless the cache is newer than version.
+
+        Inputs:
+        - lower, upper: the bounds of the shard
+        - server: the shardkv server now responsible for it
+        - version: the version of the configuration that says so
+
+        Returns:
+        - True if the cache was updated
+        """
+        if version < self.version:
+            return False
+        for shard_key in list(self.config.irange(lower)):
+            shard = self.config[shard_key]
+            if shard.lower > upper:
+                break
+            del self.config[shard_key]
+            # the parts sticking out on either side stay where they were
+            if shard.lower < lower:
+                self.config[lower - 1] = Shard(shard.lower, shard.server)
+            if shard_key > upper:
+                self.config[shard_key] = Shard(upper + 1, shard.server)
+        self.config[upper] = Shard(lower, server)
+        self.version = version
+        return True
+
     def getShardServer(self, key_id):
         """
         Retrieves the shardkv server string responsible for the key ID.